@@ -0,0 +1,73 @@
+// Checks that TaskStorage gives its items back. Built by memory_test.pro, run with make check
+
+#include <QtTest>
+#include "../timeline.h"
+
+class MemoryTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static void fill(TaskStorage& storage, const int& taskCount, const int& eventCount);
+
+    private slots:
+    void clearReleasesItems();
+    void clearReleasesArena();
+};
+
+void MemoryTest::fill(TaskStorage& storage, const int& taskCount, const int& eventCount)
+{
+    const QDateTime startTime = QDateTime::currentDateTime();
+
+    for (int task = 0; task < taskCount; ++task)
+    {
+        storage.addTask(storage.createTask(startTime, QDateTime(), task + 1, true,
+                                           QString("Task %1").arg(task + 1), TASK_TYPE_TEST_EXAMPLE));
+
+        for (int event = 0; event < eventCount; ++event)
+        {
+            QDateTime eventTime = startTime.addMSecs(event * 100);
+            storage.addEvent(task + 1, storage.createEvent(eventTime, eventTime.addMSecs(10), EventItem::EVENT_STATUS_SUCCEDED,
+                                                           quint64(task) * eventCount + event + 1));
+        }
+    }
+}
+
+void MemoryTest::clearReleasesItems()
+{
+    TaskStorage storage;
+    fill(storage, 4, 1000);
+
+    // Events used to own their task, the cycle kept both alive after clear()
+    std::weak_ptr<TaskItem> task = storage.getTask(1);
+    std::weak_ptr<EventItem> event = storage.getEvent(1);
+    QVERIFY(!task.expired());
+    QVERIFY(!event.expired());
+
+    storage.clear();
+
+    QVERIFY(task.expired());
+    QVERIFY(event.expired());
+}
+
+void MemoryTest::clearReleasesArena()
+{
+    TaskStorage storage;
+    TimeLineSlabArena::Stats before = storage.getAllocatorStats();
+
+    fill(storage, 16, 10000);
+
+    TimeLineSlabArena::Stats filled = storage.getAllocatorStats();
+    QVERIFY(filled.chunkCount > before.chunkCount);
+    QVERIFY(filled.bytesReserved > before.bytesReserved);
+
+    storage.clear();
+
+    TimeLineSlabArena::Stats after = storage.getAllocatorStats();
+    QCOMPARE(after.chunkCount, before.chunkCount);
+    QCOMPARE(after.bytesInUse, before.bytesInUse);
+    QCOMPARE(after.bytesReserved, before.bytesReserved);
+}
+
+QTEST_MAIN(MemoryTest)
+#include "memory_test.moc"
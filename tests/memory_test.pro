@@ -0,0 +1,10 @@
+QT += testlib widgets svg concurrent
+CONFIG += c++14 testcase console
+CONFIG -= app_bundle
+
+TARGET = memory_test
+INCLUDEPATH += ..
+
+HEADERS += ../timeline.h
+SOURCES += memory_test.cpp \
+           ../timeline.cpp
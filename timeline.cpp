@@ -1,654 +1,4239 @@
 #include "timeline.h"
 
+#include <QtConcurrent>
+
 //////////////////////////////////////////////////////////////////////////////
-///////////////             AbstractTimeLineItem         /////////////////////
+///////////////             TimeLineTime                //////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
-AbstractItem::AbstractItem(QDateTime startTime, QDateTime endTime) :
-                           mStartTime(startTime),
-                           mEndTime(endTime)
+const qint64 TimeLineTime::microsecond;
+const qint64 TimeLineTime::millisecond;
+const qint64 TimeLineTime::second;
+const qint64 TimeLineTime::minute;
+const qint64 TimeLineTime::hour;
+const qint64 TimeLineTime::day;
+const qint64 TimeLineTime::week;
+const qint64 TimeLineTime::month;
+const qint64 TimeLineTime::year;
+const qint64 TimeLineTime::decade;
+const qint64 TimeLineTime::mInvalidTime;
+const qint64 TimeLineTime::mMinTime;
+const qint64 TimeLineTime::mMaxTime;
+
+qint64 TimeLineTime::fromDateTime(const QDateTime& time)
 {
+    if (!time.isValid()){
+        return mInvalidTime;
+    }
 
-}
+    qint64 msecs = time.toMSecsSinceEpoch();
+    if (msecs > mMaxTime / millisecond){
+        return mMaxTime;
+    }
+    else if (msecs < mMinTime / millisecond){
+        return mMinTime;
+    }
 
-void AbstractItem::setStartTime(const QDateTime startTime)
-{
-    mStartTime = startTime;
+    return msecs * millisecond;
 }
 
-void AbstractItem::setEndTime(const QDateTime endTime)
+QDateTime TimeLineTime::toDateTime(const qint64& time)
 {
-    mEndTime = endTime;
+    if (time == mInvalidTime){
+        return QDateTime();
+    }
+
+    // Rounded towards the past for the times before the epoch too
+    qint64 msecs = time / millisecond;
+    if (time % millisecond < 0){
+        --msecs;
+    }
+
+    return QDateTime::fromMSecsSinceEpoch(msecs);
 }
 
-QDateTime AbstractItem::getStartTime() const
+qint64 TimeLineTime::currentTime()
 {
-    return mStartTime;
+    return fromDateTime(QDateTime::currentDateTimeUtc());
 }
 
-QDateTime AbstractItem::getEndTime() const
+qint64 TimeLineTime::add(const qint64& time, const qint64& span)
 {
-    return mEndTime;
+    if (span > 0 && time > mMaxTime - span){
+        return mMaxTime;
+    }
+    else if (span < 0 && time < mMinTime - span){
+        return mMinTime;
+    }
+
+    return time + span;
 }
 
-QPair <QDateTime, QDateTime> AbstractItem::getIntersection(const QDateTime& startTime, const QDateTime& endTime) const
+qint64 TimeLineTime::scale(const qint64& span, const double& factor)
 {
-    QPair<QDateTime, QDateTime> intersection;
+    double result = std::nearbyint(double(span) * factor);
 
-    if (startTime < endTime){
-        intersection = QPair <QDateTime, QDateTime>(std::max(startTime, mStartTime), std::min(endTime, mEndTime));
+    // Both bounds round to +-2^63 as doubles, the lower one is the invalid time
+    if (result != result){
+        return 0;
     }
-
-    // If there is no intersection, invalidate result
-    if (intersection.first >= intersection.second){
-        intersection = QPair<QDateTime, QDateTime>();
+    else if (result >= double(mMaxTime)){
+        return mMaxTime;
+    }
+    else if (result <= double(mMinTime)){
+        return mMinTime;
     }
 
-    return intersection;
+    return qint64(result);
 }
 
-//////////////////////////////////////////////////////////////////////////////
-///////////////                TaskItem                  /////////////////////
-//////////////////////////////////////////////////////////////////////////////
-
-TaskItem::TaskItem(const QDateTime startTime, const QDateTime endTime, const quint64& taskId,
-                   const bool& isInfinite, const QString taskName, const TimeLineTaskType& taskType) :
-
-                   mTaskId(taskId),
-                   mIsInfinite(isInfinite),
-                   mTaskType(taskType),
-                   mTaskName(taskName),
-                   AbstractItem(startTime, endTime)
+double TimeLineTime::toDouble(const qint64& span)
 {
-    if (!mEndTime.isValid()){
-        mEndTime = isInfinite? QDateTime::currentDateTime().addYears(INFINITY) : mStartTime;
-    }
+    return double(span);
 }
 
-bool TaskItem::addEvent(EventItemPtr event)
+QString TimeLineTime::toString(const qint64& time, const QString& format, const int& fractionDigits)
 {
-    Q_ASSERT(event != nullptr);
-    if (event == nullptr){
-        return false;
+    QDateTime dateTime = toDateTime(time);
+    if (!dateTime.isValid()){
+        return QString();
     }
 
-    if (!mEvent.contains(event->getStartTime()))
-    {
-        mEvent.insert(event->getEndTime(), event);
-        if (event->getStatus() == EventItem::EVENT_STATUS_FAILURE)
-        {
-            QDateTime failureTime = QDateTime::fromMSecsSinceEpoch(
-                        event->getStartTime().toMSecsSinceEpoch() / 2 +
-                        event->getEndTime().toMSecsSinceEpoch() / 2);
+    QString text = dateTime.toString(format);
+    int digits = qBound(0, fractionDigits, 6);
 
-            mEventsWithInfoSigh.insert(failureTime, event);
+    if (digits > 0)
+    {
+        qint64 fraction = time % second;
+        if (fraction < 0){
+            fraction += second;
         }
 
-        if (!mIsInfinite && (mEndTime < event->getEndTime() || !mEndTime.isValid())){
-            mEndTime = event->getEndTime();
+        for (int digit = digits; digit < 6; ++digit){
+            fraction /= 10;
         }
+
+        text += QString(".%1").arg(fraction, digits, 10, QChar('0'));
     }
 
-    return true;
+    return text;
 }
 
-bool TaskItem::isInfinite() const
+//////////////////////////////////////////////////////////////////////////////
+///////////////             AbstractTimeLineItem         /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+AbstractItem::AbstractItem(QDateTime startTime, QDateTime endTime) :
+                           mStartTime(TimeLineTime::fromDateTime(startTime)),
+                           mEndTime(TimeLineTime::fromDateTime(endTime))
 {
-    return mIsInfinite;
+
 }
 
-quint32 TaskItem::eventCount() const
+AbstractItem::AbstractItem(const qint64& startTime, const qint64& endTime) :
+                           mStartTime(startTime),
+                           mEndTime(endTime)
 {
-    return mEvent.size();
+
 }
 
-const QMap<QDateTime, EventItemPtr> &TaskItem::getEvents() const
+void AbstractItem::setStartTime(const QDateTime startTime)
 {
-    return mEvent;
+    mStartTime = TimeLineTime::fromDateTime(startTime);
 }
 
-const QMap<QDateTime, EventItemPtr> &TaskItem::getEventsWithInfoIcon() const
+void AbstractItem::setEndTime(const QDateTime endTime)
 {
-    return mEventsWithInfoSigh;
+    setEndTimeUs(TimeLineTime::fromDateTime(endTime));
 }
 
-quint64 TaskItem::getTaskId() const
+void AbstractItem::setStartTimeUs(const qint64& startTime)
 {
-    return mTaskId;
+    mStartTime = startTime;
 }
 
-TimeLineTaskType TaskItem::getTaskType() const
+void AbstractItem::setEndTimeUs(const qint64& endTime)
 {
-    return mTaskType;
+    mEndTime = endTime;
 }
 
-QString TaskItem::getTaskName() const
+QDateTime AbstractItem::getStartTime() const
 {
-    return mTaskName;
+    return TimeLineTime::toDateTime(mStartTime);
 }
 
-AbstractItem::ItemType TaskItem::getItemType() const
+QDateTime AbstractItem::getEndTime() const
 {
-    return ITEM_TYPE_TASK;
+    return TimeLineTime::toDateTime(mEndTime);
 }
 
-//////////////////////////////////////////////////////////////////////////////
-///////////////                EventItem                 /////////////////////
-//////////////////////////////////////////////////////////////////////////////
-
-EventItem::EventItem(QDateTime startTime, QDateTime endTime, EventStatus stat) :
-                     AbstractItem(startTime, endTime),
-                     mStatus(stat)
+qint64 AbstractItem::getStartTimeUs() const
 {
+    return mStartTime;
+}
 
+qint64 AbstractItem::getEndTimeUs() const
+{
+    return mEndTime;
 }
 
-bool EventItem::setParentTask(TaskItemPtr task)
+QPair<qint64, qint64> AbstractItem::getIntersection(const qint64& startTime, const qint64& endTime) const
 {
-    Q_ASSERT(task != nullptr);
-    if (task == nullptr){
-        return false;
+    QPair<qint64, qint64> intersection(0, 0);
+
+    if (startTime < endTime){
+        intersection = QPair<qint64, qint64>(std::max(startTime, mStartTime), std::min(endTime, mEndTime));
     }
 
-    mParentTask = task;
-    return true;
-}
+    // If there is no intersection, invalidate result
+    if (intersection.first >= intersection.second){
+        intersection = QPair<qint64, qint64>(0, 0);
+    }
 
-const TaskItemPtr EventItem::getParentTask() const
-{
-    return mParentTask;
+    return intersection;
 }
 
-EventItem::EventStatus EventItem::getStatus() const
+//////////////////////////////////////////////////////////////////////////////
+///////////////                EventBlock                /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+EventBlock::EventBlock()
 {
-    return mStatus;
+    mStartTimes.reserve(mCapacity);
+    mEndTimes.reserve(mCapacity);
+    mEvents.reserve(mCapacity);
 }
 
-AbstractItem::ItemType EventItem::getItemType() const
+void EventBlock::insert(const EventItemPtr& event)
 {
-    return ITEM_TYPE_EVENT;
+    Q_ASSERT(!isFull());
+
+    qint64 startTime = event->getStartTimeUs();
+    int pos = std::upper_bound(mStartTimes.begin(), mStartTimes.end(), startTime) - mStartTimes.begin();
+
+    mStartTimes.insert(pos, startTime);
+    mEndTimes.insert(pos, event->getEndTimeUs());
+    mEvents.insert(pos, event);
 }
 
-//////////////////////////////////////////////////////////////////////////////
-///////////////             TimeLineGrid                //////////////////////
-//////////////////////////////////////////////////////////////////////////////
+void EventBlock::split(EventBlock& upperHalf)
+{
+    Q_ASSERT(upperHalf.size() == 0);
+    int middle = mEvents.size() / 2;
 
+    for (int pos = middle; pos < mEvents.size(); ++pos)
+    {
+        upperHalf.mStartTimes.append(mStartTimes[pos]);
+        upperHalf.mEndTimes.append(mEndTimes[pos]);
+        upperHalf.mEvents.append(mEvents[pos]);
+    }
 
-const QString TimeLineGrid::mTimeFormat = "hh:mm:ss";
-const QString TimeLineGrid::mDayFormat = "dd:MM:yy";
-const double TimeLineGrid::mOverlayOpacity = 0.3;
+    mStartTimes.resize(middle);
+    mEndTimes.resize(middle);
+    mEvents.resize(middle);
+}
 
-TimeLineGrid::TimeLineGrid(QGraphicsItem *parent) : QGraphicsItem(parent)
+void EventBlock::remove(const int& from, const int& to)
 {
+    Q_ASSERT(0 <= from && from <= to && to <= mEvents.size());
 
+    mStartTimes.remove(from, to - from);
+    mEndTimes.remove(from, to - from);
+    mEvents.remove(from, to - from);
 }
 
-void TimeLineGrid::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
-{    
-#ifdef DEBUG
-    painter->drawText(mSettings.borderIndentX + 10,
-                      mSize.height() - 30 - mSettings.borderIndentX,
-                      "BeginTime : " + mTimeCenterMark.addMSecs(-1 * (quint64)mTimeDelta).toString());
-
-    painter->drawText(mSettings.borderIndentX + 10,
-                      mSize.height() - 15 - mSettings.borderIndentX,
-                      "EndTime : " + mTimeCenterMark.addMSecs((quint64)mTimeDelta).toString());
-
-    painter->drawText(mSettings.borderIndentX + 10,
-                      mSize.height() - 45 - mSettings.borderIndentX,
-                      "MousePos : " + QString::number(mMousePos.x()));
-#endif
+void EventBlock::remove(const QVector<int>& positions)
+{
+    if (positions.isEmpty()){
+        return;
+    }
 
-    painter->setPen(QPen(mStyle.borderColor));
+    // The kept events are moved down over the removed ones in a single pass
+    int kept = positions.first();
+    int next = 0;
 
-    // Paint item area border
-    painter->drawRect(graphicsRect());
+    for (int pos = positions.first(); pos < mEvents.size(); ++pos)
+    {
+        if (next < positions.size() && positions[next] == pos)
+        {
+            ++next;
+            continue;
+        }
 
-    // Paint central mark and mouse mark and corresponding texts
-    if (mTimeCenterMark.isValid()){
-        drawMarks(painter);
+        mStartTimes[kept] = mStartTimes[pos];
+        mEndTimes[kept] = mEndTimes[pos];
+        mEvents[kept] = mEvents[pos];
+        ++kept;
     }
+
+    mStartTimes.resize(kept);
+    mEndTimes.resize(kept);
+    mEvents.resize(kept);
 }
 
-void TimeLineGrid::drawMarks(QPainter *painter)
+void EventBlock::setEndTime(const int& pos, const qint64& endTime)
 {
-    quint64 startTime = mTimeCenterMark.toMSecsSinceEpoch() - mTimeDelta;
-    quint64 endTime = mTimeCenterMark.toMSecsSinceEpoch() + mTimeDelta;
-    quint64 currTime = QDateTime::currentDateTime().toMSecsSinceEpoch();
-    double msecPerPixel = (2 * mTimeDelta) / mSize.width();    
+    Q_ASSERT(0 <= pos && pos < mEndTimes.size());
+    mEndTimes[pos] = endTime;
+}
 
-    QFont font = painter->font();
-    QFontMetrics fm(font);
-    QString textFormat = 2 * mTimeDelta < day ? mTimeFormat : mDayFormat;
-    font.setPointSize(mSettings.borderIndentY * 0.5);
+int EventBlock::size() const
+{
+    return mEvents.size();
+}
 
-    // Current time mark and it's text
-    QPair<int, int> currTimeMarkBorders(-1, -1);
-    drawCurrTimeMark(msecPerPixel, currTime, startTime, endTime,
-                     currTimeMarkBorders, textFormat, fm, painter);
+bool EventBlock::isFull() const
+{
+    return mEvents.size() >= mCapacity;
+}
 
-    // Mouse time mark and it's text
-    drawMouseTimeMark(painter);
+qint64 EventBlock::firstStartTime() const
+{
+    return mStartTimes.first();
+}
 
+qint64 EventBlock::lastStartTime() const
+{
+    return mStartTimes.last();
+}
 
-    // Grid marks
-    drawGridMarks(fm, msecPerPixel, startTime, textFormat, currTimeMarkBorders, painter);
+int EventBlock::lowerBound(const qint64& startTime) const
+{
+    return std::lower_bound(mStartTimes.begin(), mStartTimes.end(), startTime) - mStartTimes.begin();
 }
 
-void TimeLineGrid::drawGridMarks(const QFontMetrics& fm, const double& msecPerPixel,
-                                 quint64& startTime, const QString textFormat,
-                                 QPair<int, int> &currTimeMarkBorders, QPainter *painter)
+const qint64* EventBlock::startTimes() const
 {
-    painter->setPen(QPen(mStyle.timeMarksTextColor));
+    return mStartTimes.constData();
+}
 
-    // calculate step between grid items in msec
-    double pixelsPerMsec = 1 / msecPerPixel;
-    double part = mMousePos.x() / mSize.width();
-    quint64 mSecSinseStart = 2 * mTimeDelta*part + mTimeCenterMark.addMSecs(-1 * (quint64)mTimeDelta).toMSecsSinceEpoch();
-    QString mouseTimeString = QDateTime().fromMSecsSinceEpoch(mSecSinseStart).toString("dd.MM.yy hh:mm:ss");
-    quint16 textWidth = fm.width(mouseTimeString);
-    quint16 maxNumberOfTextMarks = mSize.width() / (textWidth*1.5);
-    int triangleRectWidth = (mSettings.borderIndentY - fm.height()) / 2 + 1;
+const qint64* EventBlock::endTimes() const
+{
+    return mEndTimes.constData();
+}
 
-    if (maxNumberOfTextMarks == 0){
-        return;
-    }
+EventItemPtr EventBlock::event(const int& pos) const
+{
+    return mEvents[pos];
+}
 
-    quint64 stepMsec = calculateStep(maxNumberOfTextMarks);
+//////////////////////////////////////////////////////////////////////////////
+///////////////             ColdEventBlock               /////////////////////
+//////////////////////////////////////////////////////////////////////////////
 
-    // find first item
-    quint64 timeMark = startTime;
-    if (startTime % stepMsec){
-        timeMark = (startTime / stepMsec - 1)*stepMsec;
-    }
+std::atomic<quint64> ColdEventBlock::mNextBlockId(1);
 
-    while (true)
+static void appendVarint(QByteArray& data, quint64 value)
+{
+    while (value >= 0x80)
     {
-        // to make text appear smoothly
-        int pos = timeMark > startTime ?
-            pixelsPerMsec * (timeMark - startTime) : -pixelsPerMsec * (startTime - timeMark);
+        data.append(char(value | 0x80));
+        value >>= 7;
+    }
 
-        QString timeText = QDateTime().fromMSecsSinceEpoch(timeMark).toString(textFormat);
-        if (pos - fm.width(timeText) / 2 < mSize.width() - mSettings.borderIndentX)
-        {
-            // make an item semitransparent when it overlays the current mark text
-            double opacity = 1;
-            if (currTimeMarkBorders.first != -1 && currTimeMarkBorders.second != -1)
-            {
-                QPair<int, int> intersection(std::max(currTimeMarkBorders.first, pos - fm.width(timeText) / 2),
-                                             std::min(currTimeMarkBorders.second, pos + fm.width(timeText) / 2));
+    data.append(char(value));
+}
 
-                if (intersection.first < intersection.second){
-                    opacity = mOverlayOpacity;
-                }
-            }
+static quint64 readVarint(const char*& pos)
+{
+    quint64 value = 0;
 
-            painter->setOpacity(opacity);
-            painter->drawLine(pos, mSettings.borderIndentY, pos, mSettings.borderIndentY - triangleRectWidth);
-            paintText(true, pos, timeText, painter, mStyle.timeMarksTextColor);
+    for (int shift = 0; ; shift += 7)
+    {
+        quint8 byte = *pos++;
+        value |= quint64(byte & 0x7f) << shift;
 
-            timeMark += stepMsec;
-        }
-        else{
+        if (!(byte & 0x80)){
             break;
         }
     }
+
+    return value;
 }
 
-void TimeLineGrid::drawCurrTimeMark(const double &msecPerPixel, const quint64 &currTime, const quint64& endTime,
-                                    const quint64 &startTime, QPair<int, int>& currTimeMarkBorders,
-                                    const QString textFormat, const QFontMetrics &fm, QPainter *painter)
+// Small negative deltas stay short
+static quint64 zigZagEncode(const qint64& value)
 {
-    // Current time mark and it's text
-    QString currMarkTimeString = mTimeCenterMark.toString(textFormat);
-    quint16 currTimeMarkWidth = fm.width(currMarkTimeString);
-    quint64 currTimeMarkWidthMsec = currTimeMarkWidth * msecPerPixel;
+    return (quint64(value) << 1) ^ quint64(value >> 63);
+}
 
-    QPair<quint64, quint64> intersection(std::max(currTime - currTimeMarkWidthMsec, startTime),
-                                         std::min(currTime + currTimeMarkWidthMsec, endTime));
+static qint64 zigZagDecode(const quint64& value)
+{
+    return qint64(value >> 1) ^ -qint64(value & 1);
+}
 
-    if (intersection.first < intersection.second)
-    {
-        painter->setPen(QPen(mStyle.currMarkColor));
+ColdEventBlock::ColdEventBlock(const QVector<EventItemPtr>& events) :
+    mBlockId(mNextBlockId++),
+    mCount(events.size()),
+    mFirstStartTime(0),
+    mLastStartTime(0),
+    mMaxEndTime(std::numeric_limits<qint64>::min()),
+    mMinEventId(std::numeric_limits<quint64>::max()),
+    mMaxEventId(0),
+    mStatusCounts(EventItem::EVENT_STATUS_INVALID + 1, 0)
+{
+    Q_ASSERT(!events.isEmpty());
+    if (events.isEmpty()){
+        return;
+    }
 
-        double pixelsPerMsec = 1/msecPerPixel;
-        int currTimePos = (currTime > startTime) ?
-            pixelsPerMsec * (currTime - startTime) : -pixelsPerMsec * (startTime - currTime);
+    mFirstStartTime = events.first()->getStartTimeUs();
+    mLastStartTime = events.last()->getStartTimeUs();
 
-        currTimeMarkBorders.first = currTimePos - currTimeMarkWidth;
-        currTimeMarkBorders.second = currTimePos + currTimeMarkWidth;
+    // Per event: start delta, duration, status, id delta, run length, payload id, gap count, the gap bounds and the merged starts as deltas
+    qint64 prevStartTime = mFirstStartTime;
+    qint64 prevEventId = 0;
 
-        // line
-        if (currTimePos < mSize.width() - mSettings.borderIndentX &&
-            currTimePos > mSettings.borderIndentX)
+    for (auto& event : events)
+    {
+        qint64 startTime = event->getStartTimeUs();
+        qint64 endTime = event->getEndTimeUs();
+        Q_ASSERT(startTime >= prevStartTime);
+
+        appendVarint(mData, startTime - prevStartTime);
+        appendVarint(mData, zigZagEncode(endTime - startTime));
+        mData.append(char(event->getStatus()));
+        appendVarint(mData, zigZagEncode(qint64(event->getEventId()) - prevEventId));
+        appendVarint(mData, event->getRunLength());
+        appendVarint(mData, event->getPayloadId());
+
+        const QVector<qint64>& gaps = event->getRunGaps();
+        appendVarint(mData, gaps.size() / 2);
+
+        qint64 prevBound = startTime;
+        for (auto& bound : gaps)
         {
-            painter->drawLine(currTimePos, mSettings.borderIndentY, currTimePos, mSize.height() - mSettings.borderIndentY);
+            appendVarint(mData, bound - prevBound);
+            prevBound = bound;
         }
 
-        // curr time mark text, the size is calculated depending on the indent from the border
-        paintText(true, currTimePos, currMarkTimeString, painter, mStyle.currMarkColor);
-    }
-}
-
-void TimeLineGrid::drawMouseTimeMark(QPainter *painter)
-{
-    // The mouse mark and it's text
-    painter->setPen(QPen(mStyle.mouseMarkColor));
-
-    // line, border check
-    int linePosX = mMousePos.x();
-    QRect area = graphicsRect();
+        qint64 prevRunStart = startTime;
+        for (auto& runStart : event->mRunStarts)
+        {
+            appendVarint(mData, runStart - prevRunStart);
+            prevRunStart = runStart;
+        }
 
-    if (linePosX < area.left()){
-        linePosX = area.left();
-    }
-    else if (linePosX > area.right()){
-        linePosX = area.right();
+        prevStartTime = startTime;
+        prevEventId = event->getEventId();
+        mMaxEndTime = std::max(mMaxEndTime, endTime);
+        mMinEventId = std::min(mMinEventId, event->getEventId());
+        mMaxEventId = std::max(mMaxEventId, event->getEventId());
+        mStatusCounts[std::min<int>(event->getStatus(), EventItem::EVENT_STATUS_INVALID)] += event->getRunLength();
     }
 
-    painter->drawLine(linePosX, mSettings.borderIndentY, linePosX, mSize.height() - mSettings.borderIndentY);
-
-    // mouse time mark text, the size is calculated depending on the indent from the border
-    double part = mMousePos.x() / mSize.width();
-    quint64 mSecSinseStart = 2 * mTimeDelta*part + mTimeCenterMark.addMSecs(-1 * (quint64)mTimeDelta).toMSecsSinceEpoch();
-    QString mouseTimeString = QDateTime().fromMSecsSinceEpoch(mSecSinseStart).toString("dd.MM.yy hh:mm:ss");
-    paintText(false, linePosX, mouseTimeString, painter, mStyle.mouseMarkColor);
+    mData.squeeze();
 }
 
-quint64 TimeLineGrid::calculateStep(const int& maxNumberOfTextMarks)
+QVector<EventItemPtr> ColdEventBlock::decode(const TaskItemPtr& parentTask) const
 {
-    quint64 stepMsec = 2 * mTimeDelta / maxNumberOfTextMarks;
-    const quint64 month = (quint64)day * 30;
-    const quint64 year = (quint64)day * 365;
-
-    if (stepMsec < second){
-        return quint64(-1); //error value
-    }
+    QVector<EventItemPtr> events;
+    events.reserve(mCount);
 
-    quint64 timeUnit = second;
-    quint64 tempStepMsec = stepMsec;
+    const char* pos = mData.constData();
+    qint64 startTime = mFirstStartTime;
+    qint64 eventId = 0;
 
-    while (true)
+    for (int eventNum = 0; eventNum < mCount; ++eventNum)
     {
-        if (tempStepMsec >= minute &&  tempStepMsec < hour){
-            timeUnit = minute;
-        }
-        else if (tempStepMsec >= hour &&  tempStepMsec < day){
-            timeUnit = hour;
-        }
-        else if (tempStepMsec >= day &&  tempStepMsec < month){
-            timeUnit = day;
-        }
-        else if (tempStepMsec >= month && tempStepMsec < year){
-            timeUnit = month;
-        }
-        else if (tempStepMsec >= year){
-            timeUnit = year;
-        }
+        startTime += readVarint(pos);
+        qint64 endTime = startTime + zigZagDecode(readVarint(pos));
+        EventItem::EventStatus status = EventItem::EventStatus(quint8(*pos++));
+        eventId += zigZagDecode(readVarint(pos));
 
-        int numberOfUnits = tempStepMsec / timeUnit;
-        if (numberOfUnits > 2){
-            numberOfUnits = 5 * std::ceil((double)numberOfUnits / 5);
-        }
+        EventItemPtr event = std::make_shared<EventItem>(startTime, endTime, status, eventId);
+        event->mRunLength = readVarint(pos);
+        event->mPayloadId = readVarint(pos);
 
-        tempStepMsec = numberOfUnits * timeUnit;
-        int currNumberOfTimeMarks = 2 * mTimeDelta / tempStepMsec;
+        int gapCount = readVarint(pos);
+        event->mRunGaps.reserve(2 * gapCount);
 
-        if (currNumberOfTimeMarks > maxNumberOfTextMarks) //minutes or seconds
+        qint64 bound = startTime;
+        for (int gap = 0; gap < 2 * gapCount; ++gap)
         {
-            switch (timeUnit)
-            {
-            case second: tempStepMsec += second; break;
-            case minute: tempStepMsec += minute; break;
-            case hour: tempStepMsec   += hour; break;
-            case day: tempStepMsec    += day; break;
-            case month: tempStepMsec  = year; break;
-            case year: tempStepMsec   += year; break;
-            default: break;
-            }
-
-            continue;
+            bound += readVarint(pos);
+            event->mRunGaps.append(bound);
         }
 
-        if ((timeUnit == second || timeUnit == minute) && numberOfUnits > mMaxNumberOfUnits)
+        qint64 runStart = startTime;
+        event->mRunStarts.reserve(event->mRunLength - 1);
+
+        for (quint32 merged = 1; merged < event->mRunLength; ++merged)
         {
-            tempStepMsec = 60 * timeUnit; // promote to the next time unit
-            continue;
+            runStart += readVarint(pos);
+            event->mRunStarts.append(runStart);
         }
 
-        if (2 * mTimeDelta > day && timeUnit < day){
-            tempStepMsec = day;
+        if (parentTask != nullptr){
+            event->setParentTask(parentTask);
         }
 
-        stepMsec = tempStepMsec;
-        break;
+        events.append(event);
     }
 
-    return stepMsec;
+    Q_ASSERT(pos == mData.constData() + mData.size());
+    return events;
 }
 
-void TimeLineGrid::paintText(bool topBottom, int xPos, QString text, QPainter* painter, QColor color)
+quint64 ColdEventBlock::getBlockId() const
 {
-    QPen pen = painter->pen();
-    QFont font = painter->font();
-    QFontMetrics fm(font);
+    return mBlockId;
+}
 
-    pen.setColor(color);
-    painter->setPen(pen);
+int ColdEventBlock::size() const
+{
+    return mCount;
+}
 
-    int yPos = topBottom ? (mSettings.borderIndentY - fm.height()) / 2 :
-                            mSize.height() - fm.height() - (mSettings.borderIndentY - fm.height()) / 2;
+int ColdEventBlock::byteSize() const
+{
+    return mData.size();
+}
 
-    QRect textRect(xPos - fm.width(text) / 2, yPos, fm.width(text), fm.height());
-    painter->drawText(textRect, Qt::AlignCenter, text);
+qint64 ColdEventBlock::getFirstStartTime() const
+{
+    return mFirstStartTime;
 }
 
-bool TimeLineGrid::setTimeRange(const QDateTime& centralTime, const quint64& timeDelta)
+qint64 ColdEventBlock::getLastStartTime() const
 {
-    // If the new scale is valid, set it
-    if (timeDelta >= mSettings.maximumScale && timeDelta <= mSettings.minimumScale)
+    return mLastStartTime;
+}
+
+qint64 ColdEventBlock::getMaxEndTime() const
+{
+    return mMaxEndTime;
+}
+
+quint64 ColdEventBlock::getMinEventId() const
+{
+    return mMinEventId;
+}
+
+quint64 ColdEventBlock::getMaxEventId() const
+{
+    return mMaxEventId;
+}
+
+bool ColdEventBlock::hasEventId(const quint64& eventId) const
+{
+    if (eventId < mMinEventId || eventId > mMaxEventId){
+        return false;
+    }
+
+    // The same walk as decode(), the other fields are skipped
+    const char* pos = mData.constData();
+    qint64 decodedId = 0;
+
+    for (int eventNum = 0; eventNum < mCount; ++eventNum)
     {
-        mTimeCenterMark = centralTime;
-        mTimeDelta = timeDelta;
-        update();
+        readVarint(pos);
+        readVarint(pos);
+        ++pos;
+        decodedId += zigZagDecode(readVarint(pos));
+
+        if (quint64(decodedId) == eventId){
+            return true;
+        }
 
-        emit rangeChanged(mTimeCenterMark.addMSecs((-1)*timeDelta), mTimeCenterMark.addMSecs(timeDelta));
+        quint64 runLength = readVarint(pos);
+        readVarint(pos);
 
-        return true;
+        quint64 boundCount = 2 * readVarint(pos);
+        for (quint64 bound = 0; bound < boundCount + runLength - 1; ++bound){
+            readVarint(pos);
+        }
     }
 
     return false;
 }
 
-void TimeLineGrid::setStyle(const TimeLineGridStyle& style)
+quint32 ColdEventBlock::getStatusCount(const EventItem::EventStatus& status) const
 {
-    mStyle = style;
+    return mStatusCounts.value(status);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineColdCache            /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TimeLineColdCache::TimeLineColdCache(const int& maxBlocks) :
+    mBlocks(maxBlocks)
+{
+
+}
+
+void TimeLineColdCache::insert(const quint64& blockId, const EventBlockPtr& block)
+{
+    QMutexLocker lock(&mMutex);
+    mBlocks.insert(blockId, new EventBlockPtr(block));
+}
+
+void TimeLineColdCache::setMaxBlocks(const int& maxBlocks)
+{
+    QMutexLocker lock(&mMutex);
+    mBlocks.setMaxCost(maxBlocks);
+}
+
+void TimeLineColdCache::clear()
+{
+    QMutexLocker lock(&mMutex);
+    mBlocks.clear();
+}
+
+EventBlockPtr TimeLineColdCache::find(const quint64& blockId)
+{
+    // The shared pointer is copied out, so an eviction doesn't free a block in use
+    QMutexLocker lock(&mMutex);
+
+    EventBlockPtr* block = mBlocks.object(blockId);
+    return block != nullptr? *block : EventBlockPtr();
+}
+
+int TimeLineColdCache::getMaxBlocks() const
+{
+    QMutexLocker lock(&mMutex);
+    return mBlocks.maxCost();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineStringPool           /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TimeLineStringPool::TimeLineStringPool() :
+    mStrings(1),
+    mByteSize(0)
+{
+
+}
+
+quint32 TimeLineStringPool::intern(const QString& string)
+{
+    if (string.isEmpty()){
+        return 0;
+    }
+
+    QMutexLocker lock(&mMutex);
+
+    auto id = mIds.find(string);
+    if (id != mIds.end()){
+        return *id;
+    }
+
+    quint32 newId = mStrings.size();
+    mStrings.append(string);
+    mIds.insert(string, newId);
+    mByteSize += string.size() * sizeof(QChar);
+
+    return newId;
+}
+
+QString TimeLineStringPool::getString(const quint32& id) const
+{
+    // Copies share the pooled data
+    QMutexLocker lock(&mMutex);
+    return id < quint32(mStrings.size())? mStrings[id] : QString();
+}
+
+int TimeLineStringPool::size() const
+{
+    QMutexLocker lock(&mMutex);
+    return mStrings.size() - 1;
+}
+
+qint64 TimeLineStringPool::byteSize() const
+{
+    QMutexLocker lock(&mMutex);
+    return mByteSize;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////                TaskItem                  /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TaskItem::TaskItem(const QDateTime startTime, const QDateTime endTime, const quint64& taskId,
+                   const bool& isInfinite, const QString taskName, const TimeLineTaskType& taskType) :
+
+                   mTaskId(taskId),
+                   mIsInfinite(isInfinite),
+                   mTaskType(taskType),
+                   mTaskName(taskName),
+                   mTaskNameId(0),
+                   mEventCount(0),
+                   mMaxEventDuration(0),
+                   mCoalescingGap(-1),
+                   mColdEventCount(0),
+                   mMaxColdBlockSpan(0),
+                   mPurgeTime(std::numeric_limits<qint64>::max()),
+                   mBucketPos(-1),
+                   AbstractItem(startTime, endTime)
+{
+    mExplicitEndTime = mEndTime;
+
+    if (mEndTime == TimeLineTime::mInvalidTime){
+        mEndTime = isInfinite? TimeLineTime::mMaxTime : mStartTime;
+    }
+}
+
+TaskItem::TaskItem(const qint64& startTime, const qint64& endTime, const quint64& taskId,
+                   const bool& isInfinite, const QString taskName, const TimeLineTaskType& taskType) :
+
+                   mTaskId(taskId),
+                   mIsInfinite(isInfinite),
+                   mTaskType(taskType),
+                   mTaskName(taskName),
+                   mTaskNameId(0),
+                   mEventCount(0),
+                   mMaxEventDuration(0),
+                   mCoalescingGap(-1),
+                   mColdEventCount(0),
+                   mMaxColdBlockSpan(0),
+                   mPurgeTime(std::numeric_limits<qint64>::max()),
+                   mBucketPos(-1),
+                   AbstractItem(startTime, endTime)
+{
+    mExplicitEndTime = mEndTime;
+
+    if (mEndTime == TimeLineTime::mInvalidTime){
+        mEndTime = isInfinite? TimeLineTime::mMaxTime : mStartTime;
+    }
+}
+
+EventItemPtr TaskItem::addEvent(EventItemPtr event)
+{
+    Q_ASSERT(event != nullptr);
+    if (event == nullptr){
+        return EventItemPtr();
+    }
+
+    // Events may share a start time, duplicates are told by id in TaskStorage
+    if (appendToRun(event)){
+        return latestEvent();
+    }
+
+    insertToBlocks(event);
+    ++mEventCount;
+
+    if (!mIsInfinite && mEndTime < event->getEndTimeUs()){
+        mEndTime = event->getEndTimeUs();
+    }
+
+    return event;
+}
+
+void TaskItem::setStringPool(const TimeLineStringPoolPtr& stringPool)
+{
+    if (mStringPool == stringPool){
+        return;
+    }
+
+    // From now on the name is only the pool's
+    QString name = getTaskName();
+    mStringPool = stringPool;
+    mTaskNameId = mStringPool->intern(name);
+    mTaskName.clear();
+}
+
+bool TaskItem::appendToRun(const EventItemPtr& event)
+{
+    // Events with ids must stay addressable, failures keep their own info marks
+    if (mCoalescingGap < 0 || mEventBlocks.isEmpty() || event->getEventId() ||
+        event->getStatus() == EventItem::EVENT_STATUS_FAILURE){
+        return false;
+    }
+
+    // Only the latest event can be continued, so the run is the last one in the last block
+    const EventBlockPtr& lastBlock = mEventBlocks.last();
+    EventItemPtr run = lastBlock->event(lastBlock->size() - 1);
+    qint64 runEndTime = run->getEndTimeUs();
+    qint64 startTime = event->getStartTimeUs();
+    qint64 endTime = event->getEndTimeUs();
+
+    // A run has a single payload
+    if (run->getStatus() != event->getStatus() || run->getPayloadId() != event->getPayloadId() ||
+        startTime < runEndTime || startTime - runEndTime > mCoalescingGap){
+        return false;
+    }
+
+    if (startTime > runEndTime){
+        run->mRunGaps << runEndTime << startTime;
+    }
+
+    run->mRunStarts.append(startTime);
+    ++run->mRunLength;
+    run->setEndTimeUs(endTime);
+    lastBlock->setEndTime(lastBlock->size() - 1, endTime);
+    mMaxEventDuration = std::max(mMaxEventDuration, endTime - run->getStartTimeUs());
+
+    if (!mIsInfinite && mEndTime < event->getEndTimeUs()){
+        mEndTime = event->getEndTimeUs();
+    }
+
+    return true;
+}
+
+void TaskItem::insertToBlocks(const EventItemPtr& event)
+{
+    qint64 startTime = event->getStartTimeUs();
+    mMaxEventDuration = std::max(mMaxEventDuration, event->getEndTimeUs() - startTime);
+
+    // Events mostly come in time order, so they are appended to the last block
+    if (mEventBlocks.isEmpty() ||
+       (mEventBlocks.last()->isFull() && startTime >= mEventBlocks.last()->lastStartTime()))
+    {
+        mEventBlocks.append(createEventBlock());
+        mEventBlocks.last()->insert(event);
+        return;
+    }
+
+    // The last block starting not later than the event
+    auto block = std::upper_bound(mEventBlocks.begin(), mEventBlocks.end(), startTime,
+                                  [](const qint64& time, const EventBlockPtr& eventBlock){ return time < eventBlock->firstStartTime(); });
+
+    if (block != mEventBlocks.begin()){
+        --block;
+    }
+
+    if ((*block)->isFull())
+    {
+        EventBlockPtr upperHalf = createEventBlock();
+        (*block)->split(*upperHalf);
+        int blockNum = std::distance(mEventBlocks.begin(), block);
+        mEventBlocks.insert(blockNum + 1, upperHalf);
+
+        if (startTime >= upperHalf->firstStartTime()){
+            ++blockNum;
+        }
+
+        mEventBlocks[blockNum]->insert(event);
+    }
+    else{
+        (*block)->insert(event);
+    }
+}
+
+QVector<EventItemPtr> TaskItem::removeEvents(const qint64& startTime, const qint64& endTime, const int& maxCount)
+{
+    QVector<EventItemPtr> removed;
+    QVector<EventItemPtr> tails;                            // Parts of runs past the range, added back
+
+    int firstBlock = 0;
+    int firstPos = 0;
+    lowerBound(startTime, firstBlock, firstPos);
+
+    // A run starting before the range may have merged events in it, these are cut off its end
+    EventItemPtr cutPart;
+
+    if ((firstBlock > 0 || firstPos > 0) && maxCount > 0)
+    {
+        int runBlock = firstPos > 0? firstBlock : firstBlock - 1;
+        int runPos = firstPos > 0? firstPos - 1 : mEventBlocks[runBlock]->size() - 1;
+
+        EventItemPtr run = mEventBlocks[runBlock]->event(runPos);
+        int beforeRange = run->runEventsBefore(startTime);
+        int inRange = run->runEventsBefore(endTime);
+
+        if (inRange > beforeRange)
+        {
+            if (inRange < int(run->getRunLength())){
+                tails.append(run->takeRunTail(inRange));
+            }
+
+            cutPart = run->takeRunTail(beforeRange);
+            mEventBlocks[runBlock]->setEndTime(runPos, run->getEndTimeUs());
+            removed.append(cutPart);
+        }
+    }
+
+    // The events of a run starting in the range go whole, a part of it past the range is a run of its own then
+    int removedCount = 0;
+
+    for (int blockNum = firstBlock, pos = firstPos; blockNum < mEventBlocks.size() && removed.size() < maxCount; )
+    {
+        const EventBlockPtr& block = mEventBlocks[blockNum];
+        if (pos >= block->size())
+        {
+            ++blockNum;
+            pos = 0;
+            continue;
+        }
+
+        if (block->startTimes()[pos] >= endTime){
+            break;
+        }
+
+        EventItemPtr event = block->event(pos);
+
+        int inRange = event->runEventsBefore(endTime);
+        if (inRange < int(event->getRunLength())){
+            tails.append(event->takeRunTail(inRange));
+        }
+
+        removed.append(event);
+        ++removedCount;
+        ++pos;
+    }
+
+    if (removed.isEmpty()){
+        return removed;
+    }
+
+    // Events are taken by position, so ones sharing a start time with a kept one are told apart
+    removeFromBlocks(firstBlock, firstPos, removedCount);
+    mEventCount -= removedCount;
+
+    bool endTimeRemoved = false;
+    for (auto& event : removed){
+        endTimeRemoved |= event->getEndTimeUs() >= mEndTime;
+    }
+
+    for (auto& tail : tails)
+    {
+        insertToBlocks(tail);
+        ++mEventCount;
+    }
+
+    // The end time is moved back only if a removed event was holding it
+    if (!mIsInfinite && endTimeRemoved){
+        restoreEndTime();
+    }
+
+    return removed;
+}
+
+void TaskItem::removeFromBlocks(const int& blockNum, const int& pos, int count)
+{
+    // Only the first and the last touched blocks may keep some events, the ones between are dropped at once
+    int firstEmptyBlock = blockNum;
+    int emptyBlockCount = 0;
+    int from = pos;
+
+    for (int block = blockNum; block < mEventBlocks.size() && count > 0; ++block)
+    {
+        int to = std::min(mEventBlocks[block]->size(), from + count);
+        count -= to - from;
+
+        if (from == 0 && to == mEventBlocks[block]->size())
+        {
+            if (emptyBlockCount == 0){
+                firstEmptyBlock = block;
+            }
+
+            ++emptyBlockCount;
+        }
+        else{
+            mEventBlocks[block]->remove(from, to);
+        }
+
+        from = 0;
+    }
+
+    if (emptyBlockCount){
+        mEventBlocks.erase(mEventBlocks.begin() + firstEmptyBlock, mEventBlocks.begin() + firstEmptyBlock + emptyBlockCount);
+    }
+}
+
+void TaskItem::lowerBound(const qint64& startTime, int& blockNum, int& pos) const
+{
+    // The first block with events starting at or after startTime, the ones before end earlier
+    blockNum = std::lower_bound(mEventBlocks.begin(), mEventBlocks.end(), startTime,
+                                [](const EventBlockPtr& eventBlock, const qint64& time){ return eventBlock->lastStartTime() < time; }) - mEventBlocks.begin();
+
+    pos = blockNum < mEventBlocks.size()? mEventBlocks[blockNum]->lowerBound(startTime) : 0;
+}
+
+EventItemPtr TaskItem::latestEvent() const
+{
+    if (mEventBlocks.isEmpty()){
+        return EventItemPtr();
+    }
+
+    const EventBlockPtr& lastBlock = mEventBlocks.last();
+    return lastBlock->event(lastBlock->size() - 1);
+}
+
+qint64 TaskItem::firstEventStartTime() const
+{
+    qint64 firstStartTime = std::numeric_limits<qint64>::max();
+    if (!mEventBlocks.isEmpty() && mEventBlocks.first()->size()){
+        firstStartTime = mEventBlocks.first()->startTimes()[0];
+    }
+
+    // Cold blocks are sorted by their first start too
+    if (!mColdBlocks.isEmpty()){
+        firstStartTime = std::min(firstStartTime, mColdBlocks.first()->getFirstStartTime());
+    }
+
+    return firstStartTime;
+}
+
+qint64 TaskItem::latestEventEndTime() const
+{
+    qint64 latestEndTime = std::numeric_limits<qint64>::min();
+    if (mEventBlocks.isEmpty()){
+        return latestEndTime;
+    }
+
+    // Only events starting within the longest duration before the last one may end later than it
+    qint64 searchStartTime = mEventBlocks.last()->lastStartTime() - mMaxEventDuration;
+
+    for (int blockNum = mEventBlocks.size() - 1; blockNum >= 0; --blockNum)
+    {
+        const EventBlockPtr& block = mEventBlocks[blockNum];
+
+        for (int pos = block->size() - 1; pos >= 0; --pos)
+        {
+            if (block->startTimes()[pos] < searchStartTime){
+                return latestEndTime;
+            }
+
+            latestEndTime = std::max(latestEndTime, block->endTimes()[pos]);
+        }
+    }
+
+    return latestEndTime;
+}
+
+QVector<EventItemPtr> TaskItem::freezeEvents(const qint64& time, ColdEventBlockPtr& coldBlock)
+{
+    QVector<EventItemPtr> frozen;
+    EventItemPtr latest = latestEvent();
+
+    // The frozen events leave their blocks, the events staying hot keep their places
+    int blockNum = 0;
+    bool isRangeEnd = false;
+
+    for (; blockNum < mEventBlocks.size() && !isRangeEnd && frozen.size() < EventBlock::mCapacity; ++blockNum)
+    {
+        const EventBlockPtr& block = mEventBlocks[blockNum];
+        QVector<int> frozenPositions;
+
+        for (int pos = 0; pos < block->size() && frozen.size() < EventBlock::mCapacity; ++pos)
+        {
+            if (block->startTimes()[pos] >= time)
+            {
+                isRangeEnd = true;
+                break;
+            }
+
+            // Failures keep their info marks, the latest event may still be continued by a run
+            EventItemPtr event = block->event(pos);
+            if (event->getStatus() == EventItem::EVENT_STATUS_FAILURE || event == latest){
+                continue;
+            }
+
+            frozen.append(event);
+            frozenPositions.append(pos);
+        }
+
+        block->remove(frozenPositions);
+    }
+
+    if (frozen.isEmpty()){
+        return frozen;
+    }
+
+    mEventCount -= frozen.size();
+
+    for (int emptyBlock = blockNum - 1; emptyBlock >= 0; --emptyBlock)
+    {
+        if (!mEventBlocks[emptyBlock]->size()){
+            mEventBlocks.removeAt(emptyBlock);
+        }
+    }
+
+    coldBlock = std::make_shared<ColdEventBlock>(frozen);
+    auto pos = std::upper_bound(mColdBlocks.begin(), mColdBlocks.end(), coldBlock->getFirstStartTime(),
+                                [](const qint64& startTime, const ColdEventBlockPtr& block){ return startTime < block->getFirstStartTime(); });
+
+    mColdBlocks.insert(pos, coldBlock);
+    mColdEventCount += coldBlock->size();
+    mMaxColdBlockSpan = std::max(mMaxColdBlockSpan, coldBlock->getMaxEndTime() - coldBlock->getFirstStartTime());
+
+    return frozen;
+}
+
+int TaskItem::removeColdEvents(const qint64& startTime, const qint64& endTime,
+                               QVector<ColdEventBlockPtr>& removedBlocks, QVector<ColdEventBlockPtr>& addedBlocks)
+{
+    const qint64& from = startTime;
+    const qint64& to = endTime;
+
+    int removedCount = 0;
+    qint64 removedMaxEndTime = std::numeric_limits<qint64>::min();
+
+    for (int blockNum = 0; blockNum < mColdBlocks.size() && mColdBlocks[blockNum]->getFirstStartTime() < to; )
+    {
+        ColdEventBlockPtr block = mColdBlocks[blockNum];
+
+        // Merged events start before their run ends, so a block ended before the range has none in it
+        if (block->getMaxEndTime() < from)
+        {
+            ++blockNum;
+            continue;
+        }
+
+        // Blocks inside the range go as a whole, the partially covered ones are encoded again
+        if (from <= block->getFirstStartTime() && block->getMaxEndTime() < to)
+        {
+            for (auto& event : block->decode()){
+                removedCount += event->getRunLength();
+            }
+
+            removedBlocks.append(block);
+            removedMaxEndTime = std::max(removedMaxEndTime, block->getMaxEndTime());
+            mColdEventCount -= block->size();
+            mColdBlocks.removeAt(blockNum);
+            continue;
+        }
+
+        QVector<EventItemPtr> keptEvents;
+        int blockRemovedCount = 0;
+
+        for (auto& event : block->decode())
+        {
+            int beforeRange = event->runEventsBefore(from);
+            int inRange = event->runEventsBefore(to);
+
+            if (inRange == beforeRange)
+            {
+                keptEvents.append(event);
+                continue;
+            }
+
+            removedMaxEndTime = std::max(removedMaxEndTime, event->getEndTimeUs());
+            blockRemovedCount += inRange - beforeRange;
+
+            // The parts of a run outside the range are kept
+            EventItemPtr tail;
+            if (inRange < int(event->getRunLength())){
+                tail = event->takeRunTail(inRange);
+            }
+
+            if (beforeRange > 0)
+            {
+                event->takeRunTail(beforeRange);
+                keptEvents.append(event);
+            }
+
+            if (tail != nullptr){
+                keptEvents.append(tail);
+            }
+        }
+
+        if (!blockRemovedCount)
+        {
+            ++blockNum;
+            continue;
+        }
+
+        removedCount += blockRemovedCount;
+        mColdEventCount -= block->size() - keptEvents.size();
+        removedBlocks.append(block);
+
+        if (keptEvents.isEmpty()){
+            mColdBlocks.removeAt(blockNum);
+        }
+        else
+        {
+            mColdBlocks[blockNum] = std::make_shared<ColdEventBlock>(keptEvents);
+            addedBlocks.append(mColdBlocks[blockNum]);
+            ++blockNum;
+        }
+    }
+
+    // The end time is moved back only if a removed event may have been holding it
+    if (removedCount && !mIsInfinite && removedMaxEndTime >= mEndTime){
+        restoreEndTime();
+    }
+
+    return removedCount;
+}
+
+void TaskItem::restoreEndTime()
+{
+    // An unset explicit end time is the minimum one, so it never wins
+    mEndTime = std::max(mStartTime, mExplicitEndTime);
+    mEndTime = std::max(mEndTime, std::max(latestEventEndTime(), latestColdEventEndTime()));
+}
+
+void TaskItem::setEndTimeUs(const qint64& endTime)
+{
+    AbstractItem::setEndTimeUs(endTime);
+    mExplicitEndTime = endTime;
+}
+
+qint64 TaskItem::latestColdEventEndTime() const
+{
+    qint64 latestEndTime = std::numeric_limits<qint64>::min();
+
+    for (auto& block : mColdBlocks){
+        latestEndTime = std::max(latestEndTime, block->getMaxEndTime());
+    }
+
+    return latestEndTime;
+}
+
+const QList<ColdEventBlockPtr>& TaskItem::getColdBlocks() const
+{
+    return mColdBlocks;
+}
+
+qint64 TaskItem::getMaxColdBlockSpan() const
+{
+    return mMaxColdBlockSpan;
+}
+
+EventBlockPtr TaskItem::getDecodedColdBlock(const ColdEventBlockPtr& block) const
+{
+    if (mColdCache != nullptr)
+    {
+        EventBlockPtr decodedBlock = mColdCache->find(block->getBlockId());
+        if (decodedBlock != nullptr){
+            return decodedBlock;
+        }
+    }
+
+    // Decoded events point to the task like the hot ones do
+    TaskItemPtr self = std::const_pointer_cast<TaskItem>(shared_from_this());
+
+    EventBlockPtr decodedBlock = createEventBlock();
+    for (auto& event : block->decode(self)){
+        decodedBlock->insert(event);
+    }
+
+    if (mColdCache != nullptr){
+        mColdCache->insert(block->getBlockId(), decodedBlock);
+    }
+
+    return decodedBlock;
+}
+
+QVector<EventItemPtr> TaskItem::getColdEvents(const qint64& startTime, const qint64& endTime) const
+{
+    QVector<EventItemPtr> result;
+    const qint64& from = startTime;
+    const qint64& to = endTime;
+
+    for (int blockNum = 0; blockNum < mColdBlocks.size() && mColdBlocks[blockNum]->getFirstStartTime() < to; ++blockNum)
+    {
+        const ColdEventBlockPtr& block = mColdBlocks[blockNum];
+        if (block->getLastStartTime() < from){
+            continue;
+        }
+
+        EventBlockPtr decodedBlock = getDecodedColdBlock(block);
+        for (int pos = decodedBlock->lowerBound(from); pos < decodedBlock->size() && decodedBlock->startTimes()[pos] < to; ++pos){
+            result.append(decodedBlock->event(pos));
+        }
+    }
+
+    // Cold blocks may overlap in time
+    std::sort(result.begin(), result.end(),
+              [](const EventItemPtr& first, const EventItemPtr& second){ return first->getStartTimeUs() < second->getStartTimeUs(); });
+
+    return result;
+}
+
+EventBlockPtr TaskItem::createEventBlock() const
+{
+    if (mSlabArena == nullptr){
+        return std::make_shared<EventBlock>();
+    }
+
+    return std::allocate_shared<EventBlock>(TimeLineSlabAllocator<EventBlock>(mSlabArena));
+}
+
+bool TaskItem::isInfinite() const
+{
+    return mIsInfinite;
+}
+
+quint32 TaskItem::eventCount() const
+{
+    return mEventCount + mColdEventCount;
+}
+
+quint32 TaskItem::coldEventCount() const
+{
+    return mColdEventCount;
+}
+
+QVector<EventItemPtr> TaskItem::getEvents(const qint64& startTime, const qint64& endTime) const
+{
+    QVector<EventItemPtr> result;
+
+    int blockNum = 0;
+    int pos = 0;
+    lowerBound(startTime, blockNum, pos);
+
+    for (; blockNum < mEventBlocks.size(); ++blockNum, pos = 0)
+    {
+        const EventBlockPtr& block = mEventBlocks[blockNum];
+
+        for (; pos < block->size(); ++pos)
+        {
+            if (block->startTimes()[pos] >= endTime){
+                return result;
+            }
+
+            result.append(block->event(pos));
+        }
+    }
+
+    return result;
+}
+
+const QList<EventBlockPtr>& TaskItem::getEventBlocks() const
+{
+    return mEventBlocks;
+}
+
+qint64 TaskItem::getMaxEventDuration() const
+{
+    return mMaxEventDuration;
+}
+
+void TaskItem::setCoalescingGap(const qint64& gap)
+{
+    mCoalescingGap = gap;
+}
+
+qint64 TaskItem::getCoalescingGap() const
+{
+    return mCoalescingGap;
+}
+
+quint64 TaskItem::getTaskId() const
+{
+    return mTaskId;
+}
+
+TimeLineTaskType TaskItem::getTaskType() const
+{
+    return mTaskType;
+}
+
+QString TaskItem::getTaskName() const
+{
+    if (mStringPool != nullptr){
+        return mStringPool->getString(mTaskNameId);
+    }
+
+    return mTaskName;
+}
+
+AbstractItem::ItemType TaskItem::getItemType() const
+{
+    return ITEM_TYPE_TASK;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////                EventItem                 /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+EventItem::EventItem(QDateTime startTime, QDateTime endTime, EventStatus stat, const quint64& eventId) :
+                     AbstractItem(startTime, endTime),
+                     mStatus(stat),
+                     mEventId(eventId),
+                     mRunLength(1),
+                     mPayloadId(0)
+{
+
+}
+
+EventItem::EventItem(const qint64& startTime, const qint64& endTime, EventStatus stat, const quint64& eventId) :
+                     AbstractItem(startTime, endTime),
+                     mStatus(stat),
+                     mEventId(eventId),
+                     mRunLength(1),
+                     mPayloadId(0)
+{
+
+}
+
+bool EventItem::setParentTask(TaskItemPtr task)
+{
+    Q_ASSERT(task != nullptr);
+    if (task == nullptr){
+        return false;
+    }
+
+    mParentTask = task;
+    return true;
+}
+
+const TaskItemPtr EventItem::getParentTask() const
+{
+    return mParentTask.lock();
+}
+
+quint64 EventItem::getEventId() const
+{
+    return mEventId;
+}
+
+quint32 EventItem::getRunLength() const
+{
+    return mRunLength;
+}
+
+void EventItem::setPayloadId(const quint32& payloadId)
+{
+    mPayloadId = payloadId;
+}
+
+quint32 EventItem::getPayloadId() const
+{
+    return mPayloadId;
+}
+
+const QVector<qint64>& EventItem::getRunGaps() const
+{
+    return mRunGaps;
+}
+
+int EventItem::runEventsBefore(const qint64& time) const
+{
+    if (time <= mStartTime){
+        return 0;
+    }
+
+    return 1 + (std::lower_bound(mRunStarts.begin(), mRunStarts.end(), time) - mRunStarts.begin());
+}
+
+EventItemPtr EventItem::takeRunTail(const int& first)
+{
+    Q_ASSERT(first > 0 && first < int(mRunLength));
+
+    qint64 tailStartTime = mRunStarts[first - 1];
+
+    EventItemPtr tail = std::make_shared<EventItem>(tailStartTime, mEndTime, mStatus);
+    tail->mParentTask = mParentTask;
+    tail->mPayloadId = mPayloadId;
+    tail->mRunLength = mRunLength - first;
+    tail->mRunStarts = mRunStarts.mid(first);
+
+    // A gap ending at the tail's start separates the two runs, back-to-back events have none
+    int bound = std::lower_bound(mRunGaps.begin(), mRunGaps.end(), tailStartTime) - mRunGaps.begin();
+    bool separatedByGap = bound % 2 && mRunGaps[bound] == tailStartTime;
+
+    tail->mRunGaps = mRunGaps.mid(separatedByGap? bound + 1 : bound);
+    mEndTime = separatedByGap? mRunGaps[bound - 1] : tailStartTime;
+    mRunGaps.resize(separatedByGap? bound - 1 : bound);
+
+    mRunStarts.resize(first - 1);
+    mRunLength = first;
+
+    return tail;
+}
+
+EventItem::EventStatus EventItem::getStatus() const
+{
+    return mStatus;
+}
+
+qint64 EventItem::getMiddleTime() const
+{
+    return mStartTime / 2 + mEndTime / 2;
+}
+
+AbstractItem::ItemType EventItem::getItemType() const
+{
+    return ITEM_TYPE_EVENT;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineHistogram           //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TimeLineHistogram::TimeLineHistogram(const int& windowSize) :
+                                     mSamples(std::max(windowSize, 1), 0),
+                                     mNextSample(0),
+                                     mSampleCount(0)
+{
+
+}
+
+void TimeLineHistogram::addSample(const double& value)
+{
+    mSamples[mNextSample] = value;
+    mNextSample = (mNextSample + 1) % mSamples.size();
+
+    if (mSampleCount < mSamples.size()){
+        ++mSampleCount;
+    }
+}
+
+void TimeLineHistogram::clear()
+{
+    mNextSample = 0;
+    mSampleCount = 0;
+}
+
+int TimeLineHistogram::sampleCount() const
+{
+    return mSampleCount;
+}
+
+double TimeLineHistogram::percentile(const double& portion) const
+{
+    if (!mSampleCount){
+        return 0;
+    }
+
+    // The ring buffer is filled from the beginning, so the first mSampleCount values are valid
+    QVector<double> samples = mSamples.mid(0, mSampleCount);
+    int rank = std::min(std::max(portion, 0.0), 1.0) * (mSampleCount - 1);
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+
+    return samples[rank];
+}
+
+double TimeLineHistogram::average() const
+{
+    double sum = 0;
+    for (int sample = 0; sample < mSampleCount; ++sample){
+        sum += mSamples[sample];
+    }
+
+    return mSampleCount ? sum / mSampleCount : 0;
+}
+
+double TimeLineHistogram::maximum() const
+{
+    return mSampleCount ? *std::max_element(mSamples.begin(), mSamples.begin() + mSampleCount) : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineMetrics             //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+double TimeLineMetrics::FrameStats::value(const Metric& metric) const
+{
+    switch (metric)
+    {
+    case METRIC_FRAME_TIME: return frameTime;
+    case METRIC_LAYOUT_TIME: return layoutTime;
+    case METRIC_GRID_PAINT_TIME: return gridPaintTime;
+    case METRIC_ITEMS_PAINT_TIME: return itemsPaintTime;
+    case METRIC_ICONS_PAINT_TIME: return iconsPaintTime;
+    case METRIC_LOCK_WAIT_TIME: return lockWaitTime;
+    case METRIC_LOCK_HOLD_TIME: return lockHoldTime;
+    case METRIC_VISIBLE_ITEMS: return visibleItems;
+    case METRIC_ICONS_DRAWN: return iconsDrawn;
+    case METRIC_QUALITY_LEVEL: return qualityLevel;
+    default: return 0;
+    }
+}
+
+bool TimeLineMetrics::FrameStats::isMeasured(const Metric& metric) const
+{
+    switch (metric)
+    {
+    case METRIC_GRID_PAINT_TIME:
+        return !gridCached;
+    case METRIC_LAYOUT_TIME:
+    case METRIC_ITEMS_PAINT_TIME:
+    case METRIC_ICONS_PAINT_TIME:
+    case METRIC_LOCK_WAIT_TIME:
+    case METRIC_LOCK_HOLD_TIME:
+    case METRIC_VISIBLE_ITEMS:
+    case METRIC_ICONS_DRAWN:
+        return !itemsCached;
+    default:
+        return true;
+    }
+}
+
+TimeLineMetrics::TimeLineMetrics(const int& windowSize) :
+                                 mHistograms(METRIC_INVALID, TimeLineHistogram(windowSize)),
+                                 mFrameCount(0)
+{
+
+}
+
+TimeLineMetrics::FrameStats& TimeLineMetrics::currentFrame()
+{
+    return mCurrentFrame;
+}
+
+void TimeLineMetrics::beginFrame()
+{
+    mCurrentFrame = FrameStats();
+}
+
+void TimeLineMetrics::endFrame(const double& frameTime)
+{
+    mCurrentFrame.frameTime = frameTime;
+
+    // Cache hits would drag the percentiles of the cached layers down to zero
+    for (int metric = 0; metric < METRIC_INVALID; ++metric)
+    {
+        if (mCurrentFrame.isMeasured(Metric(metric))){
+            mHistograms[metric].addSample(mCurrentFrame.value(Metric(metric)));
+        }
+    }
+
+    mLastFrame = mCurrentFrame;
+    ++mFrameCount;
+}
+
+void TimeLineMetrics::clear()
+{
+    for (auto& histogram : mHistograms){
+        histogram.clear();
+    }
+
+    mCurrentFrame = FrameStats();
+    mLastFrame = FrameStats();
+    mFrameCount = 0;
+}
+
+TimeLineMetrics::FrameStats TimeLineMetrics::lastFrame() const
+{
+    return mLastFrame;
+}
+
+const TimeLineHistogram& TimeLineMetrics::histogram(const Metric& metric) const
+{
+    Q_ASSERT(metric < METRIC_INVALID);
+    return mHistograms[std::min<int>(metric, METRIC_INVALID - 1)];
+}
+
+quint64 TimeLineMetrics::frameCount() const
+{
+    return mFrameCount;
+}
+
+QString TimeLineMetrics::metricName(const Metric& metric)
+{
+    switch (metric)
+    {
+    case METRIC_FRAME_TIME: return "Frame, ms";
+    case METRIC_LAYOUT_TIME: return "Layout, ms";
+    case METRIC_GRID_PAINT_TIME: return "Grid paint, ms";
+    case METRIC_ITEMS_PAINT_TIME: return "Items paint, ms";
+    case METRIC_ICONS_PAINT_TIME: return "Icons paint, ms";
+    case METRIC_LOCK_WAIT_TIME: return "Lock wait, ms";
+    case METRIC_LOCK_HOLD_TIME: return "Lock hold, ms";
+    case METRIC_VISIBLE_ITEMS: return "Visible items";
+    case METRIC_ICONS_DRAWN: return "Icons drawn";
+    case METRIC_QUALITY_LEVEL: return "Quality level";
+    default: return QString();
+    }
+}
+
+double TimeLineMetrics::elapsedMSecs(const QElapsedTimer& timer)
+{
+    return timer.nsecsElapsed() / 1000000.0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////         TimeLineQualityGovernor         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+const double TimeLineQualityGovernor::mHeadroomPortion = 0.5;
+const double TimeLineQualityGovernor::mAveragingFactor = 0.25;
+
+TimeLineQualityGovernor::TimeLineQualityGovernor(const double& frameTimeBudget) :
+                                                 mFrameTimeBudget(frameTimeBudget)
+{
+    reset();
+}
+
+void TimeLineQualityGovernor::setFrameTimeBudget(const double& frameTimeBudget)
+{
+    mFrameTimeBudget = frameTimeBudget;
+    reset();
+}
+
+bool TimeLineQualityGovernor::addFrame(const double& frameTime)
+{
+    if (mFrameTimeBudget <= 0){
+        return false;
+    }
+
+    // The average starts over on every level change, so each level is judged by it's own frames
+    mAverageFrameTime = mAverageFrameTime < 0? frameTime : mAverageFrameTime + mAveragingFactor * (frameTime - mAverageFrameTime);
+
+    if (mAverageFrameTime > mFrameTimeBudget)
+    {
+        ++mFramesOverBudget;
+        mFramesWithHeadroom = 0;
+    }
+    else if (mAverageFrameTime < mFrameTimeBudget * mHeadroomPortion)
+    {
+        ++mFramesWithHeadroom;
+        mFramesOverBudget = 0;
+    }
+    else
+    {
+        mFramesOverBudget = 0;
+        mFramesWithHeadroom = 0;
+    }
+
+    // Between the headroom and the budget the level stays, so it doesn't flip back and forth
+    QualityLevel level = mLevel;
+    if (mFramesOverBudget >= mStepDownFrames && mLevel + 1 < QUALITY_INVALID){
+        level = QualityLevel(mLevel + 1);
+    }
+    else if (mFramesWithHeadroom >= mStepUpFrames && mLevel > QUALITY_FULL){
+        level = QualityLevel(mLevel - 1);
+    }
+
+    if (level == mLevel){
+        return false;
+    }
+
+    mLevel = level;
+    mAverageFrameTime = -1;
+    mFramesOverBudget = 0;
+    mFramesWithHeadroom = 0;
+    return true;
+}
+
+void TimeLineQualityGovernor::reset()
+{
+    mLevel = QUALITY_FULL;
+    mAverageFrameTime = -1;
+    mFramesOverBudget = 0;
+    mFramesWithHeadroom = 0;
+}
+
+TimeLineQualityGovernor::QualityLevel TimeLineQualityGovernor::getLevel() const
+{
+    return mLevel;
+}
+
+double TimeLineQualityGovernor::getFrameTimeBudget() const
+{
+    return mFrameTimeBudget;
+}
+
+QString TimeLineQualityGovernor::levelName(const QualityLevel& level)
+{
+    switch (level)
+    {
+    case QUALITY_FULL: return "Full";
+    case QUALITY_NO_HQ_ANTIALIASING: return "No HQ antialiasing";
+    case QUALITY_PLAIN_RECTS: return "Plain rects";
+    case QUALITY_ICON_TICKS: return "Icon ticks";
+    case QUALITY_COARSE_LAYOUT: return "Coarse layout";
+    default: return QString();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineGrid                //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+const qint64 TimeLineGrid::mMinTimeScale;
+const qint64 TimeLineGrid::mMaxTimeScale;
+const QString TimeLineGrid::mTimeFormat = "hh:mm:ss";
+const QString TimeLineGrid::mDayFormat = "dd:MM:yy";
+const double TimeLineGrid::mOverlayOpacity = 0.3;
+
+TimeLineGrid::TimeLineGrid(QGraphicsItem *parent) : QGraphicsItem(parent),
+                                                     mTimeCenterMark(TimeLineTime::mInvalidTime),
+                                                     mTimeDelta(0),
+                                                     mMetricsOverlayVisible(false),
+                                                     mMouseMarkVisible(true)
+{
+    // The border and the time marks change only with the range, mouse moves are repainted by the overlay
+    setCacheMode(QGraphicsItem::DeviceCoordinateCache);
+    mOverlay = new TimeLineGridOverlay(this);
+}
+
+void TimeLineGrid::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{    
+    QElapsedTimer paintTimer;
+    paintTimer.start();
+
+    painter->setPen(QPen(mStyle.borderColor));
+
+    // Paint item area border
+    painter->drawRect(graphicsRect());
+
+    // Paint the time marks and their texts
+    if (mTimeCenterMark != TimeLineTime::mInvalidTime){
+        drawMarks(painter);
+    }
+
+    if (mMetrics != nullptr)
+    {
+        mMetrics->currentFrame().gridCached = false;
+        mMetrics->currentFrame().gridPaintTime += TimeLineMetrics::elapsedMSecs(paintTimer);
+    }
+}
+
+void TimeLineGrid::paintOverlay(QPainter *painter)
+{
+    drawOverlay(painter);
+}
+
+void TimeLineGrid::drawOverlay(QPainter *painter)
+{
+    QElapsedTimer paintTimer;
+    paintTimer.start();
+
+    mMouseMarkRect = QRect();
+    mMetricsOverlayRect = QRect();
+
+    // Current time mark and mouse mark and corresponding texts
+    if (mTimeCenterMark != TimeLineTime::mInvalidTime)
+    {
+        qint64 startTime = TimeLineTime::add(mTimeCenterMark, -mTimeDelta);
+        qint64 endTime = TimeLineTime::add(mTimeCenterMark, mTimeDelta);
+        qint64 currTime = TimeLineTime::currentTime();
+        double usecPerPixel = TimeLineTime::toDouble(2 * mTimeDelta) / mSize.width();
+
+        QFontMetrics fm(painter->font());
+        QString textFormat = getTextFormat();
+
+        QPair<int, int> currTimeMarkBorders(-1, -1);
+        drawCurrTimeMark(usecPerPixel, currTime, startTime, endTime,
+                         currTimeMarkBorders, textFormat, fm, painter);
+
+        if (mMouseMarkVisible){
+            drawMouseTimeMark(painter);
+        }
+    }
+
+    if (mMetrics != nullptr){
+        mMetrics->currentFrame().gridPaintTime += TimeLineMetrics::elapsedMSecs(paintTimer);
+    }
+
+    if (mMetricsOverlayVisible){
+        drawMetricsOverlay(painter);
+    }
+}
+
+void TimeLineGrid::drawMetricsOverlay(QPainter *painter)
+{
+    QStringList lines;
+    int digits = fractionDigits(TimeLineTime::toDouble(2 * mTimeDelta) / mSize.width());
+    lines << "BeginTime : " + TimeLineTime::toString(TimeLineTime::add(mTimeCenterMark, -mTimeDelta), "ddd MMM d hh:mm:ss", digits)
+          << "EndTime : " + TimeLineTime::toString(TimeLineTime::add(mTimeCenterMark, mTimeDelta), "ddd MMM d hh:mm:ss", digits)
+          << "MousePos : " + QString::number(mMousePos.x());
+
+    // The current frame is not finished yet, so the statistics are shown for the previous one
+    if (mMetrics != nullptr)
+    {
+        TimeLineMetrics::FrameStats lastFrame = mMetrics->lastFrame();
+
+        for (int metric = 0; metric < TimeLineMetrics::METRIC_INVALID; ++metric)
+        {
+            const TimeLineHistogram& histogram = mMetrics->histogram(TimeLineMetrics::Metric(metric));
+            QString lastValue = lastFrame.isMeasured(TimeLineMetrics::Metric(metric)) ?
+                                QString::number(lastFrame.value(TimeLineMetrics::Metric(metric)), 'f', 2) : QString("cached");
+            lines << QString("%1 : %2 (p50 %3, p95 %4, p99 %5)")
+                     .arg(TimeLineMetrics::metricName(TimeLineMetrics::Metric(metric)))
+                     .arg(lastValue)
+                     .arg(histogram.percentile(0.5), 0, 'f', 2)
+                     .arg(histogram.percentile(0.95), 0, 'f', 2)
+                     .arg(histogram.percentile(0.99), 0, 'f', 2);
+        }
+
+        lines << "Quality : " + TimeLineQualityGovernor::levelName(TimeLineQualityGovernor::QualityLevel(lastFrame.qualityLevel));
+    }
+
+    QFontMetrics fm(painter->font());
+    int lineHeight = fm.height();
+    int width = 0;
+
+    for (auto& line : lines){
+        width = std::max(width, fm.width(line));
+    }
+
+    // Bottom left corner of the item painting region
+    QRect overlayRect(mSettings.borderIndentX + 5,
+                      mSize.height() - mSettings.borderIndentY - 5 - lineHeight * lines.size(),
+                      width + 10,
+                      lineHeight * lines.size());
+
+    mMetricsOverlayRect = overlayRect;
+
+    painter->setOpacity(1);
+    painter->fillRect(overlayRect, QColor(255, 255, 255, 200));
+    painter->setPen(QPen(mStyle.borderColor));
+
+    for (int line = 0; line < lines.size(); ++line)
+    {
+        painter->drawText(QRect(overlayRect.left() + 5, overlayRect.top() + line * lineHeight, width, lineHeight),
+                          Qt::AlignLeft | Qt::AlignVCenter, lines[line]);
+    }
+}
+
+void TimeLineGrid::drawMarks(QPainter *painter)
+{
+    qint64 startTime = TimeLineTime::add(mTimeCenterMark, -mTimeDelta);
+    qint64 endTime = TimeLineTime::add(mTimeCenterMark, mTimeDelta);
+    qint64 currTime = TimeLineTime::currentTime();
+    double usecPerPixel = TimeLineTime::toDouble(2 * mTimeDelta) / mSize.width();
+
+    QFont font = painter->font();
+    QFontMetrics fm(font);
+    QString textFormat = getTextFormat();
+    font.setPointSize(mSettings.borderIndentY * 0.5);
+
+    // The current time mark itself is on the overlay, the marks under it's text are faded here
+    QPair<int, int> currTimeMarkBorders = getCurrTimeMarkBorders(usecPerPixel, currTime, startTime, endTime, textFormat, fm);
+
+    // Grid marks
+    drawGridMarks(fm, usecPerPixel, startTime, textFormat, currTimeMarkBorders, painter);
+}
+
+void TimeLineGrid::drawGridMarks(const QFontMetrics& fm, const double& usecPerPixel,
+                                 const qint64& startTime, const QString textFormat,
+                                 QPair<int, int> &currTimeMarkBorders, QPainter *painter)
+{
+    painter->setPen(QPen(mStyle.timeMarksTextColor));
+
+    // calculate step between grid items in usec
+    // The widest text is the mouse mark's one, it doesn't depend on the mouse position much
+    double pixelsPerUsec = 1 / usecPerPixel;
+    QString mouseTimeString = TimeLineTime::toString(mTimeCenterMark, "dd.MM.yy hh:mm:ss", fractionDigits(usecPerPixel));
+    quint16 textWidth = fm.width(mouseTimeString);
+    quint16 maxNumberOfTextMarks = mSize.width() / (textWidth*1.5);
+    int triangleRectWidth = (mSettings.borderIndentY - fm.height()) / 2 + 1;
+
+    if (maxNumberOfTextMarks == 0){
+        return;
+    }
+
+    qint64 step = calculateStep(maxNumberOfTextMarks);
+    int digits = textFormat == mTimeFormat ? fractionDigits(step) : 0;
+
+    // find first item, the one before the range makes the text appear smoothly
+    qint64 timeMark = startTime;
+    if (startTime % step)
+    {
+        qint64 stepNumber = startTime / step - (startTime < 0 ? 1 : 0);
+        timeMark = TimeLineTime::add(stepNumber * step, -step);
+    }
+
+    while (true)
+    {
+        // to make text appear smoothly
+        int pos = std::floor(pixelsPerUsec * TimeLineTime::toDouble(timeMark - startTime));
+
+        QString timeText = TimeLineTime::toString(timeMark, textFormat, digits);
+        if (pos - fm.width(timeText) / 2 < mSize.width() - mSettings.borderIndentX)
+        {
+            // make an item semitransparent when it overlays the current mark text
+            double opacity = 1;
+            if (currTimeMarkBorders.first != -1 && currTimeMarkBorders.second != -1)
+            {
+                QPair<int, int> intersection(std::max(currTimeMarkBorders.first, pos - fm.width(timeText) / 2),
+                                             std::min(currTimeMarkBorders.second, pos + fm.width(timeText) / 2));
+
+                if (intersection.first < intersection.second){
+                    opacity = mOverlayOpacity;
+                }
+            }
+
+            painter->setOpacity(opacity);
+            painter->drawLine(pos, mSettings.borderIndentY, pos, mSettings.borderIndentY - triangleRectWidth);
+            paintText(true, pos, timeText, painter, mStyle.timeMarksTextColor);
+
+            if (timeMark > TimeLineTime::mMaxTime - step){
+                break;
+            }
+
+            timeMark += step;
+        }
+        else{
+            break;
+        }
+    }
+}
+
+QPair<int, int> TimeLineGrid::getCurrTimeMarkBorders(const double& usecPerPixel, const qint64& currTime, const qint64& startTime,
+                                                     const qint64& endTime, const QString textFormat, const QFontMetrics& fm) const
+{
+    QString currMarkTimeString = TimeLineTime::toString(mTimeCenterMark, textFormat, textFormat == mTimeFormat ? fractionDigits(usecPerPixel) : 0);
+    quint16 currTimeMarkWidth = fm.width(currMarkTimeString);
+    qint64 currTimeMarkWidthUsec = TimeLineTime::scale(currTimeMarkWidth, usecPerPixel);
+
+    QPair<qint64, qint64> intersection(std::max(TimeLineTime::add(currTime, -currTimeMarkWidthUsec), startTime),
+                                       std::min(TimeLineTime::add(currTime, currTimeMarkWidthUsec), endTime));
+
+    if (intersection.first >= intersection.second){
+        return QPair<int, int>(-1, -1);
+    }
+
+    double pixelsPerUsec = 1/usecPerPixel;
+    int currTimePos = pixelsPerUsec * TimeLineTime::toDouble(currTime - startTime);
+
+    return QPair<int, int>(currTimePos - currTimeMarkWidth, currTimePos + currTimeMarkWidth);
+}
+
+void TimeLineGrid::drawCurrTimeMark(const double &usecPerPixel, const qint64 &currTime, const qint64& startTime,
+                                    const qint64 &endTime, QPair<int, int>& currTimeMarkBorders,
+                                    const QString textFormat, const QFontMetrics &fm, QPainter *painter)
+{
+    // Current time mark and it's text
+    QString currMarkTimeString = TimeLineTime::toString(mTimeCenterMark, textFormat, textFormat == mTimeFormat ? fractionDigits(usecPerPixel) : 0);
+    currTimeMarkBorders = getCurrTimeMarkBorders(usecPerPixel, currTime, startTime, endTime, textFormat, fm);
+
+    if (currTimeMarkBorders.first != -1 || currTimeMarkBorders.second != -1)
+    {
+        painter->setPen(QPen(mStyle.currMarkColor));
+
+        int currTimePos = (currTimeMarkBorders.first + currTimeMarkBorders.second) / 2;
+
+        // line
+        if (currTimePos < mSize.width() - mSettings.borderIndentX &&
+            currTimePos > mSettings.borderIndentX)
+        {
+            painter->drawLine(currTimePos, mSettings.borderIndentY, currTimePos, mSize.height() - mSettings.borderIndentY);
+        }
+
+        // curr time mark text, the size is calculated depending on the indent from the border
+        paintText(true, currTimePos, currMarkTimeString, painter, mStyle.currMarkColor);
+    }
+}
+
+void TimeLineGrid::drawMouseTimeMark(QPainter *painter)
+{
+    // The mouse mark and it's text
+    painter->setPen(QPen(mStyle.mouseMarkColor));
+
+    // line, border check
+    int linePosX = mMousePos.x();
+    QRect area = graphicsRect();
+
+    if (linePosX < area.left()){
+        linePosX = area.left();
+    }
+    else if (linePosX > area.right()){
+        linePosX = area.right();
+    }
+
+    painter->drawLine(linePosX, mSettings.borderIndentY, linePosX, mSize.height() - mSettings.borderIndentY);
+
+    // mouse time mark text, the size is calculated depending on the indent from the border
+    double part = mMousePos.x() / mSize.width();
+    double usecPerPixel = TimeLineTime::toDouble(2 * mTimeDelta) / mSize.width();
+    qint64 mouseTime = TimeLineTime::add(TimeLineTime::add(mTimeCenterMark, -mTimeDelta), TimeLineTime::scale(2 * mTimeDelta, part));
+    QString mouseTimeString = TimeLineTime::toString(mouseTime, "dd.MM.yy hh:mm:ss", fractionDigits(usecPerPixel));
+    paintText(false, linePosX, mouseTimeString, painter, mStyle.mouseMarkColor);
+
+    int textWidth = QFontMetrics(painter->font()).width(mouseTimeString);
+    mMouseMarkRect = QRect(linePosX - textWidth / 2 - 1, 0, textWidth + 2, mSize.height());
+}
+
+QRect TimeLineGrid::getMouseMarkRect() const
+{
+    if (mMouseMarkRect.isEmpty()){
+        return QRect();
+    }
+
+    int linePosX = std::min(std::max(mMousePos.x(), graphicsRect().left()), graphicsRect().right());
+
+    // The text width barely changes with the time, a margin covers the difference
+    int margin = 4;
+    return QRect(linePosX - mMouseMarkRect.width() / 2 - margin, 0, mMouseMarkRect.width() + 2 * margin, mSize.height());
+}
+
+void TimeLineGrid::updateOverlay()
+{
+    mOverlay->update();
+}
+
+qint64 TimeLineGrid::calculateStep(const int& maxNumberOfTextMarks) const
+{
+    using T = TimeLineTime;
+
+    // Round numbers of every time unit, from microseconds to centuries
+    static const qint64 steps[] = {
+        1, 2, 5, 10, 20, 50, 100, 200, 500,
+        T::millisecond, 2 * T::millisecond, 5 * T::millisecond, 10 * T::millisecond, 20 * T::millisecond,
+        50 * T::millisecond, 100 * T::millisecond, 200 * T::millisecond, 500 * T::millisecond,
+        T::second, 2 * T::second, 5 * T::second, 10 * T::second, 15 * T::second, 30 * T::second,
+        T::minute, 2 * T::minute, 5 * T::minute, 10 * T::minute, 15 * T::minute, 30 * T::minute,
+        T::hour, 2 * T::hour, 3 * T::hour, 6 * T::hour, 12 * T::hour,
+        T::day, 2 * T::day, 5 * T::day, 10 * T::day, 15 * T::day,
+        T::month, 2 * T::month, 3 * T::month, 6 * T::month,
+        T::year, 2 * T::year, 5 * T::year, T::decade, 2 * T::decade, 5 * T::decade, 10 * T::decade
+    };
+
+    qint64 range = 2 * mTimeDelta;
+
+    // Marks are labeled with dates only past a day, so finer steps would repeat the labels
+    qint64 minStep = range >= T::day ? T::day : T::microsecond;
+    qint64 stepCount = sizeof(steps) / sizeof(steps[0]);
+
+    for (int step = 0; step < stepCount; ++step)
+    {
+        if (steps[step] >= minStep && range / steps[step] <= std::max(maxNumberOfTextMarks, 1)){
+            return steps[step];
+        }
+    }
+
+    return steps[stepCount - 1] * (range / (steps[stepCount - 1] * std::max(maxNumberOfTextMarks, 1)) + 1);
+}
+
+QString TimeLineGrid::getTextFormat() const
+{
+    return 2 * mTimeDelta < TimeLineTime::day ? mTimeFormat : mDayFormat;
+}
+
+int TimeLineGrid::fractionDigits(const double& resolution)
+{
+    if (resolution >= TimeLineTime::second){
+        return 0;
+    }
+
+    return resolution >= TimeLineTime::millisecond ? 3 : 6;
+}
+
+void TimeLineGrid::paintText(bool topBottom, int xPos, QString text, QPainter* painter, QColor color)
+{
+    QPen pen = painter->pen();
+    QFont font = painter->font();
+    QFontMetrics fm(font);
+
+    pen.setColor(color);
+    painter->setPen(pen);
+
+    int yPos = topBottom ? (mSettings.borderIndentY - fm.height()) / 2 :
+                            mSize.height() - fm.height() - (mSettings.borderIndentY - fm.height()) / 2;
+
+    QRect textRect(xPos - fm.width(text) / 2, yPos, fm.width(text), fm.height());
+    painter->drawText(textRect, Qt::AlignCenter, text);
+}
+
+bool TimeLineGrid::setTimeRange(const qint64& centralTime, const qint64& timeDelta)
+{
+    // If the new scale is valid, set it
+    if (centralTime != TimeLineTime::mInvalidTime && timeDelta >= mSettings.maximumScale && timeDelta <= mSettings.minimumScale)
+    {
+        mTimeCenterMark = centralTime;
+        mTimeDelta = timeDelta;
+        update();
+        updateOverlay();
+
+        emit rangeChanged(TimeLineTime::toDateTime(TimeLineTime::add(mTimeCenterMark, -timeDelta)),
+                          TimeLineTime::toDateTime(TimeLineTime::add(mTimeCenterMark, timeDelta)));
+
+        return true;
+    }
+
+    return false;
+}
+
+void TimeLineGrid::setStyle(const TimeLineGridStyle& style)
+{
+    mStyle = style;
+    update();
+    updateOverlay();
+}
+
+void TimeLineGrid::setSettings(const TimeLineGridSettings& settings)
+{
+    mSettings = settings;
+    mSettings.maximumScale = qBound(mMinTimeScale, mSettings.maximumScale, mMaxTimeScale);
+    mSettings.minimumScale = qBound(mSettings.maximumScale, mSettings.minimumScale, mMaxTimeScale);
+
+    update();
+    updateOverlay();
+}
+
+void TimeLineGrid::setMousePos(const QPoint &pos, bool isDragging)
+{
+    bool rangeMoved = false;
+
+    if (isDragging)
+    {
+        int mouseDelta = mMousePos.x() - pos.x();
+        if (mouseDelta != 0)
+        {
+            mTimeCenterMark = TimeLineTime::add(mTimeCenterMark, TimeLineTime::scale(2 * mTimeDelta, mouseDelta / mSize.width()));
+            rangeMoved = true;
+        }
+    }
+
+    // Hovering touches only the old and the new mouse marks, the rest stays cached
+    QRect oldMouseMarkRect = getMouseMarkRect();
+    mMousePos = pos;
+
+    if (rangeMoved)
+    {
+        update();
+        updateOverlay();
+    }
+    else if (oldMouseMarkRect.isEmpty()){
+        updateOverlay();
+    }
+    else
+    {
+        mOverlay->update(oldMouseMarkRect);
+        mOverlay->update(getMouseMarkRect());
+
+        // The overlay shows the mouse position
+        if (mMetricsOverlayVisible){
+            mOverlay->update(mMetricsOverlayRect);
+        }
+    }
+}
+
+void TimeLineGrid::setMetrics(TimeLineMetricsPtr metrics)
+{
+    mMetrics = metrics;
+}
+
+void TimeLineGrid::setMetricsOverlayVisible(const bool& visible)
+{
+    mMetricsOverlayVisible = visible;
+    updateOverlay();
+}
+
+void TimeLineGrid::setMouseMarkVisible(const bool& visible)
+{
+    mMouseMarkVisible = visible;
+    updateOverlay();
+}
+
+void TimeLineGrid::setSize(const QSizeF &size, const QPointF& pos)
+{
+    prepareGeometryChange();
+    mOverlay->updateGeometry();
+
+    mSize = size;
+    setPos(pos);
+    update();
+    updateOverlay();
+}
+
+qint64 TimeLineGrid::getTimeMark() const
+{
+    return mTimeCenterMark;
+}
+
+qint64 TimeLineGrid::getTimeDelta() const
+{
+    return mTimeDelta;
+}
+
+QPoint TimeLineGrid::getMousePos() const
+{
+    return mMousePos;
+}
+
+TimeLineGrid::TimeLineGridSettings TimeLineGrid::getSettings() const
+{
+    return mSettings;
+}
+
+TimeLineGrid::TimeLineGridStyle TimeLineGrid::getStyle() const
+{
+    return mStyle;
+}
+
+bool TimeLineGrid::isMetricsOverlayVisible() const
+{
+    return mMetricsOverlayVisible;
+}
+
+QRectF TimeLineGrid::boundingRect() const
+{
+    return QRectF(0, 0, mSize.width(), mSize.height());
+}
+
+QRect TimeLineGrid::graphicsRect() const
+{
+    // Timeline item painting area, with indents taken into account
+    return QRect(mSettings.borderIndentX,
+                 mSettings.borderIndentY,
+                 mSize.width() - 2 * mSettings.borderIndentX,
+                 mSize.height() - 2 * mSettings.borderIndentY);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineGridOverlay         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TimeLineGridOverlay::TimeLineGridOverlay(TimeLineGrid* grid) : QGraphicsItem(grid),
+                                                               mGrid(grid)
+{
+    Q_ASSERT(mGrid != nullptr);
+}
+
+void TimeLineGridOverlay::updateGeometry()
+{
+    prepareGeometryChange();
+}
+
+QRectF TimeLineGridOverlay::boundingRect() const
+{
+    return mGrid->boundingRect();
+}
+
+void TimeLineGridOverlay::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    mGrid->drawOverlay(painter);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineSlabArena           //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TimeLineSlabArena::TimeLineSlabArena() :
+    mPartialSlabs(mClassCount, nullptr),
+    mSpareSlabs(mClassCount, nullptr),
+    mSlabCount(0),
+    mBytesInUse(0),
+    mChunkCount(0),
+    mLargeBytes(0)
+{
+
+}
+
+TimeLineSlabArena::~TimeLineSlabArena()
+{
+    // Allocators keep the arena alive, so nothing may be in use here and only the spare slabs are left
+    Q_ASSERT(mChunkCount == 0);
+    trim();
+}
+
+int TimeLineSlabArena::firstChunkOffset()
+{
+    return (sizeof(Slab) + mGranularity - 1) / mGranularity * mGranularity;
+}
+
+TimeLineSlabArena::Slab* TimeLineSlabArena::createSlab(const int& sizeClass)
+{
+    Slab* slab = static_cast<Slab*>(qMallocAligned(mSlabSize, mSlabSize));
+    Q_CHECK_PTR(slab);
+
+    slab->prev = nullptr;
+    slab->next = nullptr;
+    slab->freeChunks = nullptr;
+    slab->sizeClass = sizeClass;
+    slab->chunkSize = (sizeClass + 1) * mGranularity;
+    slab->capacity = (mSlabSize - firstChunkOffset()) / slab->chunkSize;
+    slab->usedChunks = 0;
+    slab->unusedOffset = firstChunkOffset();
+    slab->isPartial = false;
+
+    ++mSlabCount;
+    return slab;
+}
+
+void TimeLineSlabArena::releaseSlab(Slab* slab)
+{
+    Q_ASSERT(slab->usedChunks == 0 && !slab->isPartial);
+
+    --mSlabCount;
+    qFreeAligned(slab);
+}
+
+void TimeLineSlabArena::linkPartial(Slab* slab)
+{
+    Q_ASSERT(!slab->isPartial);
+
+    Slab*& head = mPartialSlabs[slab->sizeClass];
+    slab->prev = nullptr;
+    slab->next = head;
+    if (head != nullptr){
+        head->prev = slab;
+    }
+
+    head = slab;
+    slab->isPartial = true;
+}
+
+void TimeLineSlabArena::unlinkPartial(Slab* slab)
+{
+    Q_ASSERT(slab->isPartial);
+
+    if (slab->prev != nullptr){
+        slab->prev->next = slab->next;
+    }
+    else{
+        mPartialSlabs[slab->sizeClass] = slab->next;
+    }
+
+    if (slab->next != nullptr){
+        slab->next->prev = slab->prev;
+    }
+
+    slab->prev = nullptr;
+    slab->next = nullptr;
+    slab->isPartial = false;
+}
+
+void* TimeLineSlabArena::allocate(std::size_t size)
+{
+    size = std::max<std::size_t>(size, 1);
+    QMutexLocker lock(&mMutex);
+
+    if (size > static_cast<std::size_t>(mMaxChunkSize))
+    {
+        mLargeBytes += size;
+        return ::operator new(size);
+    }
+
+    int sizeClass = (size - 1) / mGranularity;
+    Slab* slab = mPartialSlabs[sizeClass];
+
+    if (slab == nullptr)
+    {
+        slab = mSpareSlabs[sizeClass];
+        if (slab != nullptr){
+            mSpareSlabs[sizeClass] = nullptr;
+        }
+        else{
+            slab = createSlab(sizeClass);
+        }
+
+        linkPartial(slab);
+    }
+
+    void* chunk = slab->freeChunks;
+    if (chunk != nullptr){
+        slab->freeChunks = *static_cast<void**>(chunk);
+    }
+    else
+    {
+        chunk = reinterpret_cast<char*>(slab) + slab->unusedOffset;
+        slab->unusedOffset += slab->chunkSize;
+    }
+
+    if (++slab->usedChunks == slab->capacity){
+        unlinkPartial(slab);
+    }
+
+    mBytesInUse += size;
+    ++mChunkCount;
+
+    return chunk;
+}
+
+void TimeLineSlabArena::deallocate(void* ptr, std::size_t size)
+{
+    if (ptr == nullptr){
+        return;
+    }
+
+    size = std::max<std::size_t>(size, 1);
+    QMutexLocker lock(&mMutex);
+
+    if (size > static_cast<std::size_t>(mMaxChunkSize))
+    {
+        mLargeBytes -= size;
+        ::operator delete(ptr);
+        return;
+    }
+
+    Slab* slab = reinterpret_cast<Slab*>(reinterpret_cast<quintptr>(ptr) & ~quintptr(mSlabSize - 1));
+    Q_ASSERT(static_cast<char*>(ptr) >= reinterpret_cast<char*>(slab) + firstChunkOffset());
+
+    bool wasFull = slab->usedChunks == slab->capacity;
+
+    *static_cast<void**>(ptr) = slab->freeChunks;
+    slab->freeChunks = ptr;
+    --slab->usedChunks;
+
+    mBytesInUse -= size;
+    --mChunkCount;
+
+    if (slab->usedChunks == 0)
+    {
+        // Empty slabs go back to the system, except for one spare to avoid thrashing at the boundary
+        if (slab->isPartial){
+            unlinkPartial(slab);
+        }
+
+        if (mSpareSlabs[slab->sizeClass] == nullptr){
+            mSpareSlabs[slab->sizeClass] = slab;
+        }
+        else{
+            releaseSlab(slab);
+        }
+    }
+    else if (wasFull){
+        linkPartial(slab);
+    }
+}
+
+void TimeLineSlabArena::trim()
+{
+    QMutexLocker lock(&mMutex);
+
+    for (Slab*& slab : mSpareSlabs)
+    {
+        if (slab != nullptr)
+        {
+            releaseSlab(slab);
+            slab = nullptr;
+        }
+    }
+}
+
+TimeLineSlabArena::Stats TimeLineSlabArena::getStats() const
+{
+    QMutexLocker lock(&mMutex);
+    Stats stats;
+
+    stats.slabCount = mSlabCount;
+    stats.bytesReserved = qint64(stats.slabCount) * mSlabSize + mLargeBytes;
+    stats.bytesInUse = mBytesInUse + mLargeBytes;
+    stats.chunkCount = mChunkCount;
+    stats.largeBytes = mLargeBytes;
+
+    if (stats.bytesReserved > 0){
+        stats.fragmentation = 1.0 - double(stats.bytesInUse) / stats.bytesReserved;
+    }
+
+    return stats;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////	                 TaskStorage            //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+const qint64 TaskStorage::mUnboundedStartTime;
+const qint64 TaskStorage::mUnboundedEndTime;
+const int TaskStorage::mRemovalSliceSize;
+
+TaskStorage::TaskStorage() :
+    mSlabArena(std::make_shared<TimeLineSlabArena>()),
+    mEventsById(0, std::hash<quint64>(), std::equal_to<quint64>(), TimeLineSlabAllocator<EventIndexNode>(mSlabArena)),
+    mNextEventId(1),
+    mCoalescingGap(-1),
+    mColdCache(std::make_shared<TimeLineColdCache>()),
+    mStringPool(std::make_shared<TimeLineStringPool>()),
+    mColdHistoryAge(-1),
+    mDirtyStartTime(mUnboundedEndTime),
+    mDirtyEndTime(mUnboundedStartTime),
+    mFlushPending(false),
+    mRevision(0),
+    mTaskSetRevision(0)
+{
+    // changed() is queued to receivers in other threads
+    qRegisterMetaType<QList<TimeLineTaskType>>("QList<TimeLineTaskType>");
+
+    mFreezeTimer = new QTimer(this);
+    connect(mFreezeTimer, SIGNAL(timeout()), this, SLOT(onFreezeTimer()));
+}
+
+TaskItemPtr TaskStorage::createTask(const QDateTime startTime, const QDateTime endTime, const quint64& taskId,
+                                    const bool& isInfinite, const QString taskName, const TimeLineTaskType& taskType)
+{
+    TaskItemPtr task = std::allocate_shared<TaskItem>(TimeLineSlabAllocator<TaskItem>(mSlabArena),
+                                                      startTime, endTime, taskId, isInfinite, taskName, taskType);
+    task->mSlabArena = mSlabArena;
+    task->setStringPool(mStringPool);
+
+    return task;
+}
+
+EventItemPtr TaskStorage::createEvent(QDateTime startTime, QDateTime endTime, EventItem::EventStatus stat,
+                                      const quint64& eventId, const QString& payload)
+{
+    return createEvent(TimeLineTime::fromDateTime(startTime), TimeLineTime::fromDateTime(endTime), stat, eventId, payload);
+}
+
+TaskItemPtr TaskStorage::createTask(const qint64& startTime, const qint64& endTime, const quint64& taskId,
+                                    const bool& isInfinite, const QString taskName, const TimeLineTaskType& taskType)
+{
+    TaskItemPtr task = std::allocate_shared<TaskItem>(TimeLineSlabAllocator<TaskItem>(mSlabArena),
+                                                      startTime, endTime, taskId, isInfinite, taskName, taskType);
+    task->mSlabArena = mSlabArena;
+    task->setStringPool(mStringPool);
+
+    return task;
+}
+
+EventItemPtr TaskStorage::createEvent(const qint64& startTime, const qint64& endTime, EventItem::EventStatus stat,
+                                      const quint64& eventId, const QString& payload)
+{
+    EventItemPtr event = std::allocate_shared<EventItem>(TimeLineSlabAllocator<EventItem>(mSlabArena), startTime, endTime, stat, eventId);
+    event->setPayloadId(mStringPool->intern(payload));
+
+    return event;
+}
+
+bool TaskStorage::addTask(const TaskItemPtr task)
+{
+    QMutexLocker lock(&mMutex);
+
+    Q_ASSERT(task != nullptr);
+    if (task == nullptr){
+        return false;
+    }
+
+    auto taskIter = mTasks.find(task->getTaskId());
+    if (taskIter == mTasks.end() || *taskIter == nullptr)
+    {
+        // Events added to the task before must keep the ids unique, otherwise they'd be unreachable by id
+        QVector<EventItemPtr> events = task->getEvents(mUnboundedStartTime, mUnboundedEndTime);
+        QSet<quint64> eventIds;
+
+        for (auto& event : events)
+        {
+            quint64 eventId = event->getEventId();
+            if (eventId && (isEventIdTaken(eventId) || eventIds.contains(eventId))){
+                return false;
+            }
+
+            eventIds.insert(eventId);
+        }
+
+        mTasks.insert(task->getTaskId(), task);
+        ++mTaskSetRevision;
+
+        if (task->mSlabArena == nullptr){
+            task->mSlabArena = mSlabArena;
+        }
+
+        if (mCoalescingGap >= 0){
+            task->setCoalescingGap(mCoalescingGap);
+        }
+
+        task->mColdCache = mColdCache;
+        task->setStringPool(mStringPool);
+
+        // A task erased from a storage before may come with its old bookkeeping
+        task->mPurgeTime = mUnboundedEndTime;
+
+        TaskBucket& bucket = mTaskBuckets[task->getTaskType()];
+        task->mBucketPos = bucket.tasks.size();
+        bucket.tasks.append(task);
+
+        // The task may come with events added before
+        for (auto& event : events)
+        {
+            bool indexed = indexEvent(event);
+            Q_ASSERT(indexed);
+            Q_UNUSED(indexed);
+
+            if (event->getStatus() == EventItem::EVENT_STATUS_FAILURE){
+                insertInfoMark(InfoMark(event->getMiddleTime(), task->getTaskId(), task->getTaskType(), event));
+            }
+        }
+
+        indexTask(task);
+
+        // An unset start time is the unbounded one already
+        markDirty(task->getTaskType(), task->getStartTimeUs(),
+                  task->getEndTimeUs() != TimeLineTime::mInvalidTime && !task->isInfinite()? task->getEndTimeUs() : mUnboundedEndTime);
+    }
+    else
+    {
+        auto existingTask = *taskIter;
+        if (existingTask->getEndTimeUs() != task->getEndTimeUs())
+        {
+            qint64 oldEndTime = existingTask->getEndTimeUs();
+            existingTask->setEndTimeUs(task->getEndTimeUs());
+            indexTask(existingTask);
+
+            // Only the part between the old and the new end changes
+            if (oldEndTime != TimeLineTime::mInvalidTime && task->getEndTimeUs() != TimeLineTime::mInvalidTime)
+            {
+                markDirty(existingTask->getTaskType(),
+                          std::min(oldEndTime, task->getEndTimeUs()),
+                          std::max(oldEndTime, task->getEndTimeUs()));
+            }
+            else{
+                markDirty(existingTask->getTaskType(), mUnboundedStartTime, mUnboundedEndTime);
+            }
+        }
+    }
+
+    return true;
+}
+
+void TaskStorage::removeTask(const quint64& taskId, const bool& force)
+{
+    // The events go in slices first, so that painting isn't blocked meanwhile
+    if (force){
+        removeEvents(taskId, mUnboundedStartTime, mUnboundedEndTime);
+    }
+
+    QVector<EventItemPtr> removed;                            // Released after unlocking
+    QMutexLocker lock(&mMutex);
+
+    auto taskIter = mTasks.find(taskId);
+    if (taskIter != mTasks.end() && (*taskIter) != nullptr)
+    {
+        TaskItemPtr taskPtr = *taskIter;
+
+        // Events added since the slices were removed
+        if (force){
+            removeColdTaskEvents(taskPtr, mUnboundedStartTime, mUnboundedEndTime);
+        }
+
+        while (force && taskPtr->eventCount()){
+            removed += removeTaskEvents(taskPtr, mUnboundedStartTime, mUnboundedEndTime);
+        }
+
+        bool noNeedToDelete = taskPtr->eventCount();
+
+        if (!noNeedToDelete){
+            eraseTask(taskPtr);
+        }
+    }
+}
+
+void TaskStorage::setCoalescingGap(const qint64& gap)
+{
+    QMutexLocker lock(&mMutex);
+
+    // Events already stored stay as they are
+    mCoalescingGap = gap;
+    for (auto& task : mTasks){
+        task->setCoalescingGap(gap);
+    }
+}
+
+void TaskStorage::setColdHistoryAge(const qint64& age)
+{
+    QMutexLocker lock(&mMutex);
+
+    mColdHistoryAge = age;
+    if (age < 0){
+        mFreezeTimer->stop();
+    }
+    else{
+        mFreezeTimer->start(mFreezeInterval);
+    }
+}
+
+void TaskStorage::setColdCacheSize(const int& blocks)
+{
+    mColdCache->setMaxBlocks(blocks);
+}
+
+int TaskStorage::freezeBefore(const QDateTime& time)
+{
+    Q_ASSERT(time.isValid());
+    if (!time.isValid()){
+        return 0;
+    }
+
+    return freezeBefore(TimeLineTime::fromDateTime(time));
+}
+
+int TaskStorage::freezeBefore(const qint64& time)
+{
+    // Tasks with no event starting before time have nothing to freeze
+    QList<quint64> taskIds;
+    {
+        QMutexLocker lock(&mMutex);
+        for (auto task = mTasksByPurgeTime.begin(); task != mTasksByPurgeTime.end() && task.key() < time; ++task){
+            taskIds.append(task.value());
+        }
+    }
+
+    // A block per lock, painting goes on in between
+    int frozenCount = 0;
+    for (const quint64& taskId : taskIds)
+    {
+        while (true)
+        {
+            QVector<EventItemPtr> frozen;                     // Released after unlocking
+            {
+                QMutexLocker lock(&mMutex);
+
+                TaskItemPtr task = mTasks.value(taskId);
+                if (task == nullptr){
+                    break;
+                }
+
+                ColdEventBlockPtr coldBlock;
+                frozen = task->freezeEvents(time, coldBlock);
+
+                // The ids stay taken by the cold block, the index nodes go with the items
+                if (coldBlock != nullptr){
+                    registerColdBlock(coldBlock);
+                }
+
+                for (auto& event : frozen){
+                    mEventsById.erase(event->getEventId());
+                }
+            }
+
+            if (frozen.isEmpty()){
+                break;
+            }
+
+            frozenCount += frozen.size();
+        }
+    }
+
+    return frozenCount;
+}
+
+void TaskStorage::onFreezeTimer()
+{
+    qint64 age = 0;
+    {
+        QMutexLocker lock(&mMutex);
+        age = mColdHistoryAge;
+    }
+
+    if (age >= 0){
+        freezeBefore(TimeLineTime::add(TimeLineTime::currentTime(), -age));
+    }
+}
+
+qint64 TaskStorage::getColdHistoryAge() const
+{
+    return mColdHistoryAge;
+}
+
+void TaskStorage::eraseTask(const TaskItemPtr& task)
+{
+    mTasks.remove(task->getTaskId());
+    ++mTaskSetRevision;
+
+    markDirty(task->getTaskType(), task->getStartTimeUs(),
+              task->getEndTimeUs() != TimeLineTime::mInvalidTime && !task->isInfinite()? task->getEndTimeUs() : mUnboundedEndTime);
+
+    unindexTask(task);
+
+    // A hole by position instead of a search, the bucket is compacted once half of it is holes
+    auto bucket = mTaskBuckets.find(task->getTaskType());
+    if (bucket != mTaskBuckets.end() && task->mBucketPos >= 0 && task->mBucketPos < bucket->tasks.size() &&
+        bucket->tasks[task->mBucketPos] == task)
+    {
+        bucket->tasks[task->mBucketPos].reset();
+        task->mBucketPos = -1;
+
+        if (++bucket->holeCount * 2 > bucket->tasks.size()){
+            compactBucket(*bucket);
+        }
+    }
+}
+
+void TaskStorage::compactBucket(TaskBucket& bucket)
+{
+    int taskCount = 0;
+    for (auto& task : bucket.tasks)
+    {
+        if (task != nullptr)
+        {
+            task->mBucketPos = taskCount;
+            bucket.tasks[taskCount++] = task;
+        }
+    }
+
+    bucket.tasks.resize(taskCount);
+    bucket.holeCount = 0;
+}
+
+void TaskStorage::indexTask(const TaskItemPtr& task)
+{
+    // Finished tasks without events are purged by their end
+    qint64 purgeTime = task->firstEventStartTime();
+    if (purgeTime == mUnboundedEndTime && !task->isInfinite() && task->getEndTimeUs() != TimeLineTime::mInvalidTime){
+        purgeTime = task->getEndTimeUs();
+    }
+
+    if (purgeTime == task->mPurgeTime){
+        return;
+    }
+
+    unindexTask(task);
+
+    task->mPurgeTime = purgeTime;
+    if (purgeTime != mUnboundedEndTime){
+        mTasksByPurgeTime.insert(purgeTime, task->getTaskId());
+    }
+}
+
+void TaskStorage::unindexTask(const TaskItemPtr& task)
+{
+    for (auto indexed = mTasksByPurgeTime.find(task->mPurgeTime); indexed != mTasksByPurgeTime.end() && indexed.key() == task->mPurgeTime; ++indexed)
+    {
+        if (*indexed == task->getTaskId())
+        {
+            mTasksByPurgeTime.erase(indexed);
+            break;
+        }
+    }
+
+    task->mPurgeTime = mUnboundedEndTime;
+}
+
+int TaskStorage::removeEvents(const quint64& taskId, const QDateTime& startTime, const QDateTime& endTime)
+{
+    return removeEvents(taskId, TimeLineTime::fromDateTime(startTime),
+                        endTime.isValid()? TimeLineTime::fromDateTime(endTime) : mUnboundedEndTime);
+}
+
+int TaskStorage::removeEvents(const quint64& taskId, const qint64& startTime, const qint64& endTime)
+{
+    int removedCount = 0;
+    int sliceSize = 0;
+    bool isFirstSlice = true;
+
+    // The lock is released between slices, so a big removal doesn't stall painting
+    do
+    {
+        QVector<EventItemPtr> removed;                        // Released after unlocking
+        {
+            QMutexLocker lock(&mMutex);
+
+            TaskItemPtr task = mTasks.value(taskId);
+            if (task == nullptr){
+                break;
+            }
+
+            // Cold blocks mostly go as a whole, so they are done at once
+            if (isFirstSlice){
+                removedCount += removeColdTaskEvents(task, startTime, endTime);
+            }
+
+            isFirstSlice = false;
+            removed = removeTaskEvents(task, startTime, endTime);
+        }
+
+        // Merged events are counted one by one
+        sliceSize = removed.size();
+        for (auto& event : removed){
+            removedCount += event->getRunLength();
+        }
+    }
+    while (sliceSize >= mRemovalSliceSize);
+
+    return removedCount;
+}
+
+int TaskStorage::purgeBefore(const QDateTime& time)
+{
+    Q_ASSERT(time.isValid());
+    if (!time.isValid()){
+        return 0;
+    }
+
+    return purgeBefore(TimeLineTime::fromDateTime(time));
+}
+
+int TaskStorage::purgeBefore(const qint64& time)
+{
+    const qint64& purgeTime = time;
+    int removedCount = 0;
+
+    // A slice per lock, painting goes on in between. Only the tasks with something before the time are visited
+    while (true)
+    {
+        QVector<EventItemPtr> removed;                        // Released after unlocking
+        {
+            QMutexLocker lock(&mMutex);
+
+            auto first = mTasksByPurgeTime.begin();
+            if (first == mTasksByPurgeTime.end() || first.key() >= purgeTime){
+                break;
+            }
+
+            TaskItemPtr task = mTasks.value(first.value());
+            Q_ASSERT(task != nullptr);
+            if (task == nullptr)
+            {
+                mTasksByPurgeTime.erase(first);
+                continue;
+            }
+
+            // Reindexes the task, it moves on once nothing before the time is left
+            removedCount += removeColdTaskEvents(task, mUnboundedStartTime, purgeTime);
+            removed = removeTaskEvents(task, mUnboundedStartTime, purgeTime);
+
+            // Finished tasks with nothing left go as well
+            if (!task->isInfinite() && !task->eventCount() &&
+                task->getEndTimeUs() != TimeLineTime::mInvalidTime && task->getEndTimeUs() < purgeTime)
+            {
+                eraseTask(task);
+            }
+        }
+
+        // Merged events are counted one by one
+        for (auto& event : removed){
+            removedCount += event->getRunLength();
+        }
+    }
+
+    return removedCount;
+}
+
+bool TaskStorage::addEvent(const quint32 taskId, const EventItemPtr event)
+{
+    QMutexLocker lock(&mMutex);
+    return insertEvent(taskId, event);
+}
+
+int TaskStorage::addEvents(const QVector<QPair<quint64, EventItemPtr>>& events)
+{
+    QMutexLocker lock(&mMutex);
+
+    int addedCount = 0;
+    for (auto& event : events){
+        addedCount += insertEvent(event.first, event.second);
+    }
+
+    return addedCount;
+}
+
+bool TaskStorage::insertEvent(const quint64& taskId, const EventItemPtr& event)
+{
+    bool result = true;
+
+    Q_ASSERT(event != nullptr);
+    if (event == nullptr){
+        return false;
+    }
+
+    // The same event can't be added twice
+    if (event->getEventId() && isEventIdTaken(event->getEventId())){
+        return false;
+    }
+
+    auto parentTask = mTasks.find(taskId);
+    if (parentTask == mTasks.end()){
+        return false;
+    }
+
+    // The task may be prolonged by the event
+    qint64 oldTaskEndTime = (*parentTask)->getEndTimeUs();
+    EventItemPtr addedItem = (*parentTask)->addEvent(event);
+
+    qint64 dirtyStartTime = event->getStartTimeUs();
+    if (oldTaskEndTime != TimeLineTime::mInvalidTime && oldTaskEndTime < dirtyStartTime){
+        dirtyStartTime = oldTaskEndTime;
+    }
+
+    // Merged into a run, which is indexed already
+    if (addedItem != nullptr && addedItem != event){
+        markDirty((*parentTask)->getTaskType(), dirtyStartTime, event->getEndTimeUs());
+    }
+    else if (addedItem != nullptr)
+    {
+        event->setParentTask(*parentTask);
+        indexEvent(event);
+        indexTask(*parentTask);
+
+        markDirty((*parentTask)->getTaskType(), dirtyStartTime, event->getEndTimeUs());
+
+        if (event->getStatus() == EventItem::EVENT_STATUS_FAILURE)
+        {
+            insertInfoMark(InfoMark(event->getMiddleTime(), taskId,
+                                    (*parentTask)->getTaskType(), event));
+        }
+    }
+    else{
+        result = false;
+    }
+
+    return result;
+}
+
+void TaskStorage::clear()
+{
+    {
+        // Released after unlocking, destroying every item under the lock would stall painting
+        QHash<quint64, TaskItemPtr> tasks;
+        QHash<TimeLineTaskType, TaskBucket> taskBuckets;
+        QMultiMap<qint64, InfoMark> infoMarks;
+        QMultiMap<qint64, quint64> tasksByPurgeTime;
+        QMultiMap<quint64, ColdEventBlockPtr> coldBlocksByMaxId;
+        EventIndex eventsById(0, std::hash<quint64>(), std::equal_to<quint64>(), TimeLineSlabAllocator<EventIndexNode>(mSlabArena));
+
+        QMutexLocker lock(&mMutex);
+
+        for (auto type = mTaskBuckets.begin(); type != mTaskBuckets.end(); ++type){
+            markDirty(type.key(), mUnboundedStartTime, mUnboundedEndTime);
+        }
+
+        // A fresh index, clear() would keep the bucket array of the old one in the arena
+        tasks.swap(mTasks);
+        taskBuckets.swap(mTaskBuckets);
+        tasksByPurgeTime.swap(mTasksByPurgeTime);
+        coldBlocksByMaxId.swap(mColdBlocksByMaxId);
+        infoMarks.swap(mInfoMarks);
+        eventsById.swap(mEventsById);
+        ++mTaskSetRevision;
+    }
+
+    mColdCache->clear();
+
+    // Items still referenced outside keep their slabs, the rest are back to the system already
+    mSlabArena->trim();
+}
+
+TaskItemPtr TaskStorage::getTask(const quint64& taskId)
+{
+    QMutexLocker lock(&mMutex);
+
+    TaskItemPtr taskPtr;
+
+    auto taskIter = mTasks.find(taskId);
+    if (taskIter != mTasks.end()){
+        taskPtr = *taskIter;
+    }
+
+    return taskPtr;
+}
+
+EventItemPtr TaskStorage::getEvent(const quint64& eventId)
+{
+    QMutexLocker lock(&mMutex);
+    auto event = mEventsById.find(eventId);
+    return event != mEventsById.end()? event->second : EventItemPtr();
+}
+
+EventItemPtr TaskStorage::getEvent(const quint64& taskId, const QDateTime& startTime)
+{
+    return getEvent(taskId, TimeLineTime::fromDateTime(startTime));
+}
+
+EventItemPtr TaskStorage::getEvent(const quint64& taskId, const qint64& startTime)
+{
+    QMutexLocker lock(&mMutex);
+
+    EventItemPtr eventPtr;
+
+    auto taskIter = mTasks.find(taskId);
+    if (taskIter != mTasks.end())
+    {
+        TaskItemPtr taskPtr = *taskIter;
+        QVector<EventItemPtr> events = taskPtr->getEvents(startTime, TimeLineTime::add(startTime, 1));
+
+        if (!events.isEmpty()){
+            eventPtr = events.first();
+        }
+        else if (taskPtr->coldEventCount())
+        {
+            QVector<EventItemPtr> coldEvents = taskPtr->getColdEvents(startTime, TimeLineTime::add(startTime, 1));
+            if (!coldEvents.isEmpty()){
+                eventPtr = coldEvents.first();
+            }
+        }
+    }
+
+    return eventPtr;
+}
+
+QVector<EventItemPtr> TaskStorage::getEvents(const quint64& taskId, const QDateTime& startTime, const QDateTime& endTime)
+{
+    return getEvents(taskId, TimeLineTime::fromDateTime(startTime), TimeLineTime::fromDateTime(endTime));
+}
+
+QVector<EventItemPtr> TaskStorage::getEvents(const quint64& taskId, const qint64& startTime, const qint64& endTime)
+{
+    QMutexLocker lock(&mMutex);
+
+    QVector<EventItemPtr> result;
+
+    auto taskIter = mTasks.find(taskId);
+    if (taskIter != mTasks.end())
+    {
+        result = (*taskIter)->getEvents(startTime, endTime);
+
+        // Frozen events are decoded only if the range reaches them
+        if ((*taskIter)->coldEventCount())
+        {
+            QVector<EventItemPtr> coldEvents = (*taskIter)->getColdEvents(startTime, endTime);
+            if (!coldEvents.isEmpty())
+            {
+                result += coldEvents;
+                std::sort(result.begin(), result.end(),
+                          [](const EventItemPtr& first, const EventItemPtr& second){ return first->getStartTimeUs() < second->getStartTimeUs(); });
+            }
+        }
+    }
+
+    return result;
+}
+
+const QHash<quint64, TaskItemPtr> TaskStorage::getTasks()
+{
+    return mTasks;
+}
+
+const QVector<TaskItemPtr> TaskStorage::getTasks(const TimeLineTaskType& taskType) const
+{
+    TaskBucket bucket = mTaskBuckets.value(taskType);
+    if (!bucket.holeCount){
+        return bucket.tasks;
+    }
+
+    QVector<TaskItemPtr> tasks;
+    tasks.reserve(bucket.tasks.size() - bucket.holeCount);
+
+    for (auto& task : bucket.tasks)
+    {
+        if (task != nullptr){
+            tasks.append(task);
+        }
+    }
+
+    return tasks;
+}
+
+TimeLineSlabArena::Stats TaskStorage::getAllocatorStats() const
+{
+    return mSlabArena->getStats();
+}
+
+quint32 TaskStorage::internString(const QString& string)
+{
+    return mStringPool->intern(string);
+}
+
+QString TaskStorage::getString(const quint32& id) const
+{
+    return mStringPool->getString(id);
+}
+
+QString TaskStorage::getEventPayload(const EventItemPtr& event) const
+{
+    Q_ASSERT(event != nullptr);
+    if (event == nullptr){
+        return QString();
+    }
+
+    return mStringPool->getString(event->getPayloadId());
+}
+
+const TimeLineStringPoolPtr& TaskStorage::getStringPool() const
+{
+    return mStringPool;
+}
+
+quint64 TaskStorage::getRevision() const
+{
+    return mRevision;
+}
+
+quint64 TaskStorage::getTaskSetRevision() const
+{
+    return mTaskSetRevision;
+}
+
+QVector<TaskStorage::InfoMark> TaskStorage::getInfoMarks(const qint64& startTime, const qint64& endTime) const
+{
+    QVector<InfoMark> marks;
+
+    for (auto mark = mInfoMarks.lowerBound(startTime); mark != mInfoMarks.end() && mark.key() < endTime; ++mark){
+        marks.append(*mark);
+    }
+
+    return marks;
+}
+
+int TaskStorage::countInfoMarks(const QDateTime& startTime, const QDateTime& endTime, const TimeLineTaskType& taskType)
+{
+    return countInfoMarks(TimeLineTime::fromDateTime(startTime), TimeLineTime::fromDateTime(endTime), taskType);
+}
+
+int TaskStorage::countInfoMarks(const qint64& startTime, const qint64& endTime, const TimeLineTaskType& taskType)
+{
+    QMutexLocker lock(&mMutex);
+
+    int count = 0;
+
+    for (auto mark = mInfoMarks.lowerBound(startTime); mark != mInfoMarks.end() && mark.key() < endTime; ++mark)
+    {
+        if (taskType == TL_TASK_TYPE_INVALID || mark->taskType == taskType){
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+void TaskStorage::markDirty(const TimeLineTaskType& taskType, const qint64& startTime, const qint64& endTime)
+{
+    ++mRevision;
+
+    if (!mDirtyTypes.contains(taskType)){
+        mDirtyTypes.append(taskType);
+    }
+
+    mDirtyStartTime = std::min(mDirtyStartTime, startTime);
+    mDirtyEndTime = std::max(mDirtyEndTime, endTime);
+
+    // All the changes made until the storage's thread gets back to it's event loop go into a single notification
+    if (!mFlushPending)
+    {
+        mFlushPending = true;
+        QMetaObject::invokeMethod(this, "flushChanges", Qt::QueuedConnection);
+    }
+}
+
+void TaskStorage::flushChanges()
+{
+    QList<TimeLineTaskType> dirtyTypes;
+    qint64 dirtyStartTime = mUnboundedStartTime;
+    qint64 dirtyEndTime = mUnboundedEndTime;
+
+    {
+        QMutexLocker lock(&mMutex);
+
+        // The end is exclusive, so it's past the last changed usec
+        dirtyStartTime = mDirtyStartTime;
+        dirtyEndTime = TimeLineTime::add(mDirtyEndTime, TimeLineTime::microsecond);
+
+        dirtyTypes.swap(mDirtyTypes);
+        mDirtyStartTime = mUnboundedEndTime;
+        mDirtyEndTime = mUnboundedStartTime;
+        mFlushPending = false;
+    }
+
+    // Emitted unlocked, so the receivers are free to query the storage
+    emit changed(dirtyTypes, dirtyStartTime, dirtyEndTime);
+}
+
+bool TaskStorage::indexEvent(const EventItemPtr& event)
+{
+    if (event->mEventId == 0)
+    {
+        while (isEventIdTaken(mNextEventId)){
+            ++mNextEventId;
+        }
+
+        event->mEventId = mNextEventId++;
+    }
+    else if (isEventIdTaken(event->mEventId)){
+        return false;
+    }
+
+    mEventsById.emplace(event->mEventId, event);
+    return true;
+}
+
+bool TaskStorage::isEventIdTaken(const quint64& eventId) const
+{
+    if (mEventsById.count(eventId)){
+        return true;
+    }
+
+    // Ids grow with time mostly, so a new id is past every block and the walk ends at once
+    for (auto block = mColdBlocksByMaxId.lowerBound(eventId); block != mColdBlocksByMaxId.end(); ++block)
+    {
+        if ((*block)->hasEventId(eventId)){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TaskStorage::registerColdBlock(const ColdEventBlockPtr& block)
+{
+    mColdBlocksByMaxId.insert(block->getMaxEventId(), block);
+}
+
+void TaskStorage::unregisterColdBlock(const ColdEventBlockPtr& block)
+{
+    for (auto registered = mColdBlocksByMaxId.find(block->getMaxEventId());
+         registered != mColdBlocksByMaxId.end() && registered.key() == block->getMaxEventId(); ++registered)
+    {
+        if (*registered == block)
+        {
+            mColdBlocksByMaxId.erase(registered);
+            break;
+        }
+    }
+}
+
+void TaskStorage::insertInfoMark(const InfoMark& mark)
+{
+    mInfoMarks.insert(mark.time, mark);
+}
+
+int TaskStorage::removeColdTaskEvents(const TaskItemPtr& task, const qint64& startTime, const qint64& endTime)
+{
+    if (task->getColdBlocks().isEmpty()){
+        return 0;
+    }
+
+    qint64 oldEndTime = task->getEndTimeUs();
+
+    QVector<ColdEventBlockPtr> removedBlocks;
+    QVector<ColdEventBlockPtr> addedBlocks;
+    int removedCount = task->removeColdEvents(startTime, endTime, removedBlocks, addedBlocks);
+
+    // Frozen ids aren't in mEventsById, they are freed with their blocks
+    for (auto& block : removedBlocks){
+        unregisterColdBlock(block);
+    }
+
+    for (auto& block : addedBlocks){
+        registerColdBlock(block);
+    }
+
+    if (removedCount)
+    {
+        indexTask(task);
+
+        qint64 dirtyEndTime = endTime;
+        if (oldEndTime != TimeLineTime::mInvalidTime && oldEndTime != task->getEndTimeUs()){
+            dirtyEndTime = std::max(dirtyEndTime, oldEndTime);
+        }
+
+        markDirty(task->getTaskType(), startTime, dirtyEndTime);
+    }
+
+    return removedCount;
+}
+
+QVector<EventItemPtr> TaskStorage::removeTaskEvents(const TaskItemPtr& task, const qint64& startTime, const qint64& endTime)
+{
+    qint64 oldEndTime = task->getEndTimeUs();
+
+    QVector<EventItemPtr> removed = task->removeEvents(startTime, endTime, mRemovalSliceSize);
+    if (removed.isEmpty()){
+        return removed;
+    }
+
+    QVector<EventItemPtr> markedEvents;
+    qint64 dirtyStartTime = removed.first()->getStartTimeUs();
+    qint64 dirtyEndTime = mUnboundedStartTime;
+
+    for (auto& event : removed)
+    {
+        mEventsById.erase(event->getEventId());
+        dirtyEndTime = std::max(dirtyEndTime, event->getEndTimeUs());
+
+        if (event->getStatus() == EventItem::EVENT_STATUS_FAILURE){
+            markedEvents.append(event);
+        }
+    }
+
+    removeInfoMarks(markedEvents);
+    indexTask(task);
+
+    // A shortened task frees the rest of its old span
+    if (oldEndTime != TimeLineTime::mInvalidTime && oldEndTime != task->getEndTimeUs())
+    {
+        dirtyStartTime = std::min(dirtyStartTime, task->getEndTimeUs());
+        dirtyEndTime = std::max(dirtyEndTime, oldEndTime);
+    }
+
+    markDirty(task->getTaskType(), dirtyStartTime, dirtyEndTime);
+
+    return removed;
+}
+
+void TaskStorage::removeInfoMarks(const QVector<EventItemPtr>& events)
+{
+    // A lookup by time per mark, then a walk over the marks at the same time
+    for (auto& event : events)
+    {
+        qint64 time = event->getMiddleTime();
+
+        for (auto mark = mInfoMarks.find(time); mark != mInfoMarks.end() && mark.key() == time; ++mark)
+        {
+            if (mark->event == event)
+            {
+                mInfoMarks.erase(mark);
+                break;
+            }
+        }
+    }
+}
+
+void TaskStorage::lock()
+{
+    mMutex.lock();
+}
+
+void TaskStorage::unlock()
+{
+    mMutex.unlock();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineSharedFeed          //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+const int TimeLineSharedFeed::mMaxPayloadSize;
+
+// Both processes must agree on the layout, whatever they are built with
+static_assert(sizeof(TimeLineSharedFeed::Record) == 120, "The shared feed record layout has changed");
+static_assert(sizeof(TimeLineSharedFeed::Slot) == 128, "The shared feed slot layout has changed");
+static_assert(sizeof(TimeLineSharedFeed::Header) == 24, "The shared feed header layout has changed");
+
+TimeLineSharedFeed::TimeLineSharedFeed(TaskStoragePtr taskStorage, QObject* parent) :
+                                       QObject(parent),
+                                       mTaskStorage(taskStorage),
+                                       mHeader(nullptr),
+                                       mSlots(nullptr),
+                                       mNextSequence(0),
+                                       mReceivedCount(0),
+                                       mLostCount(0),
+                                       mBatchSize(4096),
+                                       mPollInterval(10)
+{
+    Q_ASSERT(mTaskStorage != nullptr);
+
+    mPollTimer = new QTimer(this);
+    connect(mPollTimer, SIGNAL(timeout()), this, SLOT(onPollTimer()));
+}
+
+TimeLineSharedFeed::~TimeLineSharedFeed()
+{
+    detach();
+}
+
+bool TimeLineSharedFeed::attach(const QString& key)
+{
+    detach();
+
+    mSharedMemory.setKey(key);
+    if (!mSharedMemory.attach()){
+        return false;
+    }
+
+    // The collector fills the header before anything is published
+    const Header* header = static_cast<const Header*>(mSharedMemory.constData());
+    bool valid = mSharedMemory.size() >= (int)sizeof(Header) &&
+                 header->magic == mMagic &&
+                 header->version == mVersion &&
+                 header->slotSize == sizeof(Slot) &&
+                 header->capacity && !(header->capacity & (header->capacity - 1)) &&
+                 mSharedMemory.size() >= sharedMemorySize(header->capacity);
+
+    Q_ASSERT(valid);
+    if (!valid)
+    {
+        mSharedMemory.detach();
+        return false;
+    }
+
+    mHeader = header;
+    mSlots = reinterpret_cast<const Slot*>(header + 1);
+
+    quint64 writeSequence = mHeader->writeSequence.load(std::memory_order_acquire);
+    mNextSequence = writeSequence > mHeader->capacity? writeSequence - mHeader->capacity : 0;
+
+    return true;
+}
+
+void TimeLineSharedFeed::detach()
+{
+    stop();
+
+    if (mSharedMemory.isAttached()){
+        mSharedMemory.detach();
+    }
+
+    mHeader = nullptr;
+    mSlots = nullptr;
+}
+
+void TimeLineSharedFeed::setBatchSize(const int& batchSize)
+{
+    Q_ASSERT(batchSize > 0);
+    mBatchSize = std::max(batchSize, 1);
+}
+
+void TimeLineSharedFeed::start(const int& pollInterval)
+{
+    mPollInterval = pollInterval;
+    mPollTimer->start(mPollInterval);
+}
+
+void TimeLineSharedFeed::stop()
+{
+    mPollTimer->stop();
+}
+
+int TimeLineSharedFeed::poll()
+{
+    if (mHeader == nullptr){
+        return 0;
+    }
+
+    const quint32& capacity = mHeader->capacity;
+    quint64 writeSequence = mHeader->writeSequence.load(std::memory_order_acquire);
+    quint64 lostCount = 0;
+
+    // The collector re-created the ring and counts from 0 again, the subtraction below would wrap. What the new ring still holds is read
+    if (writeSequence < mNextSequence){
+        mNextSequence = writeSequence > capacity? writeSequence - capacity : 0;
+    }
+
+    // The collector has lapped the reader, what it overwrote is gone
+    if (writeSequence - mNextSequence > capacity)
+    {
+        lostCount += writeSequence - capacity - mNextSequence;
+        mNextSequence = writeSequence - capacity;
+    }
+
+    quint64 lastSequence = std::min<quint64>(writeSequence, mNextSequence + mBatchSize);
+
+    QVector<QPair<quint64, EventItemPtr>> events;
+    events.reserve(lastSequence - mNextSequence);
+
+    for (; mNextSequence < lastSequence; ++mNextSequence)
+    {
+        const Slot& slot = mSlots[mNextSequence & (capacity - 1)];
+
+        // The record is copied out and checked to be the same afterwards, the collector may be overwriting it meanwhile
+        if (slot.sequence.load(std::memory_order_acquire) != mNextSequence)
+        {
+            ++lostCount;
+            continue;
+        }
+
+        Record record = slot.record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot.sequence.load(std::memory_order_relaxed) != mNextSequence)
+        {
+            ++lostCount;
+            continue;
+        }
+
+        EventItem::EventStatus status = EventItem::EventStatus(std::min<quint32>(record.status, EventItem::EVENT_STATUS_INVALID));
+        QString payload = QString::fromUtf8(record.payload, std::min<int>(record.payloadSize, mMaxPayloadSize));
+
+        events.append(qMakePair(record.taskId, mTaskStorage->createEvent(record.startTime, record.endTime, status, record.eventId, payload)));
+    }
+
+    // Records rejected by the storage, e.g. with a taken id or an unknown task, aren't received
+    if (!events.isEmpty()){
+        mReceivedCount += mTaskStorage->addEvents(events);
+    }
+
+    if (lostCount)
+    {
+        mLostCount += lostCount;
+        emit recordsLost(lostCount);
+    }
+
+    return events.size();
+}
+
+bool TimeLineSharedFeed::isAttached() const
+{
+    return mHeader != nullptr;
+}
+
+quint64 TimeLineSharedFeed::getNextSequence() const
+{
+    return mNextSequence;
+}
+
+quint64 TimeLineSharedFeed::getReceivedCount() const
+{
+    return mReceivedCount;
+}
+
+quint64 TimeLineSharedFeed::getLostCount() const
+{
+    return mLostCount;
+}
+
+int TimeLineSharedFeed::sharedMemorySize(const quint32& capacity)
+{
+    return sizeof(Header) + capacity * sizeof(Slot);
+}
+
+void TimeLineSharedFeed::onPollTimer()
+{
+    // A backlog is taken batch by batch, the event loop runs in between
+    if (poll() == mBatchSize){
+        mPollTimer->start(0);
+    }
+    else if (mPollTimer->interval() != mPollInterval){
+        mPollTimer->start(mPollInterval);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////          TimeLineSharedFeedWriter       //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TimeLineSharedFeedWriter::TimeLineSharedFeedWriter() :
+                                                   mHeader(nullptr),
+                                                   mSlots(nullptr),
+                                                   mNextSequence(0)
+{
+
+}
+
+bool TimeLineSharedFeedWriter::create(const QString& key, const quint32& capacity)
+{
+    Q_ASSERT(mHeader == nullptr);
+    Q_ASSERT(capacity > 0 && capacity <= (1u << 24));
+    if (mHeader != nullptr || capacity == 0 || capacity > (1u << 24)){
+        return false;
+    }
+
+    quint32 slotCount = 1;
+    while (slotCount < capacity){
+        slotCount <<= 1;
+    }
+
+    mSharedMemory.setKey(key);
+    if (!mSharedMemory.create(TimeLineSharedFeed::sharedMemorySize(slotCount))){
+        return false;
+    }
+
+    mHeader = new (mSharedMemory.data()) TimeLineSharedFeed::Header;
+    mHeader->magic = TimeLineSharedFeed::mMagic;
+    mHeader->version = TimeLineSharedFeed::mVersion;
+    mHeader->slotSize = sizeof(TimeLineSharedFeed::Slot);
+    mHeader->capacity = slotCount;
+
+    mSlots = reinterpret_cast<TimeLineSharedFeed::Slot*>(mHeader + 1);
+    for (quint32 slot = 0; slot < slotCount; ++slot)
+    {
+        new (&mSlots[slot]) TimeLineSharedFeed::Slot;
+        mSlots[slot].sequence.store(TimeLineSharedFeed::mSlotWriting, std::memory_order_relaxed);
+    }
+
+    // Publishes the header and the empty slots
+    mHeader->writeSequence.store(0, std::memory_order_release);
+    return true;
+}
+
+quint64 TimeLineSharedFeedWriter::write(const quint64& taskId, const qint64& startTime, const qint64& endTime,
+                                       const EventItem::EventStatus& status, const quint64& eventId, const QByteArray& payload)
+{
+    Q_ASSERT(mHeader != nullptr);
+    if (mHeader == nullptr){
+        return TimeLineSharedFeed::mSlotWriting;
+    }
+
+    quint64 sequence = mNextSequence++;
+    TimeLineSharedFeed::Slot& slot = mSlots[sequence & (mHeader->capacity - 1)];
+
+    // Readers seeing the slot marked skip it, readers in the middle of a copy notice the mark afterwards
+    slot.sequence.store(TimeLineSharedFeed::mSlotWriting, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    TimeLineSharedFeed::Record& record = slot.record;
+    record.taskId = taskId;
+    record.eventId = eventId;
+    record.startTime = startTime;
+    record.endTime = endTime;
+    record.status = status;
+    record.payloadSize = std::min<int>(payload.size(), TimeLineSharedFeed::mMaxPayloadSize);
+    std::copy(payload.constData(), payload.constData() + record.payloadSize, record.payload);
+
+    slot.sequence.store(sequence, std::memory_order_release);
+    mHeader->writeSequence.store(sequence + 1, std::memory_order_release);
+
+    return sequence;
+}
+
+bool TimeLineSharedFeedWriter::isCreated() const
+{
+    return mHeader != nullptr;
+}
+
+quint64 TimeLineSharedFeedWriter::getNextSequence() const
+{
+    return mNextSequence;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineSpanKernel          //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TIMELINE_SIMD_X86
+#define TIMELINE_SIMD_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define TIMELINE_SIMD_X86
+#define TIMELINE_SIMD_TARGET(isa)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// Processes spans [firstSpan, count) and appends the visible ones after the visibleCount already written
+static int transformSpansScalar(const qint64* startTimes, const qint64* endTimes, const int& firstSpan, const int& count,
+                                const qint64& visibleStartTime, const qint64& visibleEndTime, const double& pixelsPerUSec,
+                                qint32* startPositions, qint32* widths, qint32* indices, int visibleCount)
+{
+    for (int span = firstSpan; span < count; ++span)
+    {
+        qint64 startTime = std::min(std::max(startTimes[span], visibleStartTime), visibleEndTime);
+        qint64 endTime = std::min(std::max(endTimes[span], visibleStartTime), visibleEndTime);
+
+        if (endTime > startTime)
+        {
+            qint32 startPos = std::nearbyint((startTime - visibleStartTime) * pixelsPerUSec);
+            qint32 endPos = std::nearbyint((endTime - visibleStartTime) * pixelsPerUSec);
+
+            startPositions[visibleCount] = startPos;
+            widths[visibleCount] = endPos - startPos;
+            indices[visibleCount] = span;
+            ++visibleCount;
+        }
+    }
+
+    return visibleCount;
+}
+
+#ifdef TIMELINE_SIMD_X86
+
+// Both kernels rely on the clipped offsets being in [0, 2^52), which lets them be converted
+// to double by putting the integer into the mantissa of 2^52 and subtracting 2^52
+
+TIMELINE_SIMD_TARGET("sse4.2")
+static int transformSpansSse4(const qint64* startTimes, const qint64* endTimes, const int& count,
+                              const qint64& visibleStartTime, const qint64& visibleEndTime, const double& pixelsPerUSec,
+                              qint32* startPositions, qint32* widths, qint32* indices)
+{
+    const __m128i visibleStart = _mm_set1_epi64x(visibleStartTime);
+    const __m128i visibleEnd = _mm_set1_epi64x(visibleEndTime);
+    const __m128i magicBits = _mm_set1_epi64x(0x4330000000000000LL);
+    const __m128d magic = _mm_set1_pd(4503599627370496.0); // 2^52
+    const __m128d scale = _mm_set1_pd(pixelsPerUSec);
+
+    int visibleCount = 0;
+    int span = 0;
+
+    for (; span + 2 <= count; span += 2)
+    {
+        __m128i startTime = _mm_loadu_si128((const __m128i*)(startTimes + span));
+        __m128i endTime = _mm_loadu_si128((const __m128i*)(endTimes + span));
+
+        startTime = _mm_blendv_epi8(startTime, visibleStart, _mm_cmpgt_epi64(visibleStart, startTime));
+        startTime = _mm_blendv_epi8(startTime, visibleEnd, _mm_cmpgt_epi64(startTime, visibleEnd));
+        endTime = _mm_blendv_epi8(endTime, visibleStart, _mm_cmpgt_epi64(visibleStart, endTime));
+        endTime = _mm_blendv_epi8(endTime, visibleEnd, _mm_cmpgt_epi64(endTime, visibleEnd));
+
+        int visibleMask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(endTime, startTime)));
+        if (!visibleMask){
+            continue;
+        }
+
+        __m128d startOffset = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_sub_epi64(startTime, visibleStart), magicBits)), magic);
+        __m128d endOffset = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_sub_epi64(endTime, visibleStart), magicBits)), magic);
+
+        __m128i startPos = _mm_cvtpd_epi32(_mm_round_pd(_mm_mul_pd(startOffset, scale), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+        __m128i endPos = _mm_cvtpd_epi32(_mm_round_pd(_mm_mul_pd(endOffset, scale), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+
+        qint32 lanePos[4];
+        qint32 laneWidth[4];
+        _mm_storeu_si128((__m128i*)lanePos, startPos);
+        _mm_storeu_si128((__m128i*)laneWidth, _mm_sub_epi32(endPos, startPos));
+
+        // Branchless compaction: every lane is written, but only the visible ones are kept
+        for (int lane = 0; lane < 2; ++lane)
+        {
+            startPositions[visibleCount] = lanePos[lane];
+            widths[visibleCount] = laneWidth[lane];
+            indices[visibleCount] = span + lane;
+            visibleCount += (visibleMask >> lane) & 1;
+        }
+    }
+
+    return transformSpansScalar(startTimes, endTimes, span, count, visibleStartTime, visibleEndTime,
+                                pixelsPerUSec, startPositions, widths, indices, visibleCount);
+}
+
+TIMELINE_SIMD_TARGET("avx2")
+static int transformSpansAvx2(const qint64* startTimes, const qint64* endTimes, const int& count,
+                              const qint64& visibleStartTime, const qint64& visibleEndTime, const double& pixelsPerUSec,
+                              qint32* startPositions, qint32* widths, qint32* indices)
+{
+    const __m256i visibleStart = _mm256_set1_epi64x(visibleStartTime);
+    const __m256i visibleEnd = _mm256_set1_epi64x(visibleEndTime);
+    const __m256i magicBits = _mm256_set1_epi64x(0x4330000000000000LL);
+    const __m256d magic = _mm256_set1_pd(4503599627370496.0); // 2^52
+    const __m256d scale = _mm256_set1_pd(pixelsPerUSec);
+
+    int visibleCount = 0;
+    int span = 0;
+
+    for (; span + 4 <= count; span += 4)
+    {
+        __m256i startTime = _mm256_loadu_si256((const __m256i*)(startTimes + span));
+        __m256i endTime = _mm256_loadu_si256((const __m256i*)(endTimes + span));
+
+        startTime = _mm256_blendv_epi8(startTime, visibleStart, _mm256_cmpgt_epi64(visibleStart, startTime));
+        startTime = _mm256_blendv_epi8(startTime, visibleEnd, _mm256_cmpgt_epi64(startTime, visibleEnd));
+        endTime = _mm256_blendv_epi8(endTime, visibleStart, _mm256_cmpgt_epi64(visibleStart, endTime));
+        endTime = _mm256_blendv_epi8(endTime, visibleEnd, _mm256_cmpgt_epi64(endTime, visibleEnd));
+
+        int visibleMask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(endTime, startTime)));
+        if (!visibleMask){
+            continue;
+        }
+
+        __m256d startOffset = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_sub_epi64(startTime, visibleStart), magicBits)), magic);
+        __m256d endOffset = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_sub_epi64(endTime, visibleStart), magicBits)), magic);
+
+        __m128i startPos = _mm256_cvtpd_epi32(_mm256_round_pd(_mm256_mul_pd(startOffset, scale), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+        __m128i endPos = _mm256_cvtpd_epi32(_mm256_round_pd(_mm256_mul_pd(endOffset, scale), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+
+        qint32 lanePos[4];
+        qint32 laneWidth[4];
+        _mm_storeu_si128((__m128i*)lanePos, startPos);
+        _mm_storeu_si128((__m128i*)laneWidth, _mm_sub_epi32(endPos, startPos));
+
+        // Branchless compaction: every lane is written, but only the visible ones are kept
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            startPositions[visibleCount] = lanePos[lane];
+            widths[visibleCount] = laneWidth[lane];
+            indices[visibleCount] = span + lane;
+            visibleCount += (visibleMask >> lane) & 1;
+        }
+    }
+
+    return transformSpansScalar(startTimes, endTimes, span, count, visibleStartTime, visibleEndTime,
+                                pixelsPerUSec, startPositions, widths, indices, visibleCount);
+}
+
+#endif
+
+static TimeLineSpanKernel::InstructionSet detectInstructionSet()
+{
+#if defined(TIMELINE_SIMD_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")){
+        return TimeLineSpanKernel::INSTRUCTION_SET_AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse4.2")){
+        return TimeLineSpanKernel::INSTRUCTION_SET_SSE4;
+    }
+#elif defined(TIMELINE_SIMD_X86)
+    int info[4];
+    __cpuid(info, 1);
+
+    bool sse4 = info[2] & (1 << 20);
+    bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+
+    __cpuidex(info, 7, 0);
+
+    if (osSavesAvx && (info[1] & (1 << 5))){
+        return TimeLineSpanKernel::INSTRUCTION_SET_AVX2;
+    }
+
+    if (sse4){
+        return TimeLineSpanKernel::INSTRUCTION_SET_SSE4;
+    }
+#endif
+
+    return TimeLineSpanKernel::INSTRUCTION_SET_SCALAR;
 }
 
-void TimeLineGrid::setSettings(const TimeLineGridSettings& settings)
+TimeLineSpanKernel::InstructionSet TimeLineSpanKernel::instructionSet()
 {
-    mSettings = settings;
+    static const InstructionSet instructionSet = detectInstructionSet();
+    return instructionSet;
 }
 
-void TimeLineGrid::setMousePos(const QPoint &pos, bool isDragging)
+int TimeLineSpanKernel::transform(const qint64* startTimes, const qint64* endTimes, const int& count,
+                                  const qint64& visibleStartTime, const qint64& visibleEndTime, const double& pixelsPerUSec,
+                                  qint32* startPositions, qint32* widths, qint32* indices)
 {
-    if (isDragging)
+    Q_ASSERT(visibleStartTime <= visibleEndTime);
+
+    // Offsets from the visible start past 2^52 usec (~142 years) can't go through the SIMD conversion
+    const quint64 maxSimdSpan = quint64(1) << 52;
+    InstructionSet instructions = quint64(visibleEndTime) - quint64(visibleStartTime) < maxSimdSpan? instructionSet() : INSTRUCTION_SET_SCALAR;
+
+    switch (instructions)
     {
-        int mouseDelta = mMousePos.x() - pos.x();
-        if (mouseDelta != 0)
-        {
-            int sign = mouseDelta / std::abs(mouseDelta);
-            quint64 deltaMSec = 2 * mTimeDelta*std::abs(mouseDelta / mSize.width());
-            mTimeCenterMark = mTimeCenterMark.addMSecs(sign*deltaMSec);
-        }
+#ifdef TIMELINE_SIMD_X86
+    case INSTRUCTION_SET_AVX2:
+        return transformSpansAvx2(startTimes, endTimes, count, visibleStartTime, visibleEndTime,
+                                  pixelsPerUSec, startPositions, widths, indices);
+    case INSTRUCTION_SET_SSE4:
+        return transformSpansSse4(startTimes, endTimes, count, visibleStartTime, visibleEndTime,
+                                  pixelsPerUSec, startPositions, widths, indices);
+#endif
+    default:
+        return transformSpansScalar(startTimes, endTimes, 0, count, visibleStartTime, visibleEndTime,
+                                    pixelsPerUSec, startPositions, widths, indices, 0);
     }
-
-    mMousePos = pos;
-    update();
 }
 
-void TimeLineGrid::setSize(const QSizeF &size, const QPointF& pos)
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineRasterizer          //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// x * a / 255 rounded, exact for all 8 bit values. The SIMD fills use the same formula
+static inline quint32 multiplyColorChannel(const quint32& x, const quint32& a)
 {
-    mSize = size;
-    setPos(pos);
+    quint32 t = x * a + 128;
+    return (t + (t >> 8)) >> 8;
 }
 
-QDateTime TimeLineGrid::getTimeMark() const
+static inline quint32 multiplyPixel(const quint32& pixel, const quint32& a)
 {
-    return mTimeCenterMark;
+    quint32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8){
+        result |= multiplyColorChannel((pixel >> shift) & 0xff, a) << shift;
+    }
+
+    return result;
 }
 
-quint64 TimeLineGrid::getTimeDelta() const
+static void fillSpanScalar(quint32* pixels, const int& count, const QRgb& color)
 {
-    return mTimeDelta;
+    quint32 inverseAlpha = 255 - qAlpha(color);
+
+    for (int pixel = 0; pixel < count; ++pixel){
+        pixels[pixel] = color + multiplyPixel(pixels[pixel], inverseAlpha);
+    }
 }
 
-QPoint TimeLineGrid::getMousePos() const
+#ifdef TIMELINE_SIMD_X86
+
+TIMELINE_SIMD_TARGET("sse2")
+static void fillSpanSse2(quint32* pixels, const int& count, const QRgb& color)
 {
-    return mMousePos;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rounding = _mm_set1_epi16(128);
+    const __m128i inverseAlpha = _mm_set1_epi16(255 - qAlpha(color));
+    const __m128i source = _mm_set1_epi32(color);
+
+    int pixel = 0;
+    for (; pixel + 4 <= count; pixel += 4)
+    {
+        __m128i destination = _mm_loadu_si128((const __m128i*)(pixels + pixel));
+
+        __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(destination, zero), inverseAlpha), rounding);
+        __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(destination, zero), inverseAlpha), rounding);
+        low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+        high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+
+        // Premultiplied source over can't overflow a channel
+        _mm_storeu_si128((__m128i*)(pixels + pixel), _mm_add_epi8(_mm_packus_epi16(low, high), source));
+    }
+
+    fillSpanScalar(pixels + pixel, count - pixel, color);
 }
 
-TimeLineGrid::TimeLineGridSettings TimeLineGrid::getSettings() const
+TIMELINE_SIMD_TARGET("avx2")
+static void fillSpanAvx2(quint32* pixels, const int& count, const QRgb& color)
 {
-    return mSettings;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rounding = _mm256_set1_epi16(128);
+    const __m256i inverseAlpha = _mm256_set1_epi16(255 - qAlpha(color));
+    const __m256i source = _mm256_set1_epi32(color);
+
+    int pixel = 0;
+    for (; pixel + 8 <= count; pixel += 8)
+    {
+        __m256i destination = _mm256_loadu_si256((const __m256i*)(pixels + pixel));
+
+        // Unpacking and packing both work within 128 bit lanes, so the pixel order is kept
+        __m256i low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(destination, zero), inverseAlpha), rounding);
+        __m256i high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(destination, zero), inverseAlpha), rounding);
+        low = _mm256_srli_epi16(_mm256_add_epi16(low, _mm256_srli_epi16(low, 8)), 8);
+        high = _mm256_srli_epi16(_mm256_add_epi16(high, _mm256_srli_epi16(high, 8)), 8);
+
+        _mm256_storeu_si256((__m256i*)(pixels + pixel), _mm256_add_epi8(_mm256_packus_epi16(low, high), source));
+    }
+
+    fillSpanSse2(pixels + pixel, count - pixel, color);
 }
 
-TimeLineGrid::TimeLineGridStyle TimeLineGrid::getStyle() const
+#endif
+
+bool TimeLineRasterizer::canRasterize(const QImage& image)
 {
-    return mStyle;
+    return !image.isNull() && image.format() == QImage::Format_ARGB32_Premultiplied;
 }
 
-QRectF TimeLineGrid::boundingRect() const
+void TimeLineRasterizer::fillSpan(quint32* pixels, const int& count, const QRgb& color)
 {
-    return QRectF(0, 0, mSize.width(), mSize.height());
+    if (count <= 0 || !qAlpha(color)){
+        return;
+    }
+
+    if (qAlpha(color) == 255)
+    {
+        std::fill(pixels, pixels + count, color);
+        return;
+    }
+
+    switch (TimeLineSpanKernel::instructionSet())
+    {
+#ifdef TIMELINE_SIMD_X86
+    case TimeLineSpanKernel::INSTRUCTION_SET_AVX2:
+        fillSpanAvx2(pixels, count, color);
+        break;
+    case TimeLineSpanKernel::INSTRUCTION_SET_SSE4:
+        fillSpanSse2(pixels, count, color);
+        break;
+#endif
+    default:
+        fillSpanScalar(pixels, count, color);
+    }
 }
 
-QRect TimeLineGrid::graphicsRect() const
+void TimeLineRasterizer::blendSpan(quint32* pixels, const int& count, const QRgb& color, const quint8& coverage)
 {
-    // Timeline item painting area, with indents taken into account
-    return QRect(mSettings.borderIndentX,
-                 mSettings.borderIndentY,
-                 mSize.width() - 2 * mSettings.borderIndentX,
-                 mSize.height() - 2 * mSettings.borderIndentY);
+    // Partial coverage is the same source over with a fainter color
+    fillSpan(pixels, count, coverage == 255? color : multiplyPixel(color, coverage));
 }
 
-//////////////////////////////////////////////////////////////////////////////
-///////////////	                 TaskStorage            //////////////////////
-//////////////////////////////////////////////////////////////////////////////
-
-bool TaskStorage::addTask(const TaskItemPtr task)
+const TimeLineRasterizer::CoverageMask& TimeLineRasterizer::getCoverageMask(const int& width, const int& height,
+                                                                            const int& radiusX2, const int& radiusY2)
 {
-    QMutexLocker lock(&mMutex);
+    quint64 key = ((quint64)width << 48) | ((quint64)height << 32) | ((quint64)radiusX2 << 16) | (quint64)radiusY2;
 
-    Q_ASSERT(task != nullptr);
-    if (task == nullptr){
-        return false;
+    auto maskIter = mCoverageMasks.find(key);
+    if (maskIter != mCoverageMasks.end()){
+        return *maskIter;
     }
 
-    auto taskIter = mTasks.find(task->getTaskId());
-    if (taskIter == mTasks.end() || *taskIter == nullptr){
-        mTasks.insert(task->getTaskId(), task);
+    if (mCoverageMasks.size() >= mMaxCoverageMasks){
+        mCoverageMasks.clear();
     }
-    else
+
+    // The outline widens the shape by half a pixel on each side, so do it's radii
+    double radiusX = radiusX2 / 2.0 + 0.5;
+    double radiusY = radiusY2 / 2.0 + 0.5;
+    double left = 0.5;
+    double top = 0.5;
+    double right = width - 0.5;
+    double bottom = height - 0.5;
+
+    CoverageMask mask(width, height);
+
+    for (int row = 0; row < height; ++row)
     {
-        auto existingTask = *taskIter;
-        if (existingTask->getEndTime() != task->getEndTime()){
-            existingTask->setEndTime(task->getEndTime());
+        for (int column = 0; column < width; ++column)
+        {
+            int samplesInside = 0;
+
+            for (int sampleY = 0; sampleY < mMaskSamples; ++sampleY)
+            {
+                double y = row + (sampleY + 0.5) / mMaskSamples;
+
+                for (int sampleX = 0; sampleX < mMaskSamples; ++sampleX)
+                {
+                    double x = column + (sampleX + 0.5) / mMaskSamples;
+                    if (x < left || x > right || y < top || y > bottom){
+                        continue;
+                    }
+
+                    // Distance to the nearest corner ellipse center, 0 outside the corner areas
+                    double dx = x < left + radiusX? x - (left + radiusX) : (x > right - radiusX? x - (right - radiusX) : 0);
+                    double dy = y < top + radiusY? y - (top + radiusY) : (y > bottom - radiusY? y - (bottom - radiusY) : 0);
+
+                    if ((dx * dx) / (radiusX * radiusX) + (dy * dy) / (radiusY * radiusY) <= 1){
+                        ++samplesInside;
+                    }
+                }
+            }
+
+            int sampleCount = mMaskSamples * mMaskSamples;
+            mask.coverage[row * width + column] = (samplesInside * 255 + sampleCount / 2) / sampleCount;
         }
     }
 
-    return true;
+    return *mCoverageMasks.insert(key, mask);
 }
 
-void TaskStorage::removeTask(const quint64& taskId)
+void TimeLineRasterizer::fillRect(QImage& image, const QRect& rect, const QRgb& color)
 {
-    QMutexLocker lock(&mMutex);
+    Q_ASSERT(canRasterize(image));
+    if (!canRasterize(image)){
+        return;
+    }
 
-    auto taskIter = mTasks.find(taskId);
-    if (taskIter != mTasks.end() && (*taskIter) != nullptr)
-    {
-        TaskItemPtr taskPtr = *taskIter;
-        bool noNeedToDelete = taskPtr->eventCount();
+    QRect clippedRect = rect.intersected(image.rect());
 
-        if (!noNeedToDelete){
-            mTasks.remove(taskId);
-        }
+    for (int row = clippedRect.top(); row <= clippedRect.bottom(); ++row){
+        fillSpan((quint32*)image.scanLine(row) + clippedRect.left(), clippedRect.width(), color);
     }
 }
 
-bool TaskStorage::addEvent(const quint32 taskId, const EventItemPtr event)
+void TimeLineRasterizer::fillRoundedRect(QImage& image, const QRect& rect, const qreal& radius, const QRgb& color)
 {
-    QMutexLocker lock(&mMutex);
-    bool result = true;
+    Q_ASSERT(canRasterize(image));
+    if (!canRasterize(image) || !qAlpha(color)){
+        return;
+    }
 
-    auto parentTask = mTasks.find(taskId);
+    // QPainterPath::addRoundedRect clamps the radii to the half of the rect
+    int rectWidth = std::max(rect.width(), 0);
+    int rectHeight = std::max(rect.height(), 0);
+    int radiusX2 = std::min(radius, rectWidth / 2.0) * 2;
+    int radiusY2 = std::min(radius, rectHeight / 2.0) * 2;
 
-    if (parentTask != mTasks.end() &&
-       (*parentTask)->addEvent(event))
-    {
-        event->setParentTask(*parentTask);
-    }
-    else{
-        result = false;
-    }
+    // The shape with the outline: half a pixel wider on each side
+    int width = rectWidth + 2;
+    int height = rectHeight + 2;
+    int originX = rect.x() - 1;
+    int originY = rect.y() - 1;
 
-    return result;
-}
+    // Columns and rows touched by the corners. A shape narrower or lower than two corners is all in the mask
+    int cornerWidth = std::ceil(radiusX2 / 2.0 + 1);
+    int cornerHeight = std::ceil(radiusY2 / 2.0 + 1);
+    int maskWidth = std::min(width, cornerWidth * 2);
+    int maskHeight = std::min(height, cornerHeight * 2);
 
-void TaskStorage::clear()
-{
-    QMutexLocker lock(&mMutex);
-    mTasks.clear();
-}
+    const CoverageMask& mask = getCoverageMask(maskWidth, maskHeight, radiusX2, radiusY2);
 
-TaskItemPtr TaskStorage::getTask(const quint64& taskId)
-{
-    QMutexLocker lock(&mMutex);
+    int leftCornerEnd = std::min(cornerWidth, width);
+    int rightCornerStart = std::max(cornerWidth, width - cornerWidth);
 
-    TaskItemPtr taskPtr;
+    int firstRow = std::max(0, -originY);
+    int lastRow = std::min(height, image.height() - originY);
+    int firstColumn = std::max(0, -originX);
+    int lastColumn = std::min(width, image.width() - originX);
 
-    auto taskIter = mTasks.find(taskId);
-    if (taskIter != mTasks.end()){
-        taskPtr = *taskIter;
+    if (firstRow >= lastRow || firstColumn >= lastColumn){
+        return;
     }
 
-    return taskPtr;
-}
+    for (int row = firstRow; row < lastRow; ++row)
+    {
+        quint32* pixels = (quint32*)image.scanLine(originY + row) + originX;      // Only the columns inside the image are touched
 
-EventItemPtr TaskStorage::getEvent(const quint64& taskId, const QDateTime& startTime)
-{
-    QMutexLocker lock(&mMutex);
+        if (row < cornerHeight || row >= height - cornerHeight)
+        {
+            int maskRow = row < cornerHeight? row : row - (height - maskHeight);
+            const quint8* coverage = mask.coverage.constData() + maskRow * maskWidth;
 
-    EventItemPtr eventPtr;
+            for (int column = firstColumn; column < std::min(lastColumn, leftCornerEnd); ++column){
+                blendSpan(pixels + column, 1, color, coverage[column]);
+            }
 
-    auto taskIter = mTasks.find(taskId);
-    if (taskIter != mTasks.end())
-    {
-        TaskItemPtr taskPtr = *taskIter;
-        const QMap<QDateTime, EventItemPtr> events = taskPtr->getEvents();
-        auto eventIter = events.find(startTime);
+            // Between the corners only the outer rows are covered partially
+            int spanStart = std::max(firstColumn, leftCornerEnd);
+            int spanEnd = std::min(lastColumn, rightCornerStart);
 
-        if (eventIter != events.end()){
-            eventPtr = *eventIter;
-        }
-    }
+            if (spanStart < spanEnd){
+                blendSpan(pixels + spanStart, spanEnd - spanStart, color, row == 0 || row == height - 1? 128 : 255);
+            }
 
-    return eventPtr;
-}
+            for (int column = std::max(firstColumn, rightCornerStart); column < lastColumn; ++column){
+                blendSpan(pixels + column, 1, color, coverage[column - (width - maskWidth)]);
+            }
+        }
+        else
+        {
+            // Straight sides are half covered by the outline
+            if (firstColumn == 0){
+                blendSpan(pixels, 1, color, 128);
+            }
 
-const QHash<quint64, TaskItemPtr> TaskStorage::getTasks()
-{
-    return mTasks;
-}
+            int spanStart = std::max(firstColumn, 1);
+            int spanEnd = std::min(lastColumn, width - 1);
 
-void TaskStorage::lock()
-{
-    mMutex.lock();
-}
+            if (spanStart < spanEnd){
+                fillSpan(pixels + spanStart, spanEnd - spanStart, color);
+            }
 
-void TaskStorage::unlock()
-{
-    mMutex.unlock();
+            if (lastColumn == width){
+                blendSpan(pixels + width - 1, 1, color, 128);
+            }
+        }
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -656,22 +4241,46 @@ void TaskStorage::unlock()
 //////////////////////////////////////////////////////////////////////////////
 
 TimeLineItems::TimeLineItems(TaskStoragePtr tasks, QGraphicsItem *parent) :
-                             mTaskStorage(tasks), QGraphicsItem(parent)
+                             mTaskStorage(tasks), QGraphicsItem(parent),
+                             mCentralTime(TimeLineTime::mInvalidTime),
+                             mTimeDelta(0),
+                             mVerticalOffset(0),
+                             mRowCount(0),
+                             mFirstVisibleRow(0),
+                             mLayoutDirty(true),
+                             mLayoutConfigRevision(0),
+                             mPrefetchPending(false),
+                             mViewMoving(false),
+                             mLayoutCoarse(false),
+                             mRefinementPending(false),
+                             mQualityLevel(TimeLineQualityGovernor::QUALITY_FULL)
 {
-
+    // Repainted only on changes, exposures by the grid overlay are served from the cache
+    setCacheMode(QGraphicsItem::DeviceCoordinateCache);
 }
 
 void TimeLineItems::setSize(const QSizeF &size, const QPointF &pos)
 {
     mSize = size;
     setPos(pos);
+    mLayoutDirty = true;
     update();
 }
 
-void TimeLineItems::setTime(const QDateTime& centralTime, const quint64& timeDelta)
+void TimeLineItems::setTime(const qint64& centralTime, const qint64& timeDelta)
 {
+    if (centralTime != mCentralTime || timeDelta != mTimeDelta)
+    {
+        // A change soon after another one means the view is in motion, e.g. zooming. Such frames
+        // are laid out coarsely, the full layout is made by refineLayout() once the view is still
+        mViewMoving = mViewChangeTimer.isValid() && mViewChangeTimer.elapsed() < mSettings.refinementDelay;
+        mViewChangeTimer.start();
+        cancelRefinement();
+    }
+
     mCentralTime = centralTime;
     mTimeDelta = timeDelta;
+    mLayoutDirty = true;
     update();
 }
 
@@ -681,15 +4290,81 @@ void TimeLineItems::setSelectedItem(const TimeLineItemPtr item)
     update();
 }
 
+void TimeLineItems::invalidateLayout()
+{
+    mLayoutDirty = true;
+    update();
+}
+
+void TimeLineItems::setSelectedEvent(const quint64& eventId)
+{
+    Q_ASSERT(mTaskStorage != nullptr);
+    if (mTaskStorage == nullptr){
+        return;
+    }
+
+    setSelectedItem(mTaskStorage->getEvent(eventId));
+}
+
 void TimeLineItems::addItemType(const TimeLineTaskType type, const TaskStyle& style)
 {
+    Q_ASSERT(type < TL_TASK_TYPE_INVALID);
+    if (type >= TL_TASK_TYPE_INVALID){
+        return;
+    }
+
     TaskStylePtr stylePtr = std::make_shared<TaskStyle>(style.brush, style.infoPen, style.infoIconPath);
-    mItemStyles.insert(type, stylePtr);
+
+    // Re-registering a type only replaces it's style, the axis stays in place
+    int slot = getItemTypeSlot(type);
+    if (slot != -1){
+        mItemStyles[slot] = stylePtr;
+        return;
+    }
+
+    if (mItemTypeSlots.isEmpty()){
+        mItemTypeSlots.fill(-1, TL_TASK_TYPE_INVALID);
+    }
+
+    mItemTypeSlots[type] = mItemStyles.size();
+    mItemStyles.append(stylePtr);
+    mItemTypes.append(type);
+    mLayoutDirty = true;
+    ++mLayoutConfigRevision;
+}
+
+bool TimeLineItems::hasItemType(const TimeLineTaskType& type) const
+{
+    return getItemTypeSlot(type) != -1;
+}
+
+int TimeLineItems::getItemTypeSlot(const TimeLineTaskType& type) const
+{
+    return getItemTypeSlot(mItemTypeSlots, type);
+}
+
+int TimeLineItems::getItemTypeSlot(const QVector<int>& itemTypeSlots, const TimeLineTaskType& type)
+{
+    return type < itemTypeSlots.size() ? itemTypeSlots[type] : -1;
 }
 
 void TimeLineItems::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
 {
-    calculateVisibleItems();
+    QElapsedTimer paintTimer;
+    paintTimer.start();
+
+    // Paints caused by the mouse, selection etc reuse the last layout
+    if (mLayoutDirty){
+        calculateVisibleItems();
+    }
+
+    if (mMetrics != nullptr)
+    {
+        mMetrics->currentFrame().itemsCached = false;
+        mMetrics->currentFrame().layoutTime += TimeLineMetrics::elapsedMSecs(paintTimer);
+        mMetrics->currentFrame().visibleItems = mVisibleItems.size();
+        paintTimer.restart();
+    }
 
     painter->fillRect(boundingRect(), QBrush(mStyle.backgroundColor));
 
@@ -699,39 +4374,166 @@ void TimeLineItems::paint(QPainter *painter, const QStyleOptionGraphicsItem *opt
     //Draw separator
     painter->drawLine(1, resultAreaHeight, mSize.width(), resultAreaHeight);
 
-    // Draw axis
-    drawAxis(resultAreaHeight, painter);
+    // Draw axis
+    drawAxis(resultAreaHeight, painter);
+
+    // Paint visible items. Swimlane rows partially scrolled out must not cover the icons area
+    if (isSwimlaneMode())
+    {
+        painter->save();
+        painter->setClipRect(QRectF(0, resultAreaHeight, mSize.width(), mSize.height() - resultAreaHeight));
+        paintVisibleItems(painter);
+        drawRowHeaders(resultAreaHeight, painter);
+        painter->restore();
+    }
+    else{
+        paintVisibleItems(painter);
+    }
+
+    if (mMetrics != nullptr)
+    {
+        mMetrics->currentFrame().itemsPaintTime += TimeLineMetrics::elapsedMSecs(paintTimer);
+        paintTimer.restart();
+    }
+
+    // paint icons
+    if (!mInfoMarks.isEmpty()){
+        paintIcons(resultAreaHeight, painter);
+    }
+
+    if (mMetrics != nullptr){
+        mMetrics->currentFrame().iconsPaintTime += TimeLineMetrics::elapsedMSecs(paintTimer);
+    }
+}
+
+void TimeLineItems::drawAxis(const quint16& resultAreaHeight, QPainter *painter)
+{
+    // paint axis
+    QColor axisColor = mStyle.borderColor;
+    axisColor.setAlphaF(mStyle.axisOpacity);
+    painter->setPen(QPen(axisColor));
+
+    // Swimlane rows are separated by the lines between them, only the visible ones are drawn
+    if (isSwimlaneMode())
+    {
+        const quint32& rowHeight = mSettings.swimlaneRowHeight;
+
+        for (int row = mFirstVisibleRow; row <= mFirstVisibleRow + mVisibleRows.size(); ++row)
+        {
+            qreal rowYPos = resultAreaHeight + row * rowHeight - mVerticalOffset;
+            if (rowYPos > resultAreaHeight && rowYPos < mSize.height()){
+                painter->drawLine(QPointF(1, rowYPos), QPointF(mSize.width(), rowYPos));
+            }
+        }
+
+        return;
+    }
+
+    quint32 distBetweenAxis = (boundingRect().height() - resultAreaHeight) / (mItemStyles.size() + 1);
+
+    for (quint8 axisNum = 0; axisNum < mItemStyles.size(); ++axisNum)
+    {
+        quint32 currAxisYPos = boundingRect().height() - distBetweenAxis * (axisNum + 1);
+        painter->drawLine(1, currAxisYPos, mSize.width(), currAxisYPos);
+    }
+}
+
+void TimeLineItems::drawRowHeaders(const quint16& resultAreaHeight, QPainter* painter)
+{
+    const quint32& rowHeight = mSettings.swimlaneRowHeight;
+    int headerWidth = std::min<int>(mSettings.swimlaneHeaderWidth, mSize.width());
+    if (headerWidth <= 0){
+        return;
+    }
+
+    int textHeight = std::min<int>(painter->fontMetrics().height(), rowHeight);
+
+    QColor headerColor = mStyle.backgroundColor;
+    headerColor.setAlpha(230);
+
+    for (int rowNum = 0; rowNum < mVisibleRows.size(); ++rowNum)
+    {
+        const TaskItemPtr& task = mVisibleRows[rowNum];
+        int slot = getItemTypeSlot(task->getTaskType());
+        if (slot == -1){
+            continue;
+        }
+
+        // Headers stay at the left whatever time is scrolled to. The name of a row partially
+        // scrolled out sticks to the viewport top until the row leaves it
+        qreal rowTop = resultAreaHeight + (mFirstVisibleRow + rowNum) * rowHeight - mVerticalOffset;
+        qreal textTop = qBound<qreal>(rowTop, resultAreaHeight, rowTop + rowHeight - textHeight);
 
-    // Paint visible items
-    paintVisibleItems(painter);
+        QRectF headerRect(0, rowTop, headerWidth, rowHeight);
+        painter->fillRect(headerRect, headerColor);
+        painter->fillRect(QRectF(0, rowTop, 3, rowHeight), mItemStyles[slot]->brush);
 
-    // paint icons
-    if (!mInfoMarks.isEmpty()){
-        paintIcons(resultAreaHeight, painter);
+        painter->setPen(QPen(mStyle.borderColor));
+        painter->drawText(QRectF(6, textTop, headerWidth - 8, textHeight), Qt::AlignLeft | Qt::AlignVCenter, task->getTaskName());
     }
 }
 
-void TimeLineItems::drawAxis(const quint16& resultAreaHeight, QPainter *painter)
+bool TimeLineItems::rasterizeVisibleItems(QPainter* painter)
 {
-    // paint axis
-    QColor axisColor = mStyle.borderColor;
-    axisColor.setAlphaF(mStyle.axisOpacity);
-    painter->setPen(QPen(axisColor));
-    quint32 distBetweenAxis = (boundingRect().height() - resultAreaHeight) / (mItemStyles.size() + 1);
+    // Only a translated painter keeps the items on the pixel grid
+    if (painter->transform().type() > QTransform::TxTranslate){
+        return false;
+    }
 
-    for (quint8 axisNum = 0; axisNum < mItemStyles.size(); ++axisNum)
+    for (auto& style : mItemStyles)
     {
-        quint32 currAxisYPos = boundingRect().height() - distBetweenAxis * (axisNum + 1);
-        painter->drawLine(1, currAxisYPos, mSize.width(), currAxisYPos);
+        if (style->brush.style() != Qt::SolidPattern){
+            return false;
+        }
+    }
+
+    QSize layerSize = boundingRect().size().toSize();
+    if (layerSize.isEmpty()){
+        return true;
+    }
+
+    if (mItemsLayer.size() != layerSize){
+        mItemsLayer = QImage(layerSize, QImage::Format_ARGB32_Premultiplied);
+    }
+
+    mItemsLayer.fill(Qt::transparent);
+
+    for (auto& visibleItem : mVisibleItems)
+    {
+        QColor color = visibleItem.item == mSelectedItem? mStyle.selectedItemColor : visibleItem.style->brush.color();
+
+        AbstractItem::ItemType type = visibleItem.item->getItemType();
+        if (type == AbstractItem::ITEM_TYPE_EVENT){
+            color.setAlphaF(color.alphaF() * mStyle.eventPaintOpacity);
+        }
+        else if (type == AbstractItem::ITEM_TYPE_TASK){
+            color.setAlphaF(color.alphaF() * mStyle.taskPaintOpacity);
+        }
+
+        if (mQualityLevel >= TimeLineQualityGovernor::QUALITY_PLAIN_RECTS){
+            TimeLineRasterizer::fillRect(mItemsLayer, visibleItem.rect, qPremultiply(color.rgba()));
+        }
+        else{
+            mRasterizer.fillRoundedRect(mItemsLayer, visibleItem.rect, visibleItem.rect.height() / 4, qPremultiply(color.rgba()));
+        }
     }
+
+    painter->drawImage(0, 0, mItemsLayer);
+    return true;
 }
 
 void TimeLineItems::paintVisibleItems(QPainter *painter)
 {
+    if (mSettings.fastRasterization && rasterizeVisibleItems(painter)){
+        return;
+    }
+
+    bool plainRects = mQualityLevel >= TimeLineQualityGovernor::QUALITY_PLAIN_RECTS;
+
     for (auto& visibleItem : mVisibleItems)
     {
-        painter->setRenderHint(QPainter::Antialiasing);
-        painter->setRenderHint(QPainter::HighQualityAntialiasing);
+        painter->setRenderHint(QPainter::Antialiasing, !plainRects);
+        painter->setRenderHint(QPainter::HighQualityAntialiasing, mQualityLevel < TimeLineQualityGovernor::QUALITY_NO_HQ_ANTIALIASING);
 
         QRect rect = visibleItem.rect;
 
@@ -750,6 +4552,13 @@ void TimeLineItems::paintVisibleItems(QPainter *painter)
         }
 
         // Draw and fill the item
+        if (plainRects)
+        {
+            painter->fillRect(rect, brush);
+            painter->setOpacity(1);
+            continue;
+        }
+
         if (brush.color() != mStyle.selectedItemColor){
             painter->setPen(QPen(brush.color()));
         }
@@ -768,7 +4577,10 @@ void TimeLineItems::paintIcons(const quint16& resultAreaHeight,QPainter *painter
     const quint16& warningSignMinWidth = resultAreaHeight;
     quint16 maxWarningSigns = 8 * mSize.width() / resultAreaHeight;
 
-    quint16 warningLineStart_Y = mInfoMarks.size() <= maxWarningSigns ? resultAreaHeight / 2 : 0;
+    // Under load the icons are left out, as if there were too many of them
+    bool drawIcons = mInfoMarks.size() <= maxWarningSigns && mQualityLevel < TimeLineQualityGovernor::QUALITY_ICON_TICKS;
+
+    quint16 warningLineStart_Y = drawIcons ? resultAreaHeight / 2 : 0;
 
     QHash<QString, std::shared_ptr<QSvgRenderer>> svgRenderers;
     QImage image(warningSignMinWidth, warningSignMinWidth, QImage::Format_ARGB32);
@@ -790,9 +4602,13 @@ void TimeLineItems::paintIcons(const quint16& resultAreaHeight,QPainter *painter
             painter->setRenderHints(QPainter::Antialiasing, false);
             painter->setRenderHints(QPainter::HighQualityAntialiasing, false);
             painter->drawLine(markPos, warningLineStart_Y, markPos, resultAreaHeight - 1);
+
+            if (mMetrics != nullptr){
+                ++mMetrics->currentFrame().iconsDrawn;
+            }
         }
 
-        if (mInfoMarks.size() <= maxWarningSigns)
+        if (drawIcons)
         {
             std::shared_ptr<QSvgRenderer> renderer;
 
@@ -825,7 +4641,7 @@ void TimeLineItems::paintIcons(const quint16& resultAreaHeight,QPainter *painter
             }
 
             painter->setRenderHints(QPainter::Antialiasing, true);
-            painter->setRenderHints(QPainter::HighQualityAntialiasing, true);
+            painter->setRenderHints(QPainter::HighQualityAntialiasing, mQualityLevel < TimeLineQualityGovernor::QUALITY_NO_HQ_ANTIALIASING);
             painter->drawImage(imageRect, image, sourseRect);
         }
     }
@@ -834,88 +4650,522 @@ void TimeLineItems::paintIcons(const quint16& resultAreaHeight,QPainter *painter
 void TimeLineItems::calculateVisibleItems()
 {
     Q_ASSERT(mTaskStorage != nullptr);
-    if (mTaskStorage == nullptr || mItemStyles.isEmpty()){
+    if (mTaskStorage == nullptr || mItemStyles.isEmpty() || mTimeDelta <= 0 || mCentralTime == TimeLineTime::mInvalidTime){
         return;
     }
 
-    QDateTime visibleRangeStartTime = mCentralTime.addMSecs(-1 * (quint64)mTimeDelta);
-    QDateTime visibleRangeEndTime = mCentralTime.addMSecs(mTimeDelta);
-    double pixelsPerMSec = (double)mSize.width() / (2 * mTimeDelta);
+    mLayoutDirty = false;
+
+    LayoutParams params = layoutParams(mCentralTime, mTimeDelta);
+    params.coarse = mSettings.progressiveRendering && mViewMoving && mViewChangeTimer.elapsed() < mSettings.refinementDelay;
+
+    // Under load even the still views are coarse
+    if (mQualityLevel >= TimeLineQualityGovernor::QUALITY_COARSE_LAYOUT){
+        params.coarse = true;
+    }
+
+    // A prefetched layout is a full one
+    LayoutResult result;
+    if (takePrefetchedLayout(params, result)){
+        params.coarse = false;
+    }
+    else{
+        calculateLayout(mTaskStorage, params, result, mMetrics != nullptr? &mMetrics->currentFrame() : nullptr);
+    }
+
+    // A coarse layout gets stale too, if the storage changes meanwhile
+    cancelRefinement();
+    applyLayout(params, result);
+}
+
+void TimeLineItems::applyLayout(const LayoutParams& params, LayoutResult& result)
+{
+    mLayoutCoarse = params.coarse && mQualityLevel < TimeLineQualityGovernor::QUALITY_COARSE_LAYOUT;
+    mVisibleItems.swap(result.visibleItems);
+    mInfoMarks.swap(result.infoMarks);
+    mVisibleRows.swap(result.rows);
+    mFirstVisibleRow = params.firstRow;
+    mRowCount = result.rowCount;
+
+    // Rows may have been removed since the offset was set
+    if (isSwimlaneMode() && mVerticalOffset > getMaxVerticalOffset())
+    {
+        mVerticalOffset = getMaxVerticalOffset();
+        mLayoutDirty = true;
+        update();
+    }
+}
+
+TimeLineItems::LayoutParams TimeLineItems::layoutParams(const qint64& centralTime, const qint64& timeDelta) const
+{
+    LayoutParams params;
+    params.centralTime = centralTime;
+    params.timeDelta = timeDelta;
+    params.size = mSize;
+    params.visibleRangeStartTime = TimeLineTime::add(centralTime, -timeDelta);
+    params.visibleRangeEndTime = TimeLineTime::add(centralTime, timeDelta);
+    params.pixelsPerUSec = (double)mSize.width() / TimeLineTime::toDouble(params.visibleRangeEndTime - params.visibleRangeStartTime);
+
     quint16 resultAreaHeight = mSize.height()*mSettings.infoHeightPortion;
+    params.height = boundingRect().height();
+    params.distBetweenAxis = (params.height - resultAreaHeight) / (mItemStyles.size() + 1);
+    params.taskHeight = params.distBetweenAxis * mSettings.taskHeightPortion;
+    params.eventHeight = params.distBetweenAxis * mSettings.eventsHeightPortion;
+
+    // Swimlanes: a fixed height row per task, only the rows within the viewport are laid out
+    params.rowHeight = mSettings.swimlaneRowHeight;
+    params.lanesTop = resultAreaHeight;
+    params.verticalOffset = mVerticalOffset;
+    params.firstRow = 0;
+    params.lastRow = 0;
+
+    if (params.rowHeight)
+    {
+        params.taskHeight = params.rowHeight * mSettings.taskHeightPortion;
+        params.eventHeight = params.rowHeight * mSettings.eventsHeightPortion;
+        params.firstRow = mVerticalOffset / params.rowHeight;
+        params.lastRow = std::ceil((mVerticalOffset + params.height - resultAreaHeight) / params.rowHeight);
+    }
 
-    mVisibleItems.clear();
-    mInfoMarks.clear();
+    params.itemStyles = mItemStyles;
+    params.itemTypes = mItemTypes;
+    params.itemTypeSlots = mItemTypeSlots;
+    params.eventsVisibleScale = mSettings.eventsVisibleScale;
+    params.parallelLayoutThreshold = mSettings.parallelLayoutThreshold;
+    params.configRevision = mLayoutConfigRevision;
+    params.coarse = false;
+    params.coarseLayoutBudget = mSettings.coarseLayoutBudget;
 
-    mTaskStorage->lock();
+    return params;
+}
 
-    quint32 distBetweenAxis = (boundingRect().height() - resultAreaHeight) / (mItemStyles.size() + 1);
-    quint32 taskHeight = distBetweenAxis * mSettings.taskHeightPortion;
-    quint32 eventHeight = distBetweenAxis * mSettings.eventsHeightPortion;
+void TimeLineItems::calculateLayout(const TaskStoragePtr& taskStorage, const LayoutParams& params,
+                                    LayoutResult& result, TimeLineMetrics::FrameStats* frameStats)
+{
+    QElapsedTimer lockTimer;
+    lockTimer.start();
+
+    taskStorage->lock();
+
+    if (frameStats != nullptr){
+        frameStats->lockWaitTime += TimeLineMetrics::elapsedMSecs(lockTimer);
+    }
+
+    lockTimer.restart();
+
+    result.storageRevision = taskStorage->getRevision();
+
+    // Only registered types are queried, axis by axis
+    QVector<TaskItemPtr> tasks;
+    if (params.rowHeight)
+    {
+        // Swimlane rows follow the type slots. Only the visible rows are taken, so the
+        // layout cost doesn't depend on the total number of tasks
+        for (auto& type : params.itemTypes)
+        {
+            const QVector<TaskItemPtr> typeTasks = taskStorage->getTasks(type);
+            int firstTask = qBound(0, params.firstRow - result.rowCount, typeTasks.size());
+            int lastTask = qBound(0, params.lastRow - result.rowCount, typeTasks.size());
+
+            tasks += typeTasks.mid(firstTask, lastTask - firstTask);
+            result.rowCount += typeTasks.size();
+        }
+
+        result.rows = tasks;
+    }
+    else
+    {
+        for (auto& type : params.itemTypes){
+            tasks += taskStorage->getTasks(type);
+        }
+    }
+
+    // Tasks are independent, so big sets are split into contiguous chunks laid out by the thread pool.
+    // The storage stays locked by this thread until all the workers are done
+    int chunkCount = 1;
+    if (params.parallelLayoutThreshold && tasks.size() >= (int)params.parallelLayoutThreshold)
+    {
+        chunkCount = std::min(QThreadPool::globalInstance()->maxThreadCount() * 4,
+                              tasks.size() / mMinTasksPerLayoutChunk);
+    }
+
+    if (chunkCount > 1)
+    {
+        QVector<LayoutBuffer> buffers;
+        buffers.reserve(chunkCount);
+
+        for (int chunk = 0; chunk < chunkCount; ++chunk){
+            buffers.append(LayoutBuffer(tasks.size() * chunk / chunkCount, tasks.size() * (chunk + 1) / chunkCount));
+        }
+
+        QtConcurrent::blockingMap(buffers, [&](LayoutBuffer& buffer){
+            layoutTasks(tasks, params, buffer);
+        });
+
+        // Merging in the chunk order gives the same result as the sequential layout
+        for (auto& buffer : buffers){
+            result.visibleItems.append(buffer.visibleItems);
+        }
+    }
+    else
+    {
+        LayoutBuffer buffer(0, tasks.size());
+        layoutTasks(tasks, params, buffer);
+
+        result.visibleItems.swap(buffer.visibleItems);
+    }
+
+    // Info marks of all the tasks come from a single query to the storage index
+    qint64 visibleStartTime = params.visibleRangeStartTime;
+
+    for (auto& mark : taskStorage->getInfoMarks(params.visibleRangeStartTime, params.visibleRangeEndTime))
+    {
+        int slot = getItemTypeSlot(params.itemTypeSlots, mark.taskType);
+        if (slot != -1)
+        {
+            int pos = (mark.time - visibleStartTime)*params.pixelsPerUSec;
+            result.infoMarks.insert(pos, params.itemStyles[slot]);
+        }
+    }
+
+    taskStorage->unlock();
+
+    if (frameStats != nullptr){
+        frameStats->lockHoldTime += TimeLineMetrics::elapsedMSecs(lockTimer);
+    }
+}
+
+void TimeLineItems::prefetchLayout(const qint64& centralTime, const qint64& timeDelta)
+{
+    Q_ASSERT(mTaskStorage != nullptr);
+    if (mTaskStorage == nullptr || mItemStyles.isEmpty() || timeDelta <= 0 || centralTime == TimeLineTime::mInvalidTime){
+        return;
+    }
+
+    // A worker of the pool must not wait for other workers, so the prefetch is laid out sequentially
+    LayoutParams params = layoutParams(centralTime, timeDelta);
+    params.parallelLayoutThreshold = 0;
+    params.cancelled = std::make_shared<std::atomic<bool>>(false);
+
+    // The previous prediction is superseded
+    cancelPrefetch();
+
+    mPrefetchedParams = params;
+    mPrefetchedLayout = startLayout(mTaskStorage, params);
+    mPrefetchPending = true;
+}
+
+QFuture<TimeLineItems::LayoutResult> TimeLineItems::startLayout(const TaskStoragePtr& taskStorage, const LayoutParams& params)
+{
+    // The job owns everything it works with, so this item may be destroyed meanwhile
+    return QtConcurrent::run([taskStorage, params](){
+        LayoutResult result;
+        calculateLayout(taskStorage, params, result, nullptr);
+        return result;
+    });
+}
 
-    for (auto task : mTaskStorage->getTasks())
+bool TimeLineItems::refineLayout()
+{
+    if (!mLayoutCoarse){
+        return true;
+    }
+
+    // A worker of the pool must not wait for other workers, so the refinement is laid out sequentially
+    if (!mRefinementPending)
+    {
+        mRefinedParams = layoutParams(mCentralTime, mTimeDelta);
+        mRefinedParams.parallelLayoutThreshold = 0;
+        mRefinedParams.cancelled = std::make_shared<std::atomic<bool>>(false);
+
+        mRefinedLayout = startLayout(mTaskStorage, mRefinedParams);
+        mRefinementPending = true;
+        return false;
+    }
+
+    if (!mRefinedLayout.isFinished()){
+        return false;
+    }
+
+    LayoutResult result = mRefinedLayout.result();
+    mRefinementPending = false;
+
+    // The view is cancelled on changes, but the rows and the storage may still have changed. The next call starts over
+    if (!isSameView(mRefinedParams, layoutParams(mCentralTime, mTimeDelta)) ||
+        result.storageRevision != mTaskStorage->getRevision()){
+        return false;
+    }
+
+    applyLayout(mRefinedParams, result);
+    update();
+    return true;
+}
+
+void TimeLineItems::cancelRefinement()
+{
+    // The job is left to finish and dropped, it only stops early
+    if (mRefinementPending)
+    {
+        *mRefinedParams.cancelled = true;
+        mRefinementPending = false;
+    }
+}
+
+void TimeLineItems::cancelPrefetch()
+{
+    // The job is left to finish and dropped, it only stops early
+    if (mPrefetchPending)
+    {
+        *mPrefetchedParams.cancelled = true;
+        mPrefetchPending = false;
+    }
+}
+
+bool TimeLineItems::isSameView(const LayoutParams& first, const LayoutParams& second)
+{
+    return first.centralTime == second.centralTime &&
+           first.timeDelta == second.timeDelta &&
+           first.size == second.size &&
+           first.verticalOffset == second.verticalOffset &&
+           first.configRevision == second.configRevision;
+}
+
+bool TimeLineItems::takePrefetchedLayout(const LayoutParams& params, LayoutResult& result)
+{
+    if (!mPrefetchPending || !isSameView(mPrefetchedParams, params)){
+        return false;
+    }
+
+    // The view has settled where it was predicted to. A prefetch still running isn't waited for, the frame is laid out now instead
+    if (!mPrefetchedLayout.isFinished())
+    {
+        cancelPrefetch();
+        return false;
+    }
+
+    result = mPrefetchedLayout.result();
+    mPrefetchPending = false;
+
+    // Nothing must have changed in the storage since
+    return result.storageRevision == mTaskStorage->getRevision();
+}
+
+void TimeLineItems::layoutTasks(const QVector<TaskItemPtr>& tasks, const LayoutParams& params, LayoutBuffer& buffer)
+{
+    const double& pixelsPerUSec = params.pixelsPerUSec;
+    const qint64& visibleStartTime = params.visibleRangeStartTime;
+    const qint64& visibleEndTime = params.visibleRangeEndTime;
+
+    buffer.spanPositions.resize(EventBlock::mCapacity);
+    buffer.spanWidths.resize(EventBlock::mCapacity);
+    buffer.spanIndices.resize(EventBlock::mCapacity);
+    buffer.layoutTimer.start();
+
+    for (int taskNum = buffer.firstTask; taskNum < buffer.lastTask; ++taskNum)
     {
+        // The view has changed, nobody is going to take this layout
+        if (params.cancelled != nullptr && params.cancelled->load(std::memory_order_relaxed)){
+            return;
+        }
+
+        const TaskItemPtr& task = tasks[taskNum];
+
         // The task  has not specified end time and no events
         if (!task->eventCount() &&
-            !task->getEndTime().isValid()){
+            task->getEndTimeUs() == TimeLineTime::mInvalidTime){
             continue;
         }
 
-        // Check if there is and axis for the task
-        auto currItemStylePtr = mItemStyles.find(task->getTaskType());
-        if (currItemStylePtr == mItemStyles.end()){
+        // The type slot is the axis number
+        int currAxisConsecNumber = getItemTypeSlot(params.itemTypeSlots, task->getTaskType());
+        if (currAxisConsecNumber == -1){
             continue;
         }
 
-        quint32 currAxisConsecNumber = std::distance(mItemStyles.begin(), currItemStylePtr);
-        quint32 currAxisYPos = boundingRect().height() - distBetweenAxis * (currAxisConsecNumber + 1);
+        const TaskStylePtr& currItemStylePtr = params.itemStyles[currAxisConsecNumber];
+        qint32 currAxisYPos = params.height - params.distBetweenAxis * (currAxisConsecNumber + 1);
+
+        // A swimlane row is the task's own axis
+        if (params.rowHeight){
+            currAxisYPos = params.lanesTop + (params.firstRow + taskNum) * params.rowHeight - params.verticalOffset + params.rowHeight / 2;
+        }
 
-        QPair<QDateTime, QDateTime> intersection = task->getIntersection(visibleRangeStartTime, visibleRangeEndTime);
-        if (!intersection.first.isValid()){
+        QPair<qint64, qint64> intersection = task->getIntersection(visibleStartTime, visibleEndTime);
+        if (intersection.first == intersection.second){
             continue;
         }
 
         // Task itself
-        quint32 startPos = (intersection.first.toMSecsSinceEpoch() - visibleRangeStartTime.toMSecsSinceEpoch())*pixelsPerMSec;
-        quint32 width = (intersection.second.toMSecsSinceEpoch() - intersection.first.toMSecsSinceEpoch())*pixelsPerMSec;
-        QRect itemRect(startPos, currAxisYPos - taskHeight / 2, width, taskHeight);
+        quint32 startPos = (intersection.first - visibleStartTime)*pixelsPerUSec;
+        quint32 width = (intersection.second - intersection.first)*pixelsPerUSec;
+        QRect itemRect(startPos, currAxisYPos - params.taskHeight / 2, width, params.taskHeight);
 
-        mVisibleItems.append(VisibleItem(task, *currItemStylePtr, itemRect));
+        buffer.visibleItems.append(VisibleItem(task, currItemStylePtr, itemRect));
 
-        // If the scale is appropriate
-        if (mTimeDelta <= mSettings.eventsVisibleScale && task->eventCount())
+        // A coarse layout draws a bar per event block, until it's out of time
+        if (params.coarse)
         {
-            const QMap<QDateTime, EventItemPtr>& events = task->getEvents();
+            if (params.timeDelta > params.eventsVisibleScale || !task->eventCount() ||
+                buffer.layoutTimer.elapsed() >= params.coarseLayoutBudget){
+                continue;
+            }
+
+            const QList<ColdEventBlockPtr>& coldBlocks = task->getColdBlocks();
+            auto coldBlock = std::lower_bound(coldBlocks.begin(), coldBlocks.end(), TimeLineTime::add(visibleStartTime, -task->getMaxColdBlockSpan()),
+                                              [](const ColdEventBlockPtr& eventBlock, const qint64& time){ return eventBlock->getFirstStartTime() < time; });
+
+            for (; coldBlock != coldBlocks.end() && (*coldBlock)->getFirstStartTime() < visibleEndTime; ++coldBlock)
+            {
+                if ((*coldBlock)->getMaxEndTime() > visibleStartTime){
+                    layoutBlockSummary(task, (*coldBlock)->getFirstStartTime(), (*coldBlock)->getMaxEndTime(), currItemStylePtr,
+                                       params, currAxisYPos, buffer);
+                }
+            }
+
+            const QList<EventBlockPtr>& blocks = task->getEventBlocks();
+            auto block = std::upper_bound(blocks.begin(), blocks.end(), TimeLineTime::add(visibleStartTime, -task->getMaxEventDuration()),
+                                          [](const qint64& time, const EventBlockPtr& eventBlock){ return time < eventBlock->firstStartTime(); });
+
+            if (block != blocks.begin()){
+                --block;
+            }
+
+            for (; block != blocks.end() && (*block)->firstStartTime() < visibleEndTime; ++block)
+            {
+                if (!(*block)->size()){
+                    continue;
+                }
 
-            auto event = events.lowerBound(visibleRangeStartTime);
-            if (event != events.end() && (*event)->getEndTime() == visibleRangeStartTime){
-                event++;
+                qint64 blockEndTime = *std::max_element((*block)->endTimes(), (*block)->endTimes() + (*block)->size());
+                if (blockEndTime > visibleStartTime){
+                    layoutBlockSummary(task, (*block)->firstStartTime(), blockEndTime, currItemStylePtr, params, currAxisYPos, buffer);
+                }
             }
 
-            for (; event != events.end() && (*event)->getStartTime() < visibleRangeEndTime; ++event)
+            continue;
+        }
+
+        // If the scale is appropriate
+        if (params.timeDelta <= params.eventsVisibleScale && task->eventCount())
+        {
+            const QList<EventBlockPtr>& blocks = task->getEventBlocks();
+
+            // Events starting earlier than that can't reach the visible range
+            qint64 searchStartTime = TimeLineTime::add(visibleStartTime, -task->getMaxEventDuration());
+
+            // Zoomed in past the gap tolerance, the gaps inside runs become visible
+            bool splitRuns = task->getCoalescingGap() >= 0 && task->getCoalescingGap() * pixelsPerUSec >= 1;
+
+            // Frozen history is decoded only when the visible range reaches into it
+            const QList<ColdEventBlockPtr>& coldBlocks = task->getColdBlocks();
+            auto coldBlock = std::lower_bound(coldBlocks.begin(), coldBlocks.end(), TimeLineTime::add(visibleStartTime, -task->getMaxColdBlockSpan()),
+                                              [](const ColdEventBlockPtr& eventBlock, const qint64& time){ return eventBlock->getFirstStartTime() < time; });
+
+            for (; coldBlock != coldBlocks.end() && (*coldBlock)->getFirstStartTime() < visibleEndTime; ++coldBlock)
             {
-                QPair<QDateTime, QDateTime> intersection = (*event)->getIntersection(visibleRangeStartTime, visibleRangeEndTime);
+                if ((*coldBlock)->getMaxEndTime() > visibleStartTime){
+                    layoutEventBlock(*task->getDecodedColdBlock(*coldBlock), searchStartTime, currItemStylePtr,
+                                     params, currAxisYPos, splitRuns, buffer);
+                }
+            }
+
+            auto block = std::upper_bound(blocks.begin(), blocks.end(), searchStartTime,
+                                          [](const qint64& time, const EventBlockPtr& eventBlock){ return time < eventBlock->firstStartTime(); });
 
-                //rect
-                quint32 startPosX = (intersection.first.toMSecsSinceEpoch() - visibleRangeStartTime.toMSecsSinceEpoch())*pixelsPerMSec;
-                quint32 width = (intersection.second.toMSecsSinceEpoch() - intersection.first.toMSecsSinceEpoch())*pixelsPerMSec;
+            if (block != blocks.begin()){
+                --block;
+            }
 
-                QRect itemRect(startPosX, currAxisYPos - eventHeight / 2, width, eventHeight);
-                mVisibleItems.append(VisibleItem(*event, *currItemStylePtr, itemRect));
+            for (; block != blocks.end() && (*block)->firstStartTime() < visibleEndTime; ++block){
+                layoutEventBlock(**block, searchStartTime, currItemStylePtr, params, currAxisYPos, splitRuns, buffer);
             }
         }
+    }
+}
+
+void TimeLineItems::layoutBlockSummary(const TaskItemPtr& task, const qint64& startTime, const qint64& endTime, const TaskStylePtr& style,
+                                       const LayoutParams& params, const qint32& axisYPos, LayoutBuffer& buffer)
+{
+    qint64 visibleStartTime = std::max(startTime, params.visibleRangeStartTime);
+    qint64 visibleEndTime = std::min(endTime, params.visibleRangeEndTime);
+
+    qint32 startPos = (visibleStartTime - params.visibleRangeStartTime)*params.pixelsPerUSec;
+    qint32 width = std::max<qint32>(1, (visibleEndTime - visibleStartTime)*params.pixelsPerUSec);
+
+    // The bar stands for the task's events, so it's the task that is hovered and selected
+    QRect itemRect(startPos, axisYPos - params.eventHeight / 2, width, params.eventHeight);
+    buffer.visibleItems.append(VisibleItem(task, style, itemRect));
+}
+
+void TimeLineItems::layoutEventBlock(const EventBlock& block, const qint64& searchStartTime, const TaskStylePtr& style,
+                                     const LayoutParams& params, const qint32& axisYPos, const bool& splitRuns, LayoutBuffer& buffer)
+{
+    const qint64& visibleStartTime = params.visibleRangeStartTime;
+    const qint64& visibleEndTime = params.visibleRangeEndTime;
 
-        //info marks
-        const QMap<QDateTime, EventItemPtr>& eventsWithInfoIcons = task->getEventsWithInfoIcon();
-        auto event = eventsWithInfoIcons.lowerBound(visibleRangeStartTime);
+    int firstEvent = block.lowerBound(searchStartTime);
+    int eventCount = block.lowerBound(visibleEndTime) - firstEvent;
 
-        for (; event != eventsWithInfoIcons.end() && event.key() < visibleRangeEndTime; ++event)
+    int visibleCount = TimeLineSpanKernel::transform(block.startTimes() + firstEvent,
+                                                     block.endTimes() + firstEvent,
+                                                     eventCount, visibleStartTime, visibleEndTime, params.pixelsPerUSec,
+                                                     buffer.spanPositions.data(),
+                                                     buffer.spanWidths.data(),
+                                                     buffer.spanIndices.data());
+
+    for (int span = 0; span < visibleCount; ++span)
+    {
+        EventItemPtr event = block.event(firstEvent + buffer.spanIndices[span]);
+
+        if (splitRuns && !event->getRunGaps().isEmpty())
         {
-            int pos = (event.key().toMSecsSinceEpoch() - visibleRangeStartTime.toMSecsSinceEpoch())*pixelsPerMSec;
-            mInfoMarks.insert(pos, *currItemStylePtr);
+            layoutRun(event, style, params, axisYPos, buffer);
+            continue;
         }
+
+        QRect itemRect(buffer.spanPositions[span], axisYPos - params.eventHeight / 2,
+                       buffer.spanWidths[span], params.eventHeight);
+
+        buffer.visibleItems.append(VisibleItem(event, style, itemRect));
     }
+}
+
+void TimeLineItems::layoutRun(const EventItemPtr& run, const TaskStylePtr& style, const LayoutParams& params,
+                              const qint32& axisYPos, LayoutBuffer& buffer)
+{
+    const qint64& visibleStartTime = params.visibleRangeStartTime;
+    const qint64& visibleEndTime = params.visibleRangeEndTime;
+    const QVector<qint64>& gaps = run->getRunGaps();
+
+    // Gap bounds go in increasing order, the first one past the visible start opens the first visible segment
+    int bound = std::upper_bound(gaps.begin(), gaps.end(), visibleStartTime) - gaps.begin();
+    int gap = bound / 2;
+
+    qint64 segmentStartTime = gap > 0? gaps[2 * gap - 1] : run->getStartTimeUs();
+
+    for (; segmentStartTime < visibleEndTime; ++gap)
+    {
+        bool isLastSegment = 2 * gap >= gaps.size();
+        qint64 segmentEndTime = isLastSegment? run->getEndTimeUs() : gaps[2 * gap];
+
+        qint64 startTime = std::min(std::max(segmentStartTime, visibleStartTime), visibleEndTime);
+        qint64 endTime = std::min(std::max(segmentEndTime, visibleStartTime), visibleEndTime);
+
+        if (endTime > startTime)
+        {
+            qint32 startPos = std::nearbyint((startTime - visibleStartTime) * params.pixelsPerUSec);
+            qint32 endPos = std::nearbyint((endTime - visibleStartTime) * params.pixelsPerUSec);
 
-    mTaskStorage->unlock();
+            QRect itemRect(startPos, axisYPos - params.eventHeight / 2, endPos - startPos, params.eventHeight);
+            buffer.visibleItems.append(VisibleItem(run, style, itemRect));
+        }
+
+        if (isLastSegment){
+            break;
+        }
+
+        segmentStartTime = gaps[2 * gap + 1];
+    }
 }
 
 QList<TimeLineItemPtr> TimeLineItems::getItemUnderPos(QPoint &pos)
@@ -932,9 +5182,38 @@ QList<TimeLineItemPtr> TimeLineItems::getItemUnderPos(QPoint &pos)
     return result;
 }
 
-void TimeLineItems::setSettings(const TimeLineItemsSettings& settings)
-{
-    mSettings = settings;
+void TimeLineItems::setSettings(const TimeLineItemsSettings& settings)
+{
+    mSettings = settings;
+    mLayoutDirty = true;
+    ++mLayoutConfigRevision;
+}
+
+void TimeLineItems::setVerticalOffset(const qreal& offset)
+{
+    qreal newOffset = qBound<qreal>(0, offset, getMaxVerticalOffset());
+    if (newOffset == mVerticalOffset){
+        return;
+    }
+
+    mVerticalOffset = newOffset;
+    mLayoutDirty = true;
+    update();
+}
+
+void TimeLineItems::setQualityLevel(const TimeLineQualityGovernor::QualityLevel& level)
+{
+    if (level == mQualityLevel){
+        return;
+    }
+
+    // Only the coarse layout level changes the layout, the rest is painting
+    if ((level >= TimeLineQualityGovernor::QUALITY_COARSE_LAYOUT) != (mQualityLevel >= TimeLineQualityGovernor::QUALITY_COARSE_LAYOUT)){
+        mLayoutDirty = true;
+    }
+
+    mQualityLevel = level;
+    update();
 }
 
 void TimeLineItems::setStyle(const TimeLineItemsStyle& style)
@@ -942,6 +5221,11 @@ void TimeLineItems::setStyle(const TimeLineItemsStyle& style)
     mStyle = style;
 }
 
+void TimeLineItems::setMetrics(TimeLineMetricsPtr metrics)
+{
+    mMetrics = metrics;
+}
+
 TimeLineItems::TimeLineItemsSettings TimeLineItems::getSettings() const
 {
     return mSettings;
@@ -952,6 +5236,32 @@ TimeLineItems::TimeLineItemsStyle TimeLineItems::getStyle() const
     return mStyle;
 }
 
+bool TimeLineItems::isLayoutCoarse() const
+{
+    return mLayoutCoarse;
+}
+
+TimeLineQualityGovernor::QualityLevel TimeLineItems::getQualityLevel() const
+{
+    return mQualityLevel;
+}
+
+bool TimeLineItems::isSwimlaneMode() const
+{
+    return mSettings.swimlaneRowHeight != 0;
+}
+
+qreal TimeLineItems::getVerticalOffset() const
+{
+    return mVerticalOffset;
+}
+
+qreal TimeLineItems::getMaxVerticalOffset() const
+{
+    qreal lanesHeight = mSize.height() - (quint16)(mSize.height()*mSettings.infoHeightPortion);
+    return std::max<qreal>(0, (qreal)mRowCount * mSettings.swimlaneRowHeight - lanesHeight);
+}
+
 QRectF TimeLineItems::boundingRect() const
 {
     return QRectF(QPointF(0, 0), QPointF(mSize.width(), mSize.height()));
@@ -961,17 +5271,19 @@ QRectF TimeLineItems::boundingRect() const
 ///////////////         SphereTimeLineScaler            //////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
-SphereTimeLineScaler::SphereTimeLineScaler(QObject* parent /*= 0*/) :
+SphereTimeLineScaler::SphereTimeLineScaler(TimeLineAnimationDriver* animationDriver, QObject* parent /*= 0*/) :
+                                           mAnimationDriver(animationDriver),
                                            mZoomStepTime(350),
                                            mElementalZoomTime(50),
                                            mZoomStepRelaxationCoeff(0.000625),
                                            mScheduledScaling(0),
+                                           mIsScaling(false),
+                                           mZoomStepStartTime(0),
+                                           mLastTickTime(0),
                                            QObject(parent)
 {
-    mZoomingTimeLine = new QTimeLine(mZoomStepTime, this);
-    mZoomingTimeLine->setUpdateInterval(mElementalZoomTime);
-
-    connect(mZoomingTimeLine, SIGNAL(valueChanged(qreal)), this, SLOT(onUpdateScale(qreal)));
+    Q_ASSERT(mAnimationDriver != nullptr);
+    connect(mAnimationDriver, SIGNAL(tick(qint64)), this, SLOT(onTick(qint64)));
 }
 
 void SphereTimeLineScaler::startScaling(const int& delta)
@@ -983,55 +5295,122 @@ void SphereTimeLineScaler::startScaling(const int& delta)
         mScheduledScaling = stepNum;
     }
 
-    if (mZoomingTimeLine->state() == QTimeLine::NotRunning){
-        mZoomingTimeLine->start();
+    if (!mIsScaling && mScheduledScaling)
+    {
+        mIsScaling = true;
+        mZoomStepStartTime = mAnimationDriver->now();
+        mLastTickTime = mZoomStepStartTime;
+        mAnimationDriver->requestTick();
     }
 }
 
 void SphereTimeLineScaler::stopScaling()
 {
-    mZoomingTimeLine->stop();
+    mIsScaling = false;
+    mScheduledScaling = 0;
 }
 
-void SphereTimeLineScaler::onUpdateScale(qreal)
+double SphereTimeLineScaler::zoomRate() const
 {
     // The more zomoming iterations are scheduled, the faster the zooming is
-    qreal factor = 1.0 + qreal(mScheduledScaling)*mZoomStepRelaxationCoeff;
-    emit scale(factor);
+    return std::log(1.0 + qreal(mScheduledScaling)*mZoomStepRelaxationCoeff) / mElementalZoomTime;
+}
+
+void SphereTimeLineScaler::onTick(qint64 time)
+{
+    if (!mIsScaling){
+        return;
+    }
+
+    // The scale changes continuously with the elapsed time, so the result doesn't depend on the frame rate.
+    // A tick may cover the end of a zooming action, then the rest of it goes at the next action's rate
+    double zoom = 0;
+    while (mIsScaling && mLastTickTime < time)
+    {
+        qint64 zoomStepEndTime = mZoomStepStartTime + mZoomStepTime;
+        qint64 tickEndTime = std::min(time, zoomStepEndTime);
+
+        zoom += zoomRate() * (tickEndTime - mLastTickTime);
+        mLastTickTime = tickEndTime;
+
+        if (tickEndTime == zoomStepEndTime){
+            scalingFinished();
+        }
+    }
+
+    if (zoom != 0){
+        emit scale(std::exp(zoom));
+    }
+
+    if (mIsScaling){
+        mAnimationDriver->requestTick();
+    }
 }
 
 void SphereTimeLineScaler::scalingFinished()
 {
     mScheduledScaling = mScheduledScaling > 0?
                         mScheduledScaling - 1 : mScheduledScaling + 1;
+
+    // Go on with the next planned action
+    mIsScaling = mScheduledScaling != 0;
+    mZoomStepStartTime += mZoomStepTime;
 }
 
 void SphereTimeLineScaler::setZoomStepTime(const quint64& zoomStepTime)
 {
-    if (zoomStepTime > 0)
-    {
+    if (zoomStepTime > 0){
         mZoomStepTime = zoomStepTime;
-        mZoomingTimeLine->setDuration(mZoomStepTime);
     }
 }
 
 void SphereTimeLineScaler::setElementalZoomTime(const quint64& elementalZoomTime)
 {
-    mElementalZoomTime = elementalZoomTime;
-    mZoomingTimeLine->setUpdateInterval(50);
+    if (elementalZoomTime > 0){
+        mElementalZoomTime = elementalZoomTime;
+    }
 }
 
 quint64 SphereTimeLineScaler::getZoomStepTime() const
 {
-    return mZoomingTimeLine->duration();
+    return mZoomStepTime;
 }
 
 quint64 SphereTimeLineScaler::getElementalZoomTime() const
 {
-    return mZoomingTimeLine->updateInterval();
+    return mElementalZoomTime;
+}
+
+bool SphereTimeLineScaler::scalingIsOngoing() const
+{
+    return mIsScaling;
+}
+
+qreal SphereTimeLineScaler::getRemainingScale() const
+{
+    if (!mIsScaling){
+        return 1;
+    }
+
+    // The same integration as onTick() does, from the last applied tick till the last planned action ends
+    double zoom = 0;
+    int scheduledScaling = mScheduledScaling;
+    qint64 fromTime = mLastTickTime;
+    qint64 zoomStepEndTime = mZoomStepStartTime + mZoomStepTime;
+
+    while (scheduledScaling)
+    {
+        zoom += std::log(1.0 + qreal(scheduledScaling)*mZoomStepRelaxationCoeff) / mElementalZoomTime * (zoomStepEndTime - fromTime);
+
+        fromTime = zoomStepEndTime;
+        zoomStepEndTime += mZoomStepTime;
+        scheduledScaling += scheduledScaling > 0? -1 : 1;
+    }
+
+    return std::exp(zoom);
 }
 
-quint64 SphereTimeLineScaler::getDefaultScale() const
+qint64 SphereTimeLineScaler::getDefaultScale() const
 {
     return mDefaultScale;
 }
@@ -1040,21 +5419,23 @@ quint64 SphereTimeLineScaler::getDefaultScale() const
 ///////////////          SphereTimeLineScroller         //////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
-SphereTimeLineScroller::SphereTimeLineScroller(QObject* parent /*= 0*/) :
+SphereTimeLineScroller::SphereTimeLineScroller(TimeLineAnimationDriver* animationDriver, QObject* parent /*= 0*/) :
+                        mAnimationDriver(animationDriver),
                         mDragIsOngoing(false),
+                        mIsScrolling(false),
                         mMouseDragDistance(0),
                         mInitialVelocity(0),
-                        mMsecPerPixel(0),
+                        mUsecPerPixel(0),
                         mFrictionCoeff(0.66),
+                        mScrollStartClockTime(0),
+                        mScrollDuration(0),
                         QObject(parent)
 {
-    mScrollingTimeLine = new QTimeLine(mTotalElementalScrollDuration, this);
-    mScrollingTimeLine->setUpdateInterval(mElementalScrollTime);
-
-    connect(mScrollingTimeLine, SIGNAL(valueChanged(qreal)), this, SLOT(onUpdateScroll(qreal)));
+    Q_ASSERT(mAnimationDriver != nullptr);
+    connect(mAnimationDriver, SIGNAL(tick(qint64)), this, SLOT(onTick(qint64)));
 }
 
-void SphereTimeLineScroller::startScrolling(const QDateTime startTime, const double msecPerPixel)
+void SphereTimeLineScroller::startScrolling(const qint64 startTime, const double usecPerPixel)
 {
     // If there was a move at all
     if (mMouseDragDistance)
@@ -1068,11 +5449,13 @@ void SphereTimeLineScroller::startScrolling(const QDateTime startTime, const dou
 
         if (scrollTime > 0)
         {
-            mMsecPerPixel = msecPerPixel;
+            mUsecPerPixel = usecPerPixel;
             mScrollStartTime = startTime;
+            mScrollStartClockTime = mAnimationDriver->now();
+            mScrollDuration = scrollTime;
 
-            mScrollingTimeLine->setDuration(scrollTime);
-            mScrollingTimeLine->start();
+            mIsScrolling = true;
+            mAnimationDriver->requestTick();
         }
     }
 }
@@ -1081,25 +5464,38 @@ void SphereTimeLineScroller::stopScrolling()
 {
     mInitialVelocity = 0;
     mMouseDragDistance = 0;
-
-    if (mScrollingTimeLine->state() == QTimeLine::Running){
-        mScrollingTimeLine->stop();
-    }
+    mIsScrolling = false;
 }
 
 void SphereTimeLineScroller::onScrollFinished()
 {
     mInitialVelocity = 0;
     mMouseDragDistance = 0;
+    mIsScrolling = false;
 }
 
-void SphereTimeLineScroller::onUpdateScroll(qreal)
+void SphereTimeLineScroller::onTick(qint64 time)
 {
-    if (mScrollingTimeLine->state() == QTimeLine::NotRunning){
+    if (!mIsScrolling){
         return;
     }
 
-    int elapsedTime = mScrollingTimeLine->currentTime();
+    // The position is a function of the elapsed time only, the last tick lands exactly on the stop point
+    qint64 elapsedTime = std::min(time - mScrollStartClockTime, mScrollDuration);
+    qint64 newCentralTime = scrollPosition(elapsedTime);
+
+    if (elapsedTime >= mScrollDuration){
+        onScrollFinished();
+    }
+    else{
+        mAnimationDriver->requestTick();
+    }
+
+    emit scroll(newCentralTime);
+}
+
+qint64 SphereTimeLineScroller::scrollPosition(const qint64& elapsedTime) const
+{
     double acceleration = mFrictionCoeff*mFreeFallAcceleration / 1000; //  in m/(sec^2)
 
     if (mInitialVelocity > 0){ //direction
@@ -1109,9 +5505,16 @@ void SphereTimeLineScroller::onUpdateScroll(qreal)
     double newPos = mInitialVelocity*elapsedTime +
                     acceleration*elapsedTime*elapsedTime / 2; // Distance from the start: v0*t - (a*t^2)/2
 
-    QDateTime newCentralTime = mScrollStartTime.addMSecs(newPos*mMsecPerPixel); // New central time
+    return TimeLineTime::add(mScrollStartTime, TimeLineTime::scale(TimeLineTime::microsecond, newPos*mUsecPerPixel)); // New central time
+}
+
+qint64 SphereTimeLineScroller::getScrollDestination() const
+{
+    if (!mIsScrolling){
+        return TimeLineTime::mInvalidTime;
+    }
 
-    emit scroll(newCentralTime);
+    return scrollPosition(mScrollDuration);
 }
 
 void SphereTimeLineScroller::addScrollingDelta(const int& delta)
@@ -1143,7 +5546,7 @@ void SphereTimeLineScroller::setDragIsOngoing(const bool& isOngoing)
 
 bool SphereTimeLineScroller::scalingIsOngoing() const
 {
-    return mScrollingTimeLine->state() == QTimeLine::Running;
+    return mIsScrolling;
 }
 
 double SphereTimeLineScroller::getFrictionCoefficient() const
@@ -1157,26 +5560,136 @@ bool SphereTimeLineScroller::dragIsOngoing() const
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+///////////////         TimeLineFrameScheduler          //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TimeLineFrameScheduler::TimeLineFrameScheduler(const quint32& maxFrameRate, QObject* parent) :
+    QObject(parent),
+    mMaxFrameRate(maxFrameRate)
+{
+    mFrameTimer = new QTimer(this);
+    mFrameTimer->setSingleShot(true);
+    mFrameTimer->setTimerType(Qt::PreciseTimer);
+
+    connect(mFrameTimer, SIGNAL(timeout()), this, SLOT(onFrameTimer()));
+}
+
+void TimeLineFrameScheduler::setMaxFrameRate(const quint32& maxFrameRate)
+{
+    mMaxFrameRate = maxFrameRate;
+}
+
+quint32 TimeLineFrameScheduler::getMaxFrameRate() const
+{
+    return mMaxFrameRate;
+}
+
+bool TimeLineFrameScheduler::isFramePending() const
+{
+    return mFrameTimer->isActive();
+}
+
+void TimeLineFrameScheduler::requestFrame()
+{
+    if (mFrameTimer->isActive()){
+        return;
+    }
+
+    // The first frame after a pause goes out on the next event loop iteration
+    qint64 delay = 0;
+    if (mMaxFrameRate && mLastFrameTimer.isValid())
+    {
+        qint64 frameInterval = 1000 / mMaxFrameRate;
+        delay = std::max<qint64>(0, frameInterval - mLastFrameTimer.elapsed());
+    }
+
+    mFrameTimer->start(delay);
+}
+
+void TimeLineFrameScheduler::onFrameTimer()
+{
+    mLastFrameTimer.start();
+    emit frame();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////         TimeLineAnimationDriver         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+TimeLineAnimationDriver::TimeLineAnimationDriver(TimeLineFrameScheduler* frameScheduler, QObject* parent) :
+    QObject(parent),
+    mFrameScheduler(frameScheduler),
+    mTickRequested(false)
+{
+    Q_ASSERT(mFrameScheduler != nullptr);
+
+    mClock.start();
+    connect(mFrameScheduler, SIGNAL(frame()), this, SLOT(onFrame()));
+}
+
+void TimeLineAnimationDriver::requestTick()
+{
+    mTickRequested = true;
+    mFrameScheduler->requestFrame();
+}
+
+qint64 TimeLineAnimationDriver::now() const
+{
+    return mClock.elapsed();
+}
+
+bool TimeLineAnimationDriver::isTickRequested() const
+{
+    return mTickRequested;
+}
+
+void TimeLineAnimationDriver::onFrame()
+{
+    if (!mTickRequested){
+        return;
+    }
+
+    // Animations request the next tick from their handlers
+    mTickRequested = false;
+    emit tick(now());
+}
+
 //////////////////////////////////////////////////////////////////////////////
 ///////////////             TimeLineWidget              //////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
-TimeLineWidget::TimeLineWidget(TaskStoragePtr tasks, QWidget *parent) : QGraphicsView(parent)
+TimeLineWidget::TimeLineWidget(TaskStoragePtr tasks, QWidget *parent) : QGraphicsView(parent), mTaskStorage(tasks),
+                                                                        mTaskSetRevision(tasks->getTaskSetRevision())
 {
     setScene(new QGraphicsScene(this));
     setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
 
+    mZoomTargetDelta = 0;
+
+    // Scene changes only request a frame, the scheduler decides when the viewport is repainted
+    mFrameScheduler = new TimeLineFrameScheduler(TimeLineSettings().maxFrameRate, this);
+    setViewportUpdateMode(QGraphicsView::NoViewportUpdate);
+
+    mQualityGovernor.setFrameTimeBudget(TimeLineSettings().frameTimeBudget);
+
     // Scaling and scrolling
-    mScaler = new SphereTimeLineScaler(this);
-    mScroller = new SphereTimeLineScroller(this);
+    mAnimationDriver = new TimeLineAnimationDriver(mFrameScheduler, this);
+    mScaler = new SphereTimeLineScaler(mAnimationDriver, this);
+    mScroller = new SphereTimeLineScroller(mAnimationDriver, this);
+
+    // Frame statistics
+    mMetrics = std::make_shared<TimeLineMetrics>();
 
     // Interface
     mGrid = new TimeLineGrid();
-    mGrid->setTimeRange(QDateTime::currentDateTime(), mScaler->getDefaultScale());
+    mGrid->setTimeRange(TimeLineTime::currentTime(), mScaler->getDefaultScale());
+    mGrid->setMetrics(mMetrics);
     mGrid->setZValue(1);
 
     // Items
     mItems = new TimeLineItems(tasks);
+    mItems->setMetrics(mMetrics);
     mItems->setZValue(0);
 
     // Info about an item
@@ -1200,16 +5713,28 @@ TimeLineWidget::TimeLineWidget(TaskStoragePtr tasks, QWidget *parent) : QGraphic
     mUpdateTimer = new QTimer(this);
     mUpdateTimer->start(1000);
 
+    mRefinementTimer = new QTimer(this);
+    mRefinementTimer->setSingleShot(true);
+
+    mQualityRestoreTimer = new QTimer(this);
+    mQualityRestoreTimer->setSingleShot(true);
+
     scene()->addItem(mGrid);
     scene()->addItem(mItems);
     mRealTimeButtonProxy = scene()->addWidget(realTimeButton);
 
     // Connections
     connect(mUpdateTimer, SIGNAL(timeout()), this, SLOT(onUpdateTimeLine()));
+    connect(mRefinementTimer, SIGNAL(timeout()), this, SLOT(onRefineLayout()));
+    connect(mQualityRestoreTimer, SIGNAL(timeout()), this, SLOT(onRestoreQuality()));
     connect(realTimeButton, SIGNAL(clicked()), this, SLOT(setRealTime()));
-    connect(mScroller, SIGNAL(scroll(QDateTime)), this, SLOT(setCentralTime(QDateTime)));
+    connect(mScroller, SIGNAL(scroll(qint64)), this, SLOT(onScroll(qint64)));
     connect(mScaler, SIGNAL(scale(qreal)), this, SLOT(setScale(qreal)));
     connect(mGrid, SIGNAL(rangeChanged(QDateTime, QDateTime)), this, SIGNAL(rangeChanged(QDateTime, QDateTime)));
+    connect(scene(), SIGNAL(changed(QList<QRectF>)), this, SLOT(onSceneChanged(QList<QRectF>)));
+    connect(mFrameScheduler, SIGNAL(frame()), this, SLOT(onFrame()));
+    connect(tasks.get(), SIGNAL(changed(QList<TimeLineTaskType>, qint64, qint64)),
+            this, SLOT(onStorageChanged(QList<TimeLineTaskType>, qint64, qint64)));
 
     viewport()->setCursor(Qt::OpenHandCursor);
 
@@ -1233,10 +5758,16 @@ void TimeLineWidget::mousePressEvent(QMouseEvent *event)
                 viewport()->setCursor(Qt::ArrowCursor);
                 mItems->setSelectedItem(item);
                 EventItemPtr event = std::dynamic_pointer_cast<EventItem>(item);
-                emit eventClicked(event->getParentTask()->getTaskId(), event->getStartTime());
+                TaskItemPtr parentTask = event->getParentTask();
+                if (parentTask == nullptr){
+                    continue;
+                }
+
+                emit eventClicked(event->getEventId());
 
-                qDebug() << QString("Clicked event: taskId %1 | startTime %2 | endTime %3")
-                            .arg(event->getParentTask()->getTaskId())
+                qDebug() << QString("Clicked event: eventId %1 | taskId %2 | startTime %3 | endTime %4")
+                            .arg(event->getEventId())
+                            .arg(parentTask->getTaskId())
                             .arg(event->getStartTime().toString())
                             .arg(event->getEndTime().toString());
             }
@@ -1329,8 +5860,13 @@ void TimeLineWidget::mouseReleaseEvent(QMouseEvent *event)
         if (mScroller->dragIsOngoing()) // start scrolling
         {
             mScroller->setDragIsOngoing(false);
-            double msecPerPx = (mGrid->getTimeDelta() * 2) / mGrid->graphicsRect().width();
-            mScroller->startScrolling(mGrid->getTimeMark(), msecPerPx);
+            double usecPerPx = TimeLineTime::toDouble(mGrid->getTimeDelta() * 2) / mGrid->graphicsRect().width();
+            mScroller->startScrolling(mGrid->getTimeMark(), usecPerPx);
+
+            // The destination is known from the start, so it's laid out while the timeline is moving
+            if (mScroller->scalingIsOngoing()){
+                mItems->prefetchLayout(mScroller->getScrollDestination(), mGrid->getTimeDelta());
+            }
         }
     }
 
@@ -1339,8 +5875,23 @@ void TimeLineWidget::mouseReleaseEvent(QMouseEvent *event)
 
 void TimeLineWidget::wheelEvent(QWheelEvent *event)
 {
+    // Shift + wheel scrolls the swimlane rows instead of zooming
+    if ((event->modifiers() & Qt::ShiftModifier) && mItems->isSwimlaneMode())
+    {
+        mItems->setVerticalOffset(mItems->getVerticalOffset() - event->delta());
+        event->accept();
+        return;
+    }
+
     mScaler->startScaling(event->delta());
 
+    // The same for the scale the planned zooming will end at
+    if (mScaler->scalingIsOngoing())
+    {
+        mZoomTargetDelta = TimeLineTime::scale(mGrid->getTimeDelta(), 1 / mScaler->getRemainingScale());
+        mItems->prefetchLayout(mGrid->getTimeMark(), mZoomTargetDelta);
+    }
+
     QGraphicsView::wheelEvent(event);
 }
 
@@ -1359,6 +5910,18 @@ QString TimeLineWidget::createStringForItem(TimeLineItemPtr item)
         TaskItemPtr event = std::dynamic_pointer_cast<TaskItem>(item);        
         taskName = event->getTaskName();
    }
+   else if (type == AbstractItem::ITEM_TYPE_EVENT)
+   {
+        // Payloads stay interned in the storage until a tooltip needs one
+        EventItemPtr event = std::dynamic_pointer_cast<EventItem>(item);
+        TaskItemPtr task = event->getParentTask();
+        QString payload = mTaskStorage->getEventPayload(event);
+
+        taskName = task != nullptr? task->getTaskName() : QString();
+        if (!payload.isEmpty()){
+            taskName += taskName.isEmpty()? payload : ": " + payload;
+        }
+   }
 
     return taskName;
 }
@@ -1370,32 +5933,148 @@ void TimeLineWidget::addItemType(const TimeLineTaskType type, const TaskStyle& s
 
 void TimeLineWidget::setScale(qreal factor)
 {
-    int newDelta = mGrid->getTimeDelta() / factor;
+    qint64 newDelta = TimeLineTime::scale(mGrid->getTimeDelta(), 1 / factor);
+
+    // The last step lands exactly on the predicted scale, where the prefetched layout is waiting
+    if (!mScaler->scalingIsOngoing())
+    {
+        if (mZoomTargetDelta){
+            newDelta = mZoomTargetDelta;
+        }
+
+        mZoomTargetDelta = 0;
+    }
+
+    // Zooming past a limit stops right at it
+    TimeLineGrid::TimeLineGridSettings gridSettings = mGrid->getSettings();
+    qint64 limitedDelta = qBound(gridSettings.maximumScale, newDelta, gridSettings.minimumScale);
 
-    if (mGrid->setTimeRange(mGrid->getTimeMark(), newDelta)){
+    if (limitedDelta != mGrid->getTimeDelta() && mGrid->setTimeRange(mGrid->getTimeMark(), limitedDelta)){
         mItems->setTime(mGrid->getTimeMark(), mGrid->getTimeDelta());
     }
-    else{
+
+    if (limitedDelta != newDelta)
+    {
         mScaler->stopScaling();
+        mZoomTargetDelta = 0;
     }
 }
 
 void TimeLineWidget::setCentralTime(QDateTime time)
 {
-    if (mGrid->setTimeRange(time, mGrid->getTimeDelta())){
+    onScroll(TimeLineTime::fromDateTime(time));
+}
+
+void TimeLineWidget::onScroll(qint64 centralTime)
+{
+    if (mGrid->setTimeRange(centralTime, mGrid->getTimeDelta())){
         mItems->setTime(mGrid->getTimeMark(), mGrid->getTimeDelta());
     }
 }
 
+void TimeLineWidget::setSelectedEvent(quint64 eventId)
+{
+    mItems->setSelectedEvent(eventId);
+}
+
+void TimeLineWidget::onStorageChanged(QList<TimeLineTaskType> taskTypes, qint64 startTime, qint64 endTime)
+{
+    bool typeIsShown = false;
+    for (auto& type : taskTypes){
+        typeIsShown |= mItems->hasItemType(type);
+    }
+
+    qint64 visibleRangeStartTime = TimeLineTime::add(mGrid->getTimeMark(), -mGrid->getTimeDelta());
+    qint64 visibleRangeEndTime = TimeLineTime::add(mGrid->getTimeMark(), mGrid->getTimeDelta());
+
+    // Swimlane rows follow the tasks that exist, wherever they are in time
+    quint64 taskSetRevision = mTaskStorage->getTaskSetRevision();
+    bool rowsChanged = mItems->isSwimlaneMode() && taskSetRevision != mTaskSetRevision;
+    mTaskSetRevision = taskSetRevision;
+
+    // Repaint only if the changed interval overlaps the visible range
+    if (typeIsShown &&
+        (rowsChanged ||
+        (startTime < visibleRangeEndTime && endTime > visibleRangeStartTime)))
+    {
+        mItems->invalidateLayout();
+    }
+}
+
 void TimeLineWidget::onUpdateTimeLine()
 {
-    bool ok = mGrid->setTimeRange(mGrid->getTimeMark().addSecs(1), mGrid->getTimeDelta());
+    bool ok = mGrid->setTimeRange(TimeLineTime::add(mGrid->getTimeMark(), TimeLineTime::second), mGrid->getTimeDelta());
 
     if (ok){
         mItems->setTime(mGrid->getTimeMark(), mGrid->getTimeDelta());
     }
 }
 
+void TimeLineWidget::onSceneChanged(const QList<QRectF>& region)
+{
+    for (auto& rect : region){
+        mDirtyRegion += mapFromScene(rect).boundingRect().adjusted(-1, -1, 1, 1);
+    }
+
+    mFrameScheduler->requestFrame();
+}
+
+void TimeLineWidget::onFrame()
+{
+    // Frames requested without scene changes, e.g. after new settings, repaint everything
+    if (mDirtyRegion.isEmpty()){
+        viewport()->update();
+    }
+    else{
+        viewport()->update(mDirtyRegion);
+    }
+
+    mDirtyRegion = QRegion();
+}
+
+void TimeLineWidget::paintEvent(QPaintEvent *event)
+{
+    QElapsedTimer frameTimer;
+    frameTimer.start();
+
+    // Layers add their timings to the current frame while the scene is painted
+    mMetrics->beginFrame();
+    mMetrics->currentFrame().qualityLevel = mQualityGovernor.getLevel();
+    QGraphicsView::paintEvent(event);
+
+    double frameTime = TimeLineMetrics::elapsedMSecs(frameTimer);
+    mMetrics->endFrame(frameTime);
+
+    // The level is applied from the next frame on
+    if (mQualityGovernor.addFrame(frameTime)){
+        mItems->setQualityLevel(mQualityGovernor.getLevel());
+    }
+
+    // Frames are painted only on changes, so a still view would keep a lowered level for good
+    if (mQualityGovernor.getLevel() != TimeLineQualityGovernor::QUALITY_FULL){
+        mQualityRestoreTimer->start(mQualityRestoreDelay);
+    }
+
+    // Every coarse frame postpones the refinement, it starts once the view has been still for a while
+    if (mItems->isLayoutCoarse()){
+        mRefinementTimer->start(mItems->getSettings().refinementDelay);
+    }
+}
+
+void TimeLineWidget::onRestoreQuality()
+{
+    // A single frame of a still view is affordable, whatever the motion cost
+    mQualityGovernor.reset();
+    mItems->setQualityLevel(mQualityGovernor.getLevel());
+}
+
+void TimeLineWidget::onRefineLayout()
+{
+    if (!mItems->refineLayout()){
+        mRefinementTimer->start(mRefinementPollInterval);
+    }
+}
+
 void TimeLineWidget::resizeEvent(QResizeEvent *event)
 {
     rearrangeWidgets(event->size());
@@ -1436,7 +6115,7 @@ void TimeLineWidget::setRealTime()
     {
         realTimeButton->setIcon(QIcon(":/icons/realtime_on_128"));
 
-        if (mGrid->setTimeRange(QDateTime::currentDateTime(), mGrid->getTimeDelta())){
+        if (mGrid->setTimeRange(TimeLineTime::currentTime(), mGrid->getTimeDelta())){
             mItems->setTime(mGrid->getTimeMark(), mGrid->getTimeDelta());
         }
     }
@@ -1449,12 +6128,17 @@ void TimeLineWidget::setStyle(const TimeLineStyle& style)
 {
     mItems->setStyle(style.itemsStyle);
     mGrid->setStyle(style.gridStyle);
+    mFrameScheduler->requestFrame();
 }
 
 void TimeLineWidget::setSettings(const TimeLineSettings& settings)
 {
     mItems->setSettings(settings.itemsSettings);
     mGrid->setSettings(settings.gridSettings);
+    mFrameScheduler->setMaxFrameRate(settings.maxFrameRate);
+    mQualityGovernor.setFrameTimeBudget(settings.frameTimeBudget);
+    mItems->setQualityLevel(mQualityGovernor.getLevel());
+    mFrameScheduler->requestFrame();
 }
 
 TimeLineWidget::TimeLineStyle TimeLineWidget::getStyle() const
@@ -1471,7 +6155,164 @@ TimeLineWidget::TimeLineSettings TimeLineWidget::getSettings() const
     TimeLineSettings settings;
     settings.gridSettings = mGrid->getSettings();
     settings.itemsSettings = mItems->getSettings();
+    settings.maxFrameRate = mFrameScheduler->getMaxFrameRate();
+    settings.frameTimeBudget = mQualityGovernor.getFrameTimeBudget();
 
     return settings;
 }
 
+const TimeLineMetrics& TimeLineWidget::metrics() const
+{
+    return *mMetrics;
+}
+
+bool TimeLineWidget::isMetricsOverlayVisible() const
+{
+    return mGrid->isMetricsOverlayVisible();
+}
+
+void TimeLineWidget::setMetricsOverlayVisible(bool visible)
+{
+    mGrid->setMetricsOverlayVisible(visible);
+}
+
+void TimeLineWidget::resetMetrics()
+{
+    mMetrics->clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineRenderer            //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+void TimeLineRenderer::paint(TaskStoragePtr storage, const qint64& startTime, const qint64& endTime,
+                             const RenderStyle& style, const QSize& size, QPainter* painter)
+{
+    qint64 timeDelta = (endTime - startTime) / 2;
+
+    // There is no zooming here, so the scale limits must not reject the requested range
+    TimeLineGrid::TimeLineGridSettings gridSettings = style.settings.gridSettings;
+    gridSettings.maximumScale = std::min(gridSettings.maximumScale, timeDelta);
+    gridSettings.minimumScale = std::max(gridSettings.minimumScale, timeDelta);
+
+    TimeLineGrid grid;
+    grid.setStyle(style.style.gridStyle);
+    grid.setSettings(gridSettings);
+    grid.setMouseMarkVisible(false);
+    grid.setSize(size, QPointF(0, 0));
+    grid.setTimeRange(startTime + timeDelta, timeDelta);
+
+    TimeLineItems items(storage);
+    items.setStyle(style.style.itemsStyle);
+    items.setSettings(style.settings.itemsSettings);
+
+    for (auto& itemType : style.itemTypes){
+        items.addItemType(itemType.first, itemType.second);
+    }
+
+    QRect graphicsRect = grid.graphicsRect();
+    items.setSize(graphicsRect.size(), graphicsRect.topLeft());
+    items.setTime(grid.getTimeMark(), grid.getTimeDelta());
+
+    // Same z order as in the widget: items first, the grid on top of them
+    painter->save();
+    painter->translate(graphicsRect.topLeft());
+    items.paint(painter, nullptr);
+    painter->restore();
+
+    painter->save();
+    grid.paint(painter, nullptr);
+    grid.paintOverlay(painter);
+    painter->restore();
+}
+
+QImage TimeLineRenderer::render(TaskStoragePtr storage, const QPair<QDateTime, QDateTime>& range,
+                                const QSize& size, const RenderStyle& style)
+{
+    return render(storage, TimeLineTime::fromDateTime(range.first), TimeLineTime::fromDateTime(range.second), size, style);
+}
+
+QImage TimeLineRenderer::render(TaskStoragePtr storage, const qint64& startTime, const qint64& endTime,
+                                const QSize& size, const RenderStyle& style)
+{
+    Q_ASSERT(storage != nullptr);
+    if (storage == nullptr || size.isEmpty() || startTime == TimeLineTime::mInvalidTime || !(startTime < endTime)){
+        return QImage();
+    }
+
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull()){ // Too large, renderTiled() should be used
+        return image;
+    }
+
+    image.fill(style.backgroundColor);
+
+    QPainter painter(&image);
+    paint(storage, startTime, endTime, style, size, &painter);
+    painter.end();
+
+    return image;
+}
+
+bool TimeLineRenderer::renderTiled(TaskStoragePtr storage, const QPair<QDateTime, QDateTime>& range,
+                                   const QSize& size, const RenderStyle& style,
+                                   const int& tileWidth, TileHandler handler)
+{
+    return renderTiled(storage, TimeLineTime::fromDateTime(range.first), TimeLineTime::fromDateTime(range.second),
+                       size, style, tileWidth, handler);
+}
+
+bool TimeLineRenderer::renderTiled(TaskStoragePtr storage, const qint64& startTime, const qint64& endTime,
+                                   const QSize& size, const RenderStyle& style,
+                                   const int& tileWidth, TileHandler handler)
+{
+    Q_ASSERT(storage != nullptr && handler);
+    if (storage == nullptr || !handler || size.isEmpty() || tileWidth <= 0 ||
+        startTime == TimeLineTime::mInvalidTime || !(startTime < endTime)){
+        return false;
+    }
+
+    // Every tile is painted with the same width and scale, so the grid marks match across the seams
+    const qint64& rangeStartTime = startTime;
+    double usecPerPixel = TimeLineTime::toDouble(endTime - rangeStartTime) / size.width();
+    QSize paintedSize(tileWidth + 2 * mTileMargin, size.height());
+
+    QImage paintedTile(paintedSize, QImage::Format_ARGB32_Premultiplied);
+    if (paintedTile.isNull()){
+        return false;
+    }
+
+    // Horizontal indents would be repeated on every tile, the outer border is painted separately
+    RenderStyle tileStyle = style;
+    tileStyle.settings.gridSettings.borderIndentX = 0;
+    int borderIndentY = style.settings.gridSettings.borderIndentY;
+
+    for (int tileStart = 0; tileStart < size.width(); tileStart += tileWidth)
+    {
+        int width = std::min(tileWidth, size.width() - tileStart);
+        qint64 startTime = TimeLineTime::add(rangeStartTime, TimeLineTime::scale(tileStart - mTileMargin, usecPerPixel));
+        qint64 endTime = TimeLineTime::add(rangeStartTime, TimeLineTime::scale(tileStart - mTileMargin + paintedSize.width(), usecPerPixel));
+
+        paintedTile.fill(style.backgroundColor);
+
+        QPainter painter(&paintedTile);
+        paint(storage, startTime, endTime, tileStyle, paintedSize, &painter);
+
+        painter.setOpacity(1);
+        painter.setPen(QPen(style.style.gridStyle.borderColor));
+
+        if (tileStart == 0){
+            painter.drawLine(mTileMargin, borderIndentY, mTileMargin, size.height() - borderIndentY);
+        }
+
+        if (tileStart + width == size.width()){
+            painter.drawLine(mTileMargin + width - 1, borderIndentY, mTileMargin + width - 1, size.height() - borderIndentY);
+        }
+
+        painter.end();
+
+        handler(paintedTile.copy(mTileMargin, 0, width, size.height()), QRect(tileStart, 0, width, size.height()));
+    }
+
+    return true;
+}
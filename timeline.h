@@ -1,8 +1,6 @@
 #ifndef TIMELINE_H
 #define TIMELINE_H
 
-#define DEBUG
-
 #include <QMap>
 #include <QHash>
 #include <QRect>
@@ -12,24 +10,35 @@
 #include <QDebug>
 #include <QTimer>
 #include <QLabel>
+#include <QCache>
 #include <QWidget>
 #include <QAction>
 #include <QPointF>
 #include <QString>
+#include <QVector>
+#include <QFuture>
 #include <QPainter>
-#include <QTimeLine>
 #include <QDateTime>
 #include <QTabWidget>
 #include <QWheelEvent>
+#include <QThreadPool>
 #include <QPushButton>
+#include <QStringList>
 #include <QPainterPath>
 #include <QSvgRenderer>
 #include <QGraphicsItem>
+#include <QElapsedTimer>
+#include <QSharedMemory>
 #include <QGraphicsView>
 #include <QGraphicsScene>
 #include <QGraphicsProxyWidget>
 
+#include <cmath>
+#include <atomic>
 #include <memory>
+#include <limits>
+#include <functional>
+#include <unordered_map>
 
 inline uint qHash(const QRect& rect, uint seed = 0)
 {
@@ -45,14 +54,29 @@ inline uint qHash(const QPair<QDateTime, QDateTime>& data, uint seed = 0)
 class AbstractItem;
 class TaskItem;
 class EventItem;
+class EventBlock;
+class ColdEventBlock;
+class TimeLineColdCache;
+class TimeLineStringPool;
 class TaskStorage;
+class TimeLineSlabArena;
+class TimeLineMetrics;
+class TimeLineGridOverlay;
+class TimeLineAnimationDriver;
 struct TaskStyle;
 
 typedef std::shared_ptr<AbstractItem> TimeLineItemPtr;
 typedef std::shared_ptr<TaskItem> TaskItemPtr;
+typedef std::weak_ptr<TaskItem> TaskItemWeakPtr;
 typedef std::shared_ptr<EventItem> EventItemPtr;
+typedef std::shared_ptr<EventBlock> EventBlockPtr;
+typedef std::shared_ptr<ColdEventBlock> ColdEventBlockPtr;
+typedef std::shared_ptr<TimeLineColdCache> TimeLineColdCachePtr;
+typedef std::shared_ptr<TimeLineStringPool> TimeLineStringPoolPtr;
 typedef std::shared_ptr<TaskStorage> TaskStoragePtr;
 typedef std::shared_ptr<TaskStyle> TaskStylePtr;
+typedef std::shared_ptr<TimeLineMetrics> TimeLineMetricsPtr;
+typedef std::shared_ptr<TimeLineSlabArena> TimeLineSlabArenaPtr;
 
 enum TimeLineTaskType
 {
@@ -60,6 +84,48 @@ enum TimeLineTaskType
     TL_TASK_TYPE_INVALID
 };
 
+Q_DECLARE_METATYPE(TimeLineTaskType)
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineTime                //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Time core of the timeline: points are usec since epoch, spans are usec, both qint64.
+* The arithmetic saturates instead of overflowing, so scales from microseconds to decades are safe.
+* QDateTime (msec) is used only at the public boundaries
+*/
+
+class TimeLineTime
+{
+public:
+    static const qint64 microsecond = 1;
+    static const qint64 millisecond = 1000 * microsecond;
+    static const qint64 second = 1000 * millisecond;
+    static const qint64 minute = 60 * second;
+    static const qint64 hour = 60 * minute;
+    static const qint64 day = 24 * hour;
+    static const qint64 week = 7 * day;
+    static const qint64 month = 30 * day;                   // Nominal, for scales and grid steps
+    static const qint64 year = 365 * day;
+    static const qint64 decade = 10 * year;
+
+    static const qint64 mInvalidTime = std::numeric_limits<qint64>::min();      // A time that isn't set
+    static const qint64 mMinTime = mInvalidTime + 1;
+    static const qint64 mMaxTime = std::numeric_limits<qint64>::max();
+
+    static qint64 fromDateTime(const QDateTime& time);      // mInvalidTime for an invalid time
+    static QDateTime toDateTime(const qint64& time);        // Rounded down to msec, invalid for mInvalidTime
+    static qint64 currentTime();
+
+    static qint64 add(const qint64& time, const qint64& span);       // Saturated to [mMinTime, mMaxTime]
+    static qint64 scale(const qint64& span, const double& factor);   // Rounded and saturated
+    static double toDouble(const qint64& span);              // Exact up to 2^53 usec (~285 years)
+
+    // QDateTime::toString() of the whole seconds followed by fractionDigits (0-6) digits of the second fraction
+    static QString toString(const qint64& time, const QString& format, const int& fractionDigits = 0);
+};
+
 //////////////////////////////////////////////////////////////////////////////
 ///////////////             AbstractTimeLineItem         /////////////////////
 //////////////////////////////////////////////////////////////////////////////
@@ -79,20 +145,25 @@ public:
     };
 
 protected:
-    QDateTime mStartTime;
-    QDateTime mEndTime;
+    qint64 mStartTime;                                      // usec since epoch, TimeLineTime::mInvalidTime - not set
+    qint64 mEndTime;
 
 public:
     AbstractItem(QDateTime startTime = QDateTime(), QDateTime endTime = QDateTime());
+    AbstractItem(const qint64& startTime, const qint64& endTime);                       // usec since epoch
     virtual ~AbstractItem() {};
 
     void setStartTime(const QDateTime startTime);
     void setEndTime(const QDateTime endTime);
+    void setStartTimeUs(const qint64& startTime);
+    virtual void setEndTimeUs(const qint64& endTime);
 
     //getters
-    QDateTime getStartTime() const;
+    QDateTime getStartTime() const;                         // Rounded down to msec
     QDateTime getEndTime() const;
-    QPair<QDateTime, QDateTime> getIntersection(const QDateTime& startTime, const QDateTime& endTime) const;  //Returns intersection with the object's time interval
+    qint64 getStartTimeUs() const;                          // usec since epoch, TimeLineTime::mInvalidTime - not set
+    qint64 getEndTimeUs() const;
+    QPair<qint64, qint64> getIntersection(const qint64& startTime, const qint64& endTime) const;  //Returns intersection with the object's time interval, usec. (0, 0) if there is none
     virtual ItemType getItemType() const = 0;
 };
 
@@ -102,7 +173,8 @@ public:
 
 /**
 * Event is a task's subitem representing some specific action done by the task
-* Arbitrary, tasks can have no events at all
+* Arbitrary, tasks can have no events at all.
+* With coalescing on, an event may be a run of merged back-to-back events of the same status
 */
 
 class EventItem : public AbstractItem
@@ -118,21 +190,187 @@ public:
 
 private:
     EventStatus mStatus; // Result of the task
-    TaskItemPtr mParentTask;
+    TaskItemWeakPtr mParentTask;                            // Non-owning, the task owns it's events
+    quint64 mEventId;                                       // Unique within a storage, 0 - assigned by the storage on adding
+    quint32 mRunLength;                                     // Number of merged events, 1 - a single event
+    quint32 mPayloadId;                                     // Text of the event in the storage's string pool, 0 - none
+    QVector<qint64> mRunGaps;                               // [start, end) usec pairs of the gaps between the merged events
+    QVector<qint64> mRunStarts;                             // usec, starts of the merged events after the first one
+
+    friend class TaskStorage;
+    friend class TaskItem;
+    friend class ColdEventBlock;
+
+    int runEventsBefore(const qint64& time) const;          // Merged events starting before time, usec
+    EventItemPtr takeRunTail(const int& first);             // Moves the merged events from first on to a new run, this one keeps the ones before
 
 public:
-    EventItem(QDateTime startTime = QDateTime(), QDateTime endTime = QDateTime(), EventStatus stat = EVENT_STATUS_INVALID);
+    EventItem(QDateTime startTime = QDateTime(),
+              QDateTime endTime = QDateTime(),
+              EventStatus stat = EVENT_STATUS_INVALID,
+              const quint64& eventId = 0);
+    EventItem(const qint64& startTime,
+              const qint64& endTime,
+              EventStatus stat = EVENT_STATUS_INVALID,
+              const quint64& eventId = 0);                  // usec since epoch
 
     //setters
     bool setParentTask(TaskItemPtr task);
+    void setPayloadId(const quint32& payloadId);            // An id from TaskStorage::internString()
 
     //getters
-    const TaskItemPtr getParentTask() const;
+    const TaskItemPtr getParentTask() const;                // Null if the task has already been destroyed
+    quint64 getEventId() const;
+    quint32 getRunLength() const;
+    quint32 getPayloadId() const;                           // The text is TaskStorage::getEventPayload()
+    const QVector<qint64>& getRunGaps() const;
     EventStatus getStatus() const;
+    qint64 getMiddleTime() const;                           // Position of the event's info mark, usec
     ItemType getItemType() const;
 };
 
 
+//////////////////////////////////////////////////////////////////////////////
+///////////////             EventBlock                   /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* A chunk of a task's events sorted by start time. The times are kept in contiguous
+* arrays, so that whole blocks can be passed to TimeLineSpanKernel
+*/
+
+class EventBlock
+{
+public:
+    static const int mCapacity = 256;
+
+private:
+    QVector<qint64> mStartTimes;                            // usec since epoch
+    QVector<qint64> mEndTimes;                              // usec since epoch
+    QVector<EventItemPtr> mEvents;
+
+public:
+    EventBlock();
+
+    //setters
+    void insert(const EventItemPtr& event);                 // Events with equal start times keep the insertion order
+    void split(EventBlock& upperHalf);                      // Moves the upper half of the events to the empty upperHalf
+    void remove(const int& from, const int& to);            // Removes the events in [from, to) positions
+    void remove(const QVector<int>& positions);             // Removes the events at the positions, ascending
+    void setEndTime(const int& pos, const qint64& endTime); // The event has changed it's end, usec
+
+    //getters
+    int size() const;
+    bool isFull() const;
+    qint64 firstStartTime() const;
+    qint64 lastStartTime() const;
+    int lowerBound(const qint64& startTime) const;          // Position of the first event starting at or after startTime
+    const qint64* startTimes() const;
+    const qint64* endTimes() const;
+    EventItemPtr event(const int& pos) const;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             ColdEventBlock               /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Immutable compressed block of old events. Times, ids and run gaps are delta and varint encoded,
+* the header keeps what is needed to skip the block without decoding it.
+* Every decode makes new items, so a selected or hovered frozen event is a different object once
+* its block is evicted from TimeLineColdCache, and the selection is lost
+*/
+
+class ColdEventBlock
+{
+private:
+    QByteArray mData;                                       // Encoded events sorted by start time
+    quint64 mBlockId;                                       // Unique, keys the decode cache
+    int mCount;                                             // Encoded items, a run counts once
+    qint64 mFirstStartTime;                                 // usec since epoch
+    qint64 mLastStartTime;
+    qint64 mMaxEndTime;
+    quint64 mMinEventId;                                    // Most id lookups are told apart by the range, without decoding
+    quint64 mMaxEventId;
+    QVector<quint32> mStatusCounts;                         // Original events per EventItem::EventStatus, runs count all their events
+
+    static std::atomic<quint64> mNextBlockId;
+
+public:
+    ColdEventBlock(const QVector<EventItemPtr>& events);    // Events sorted by start time, not empty
+
+    QVector<EventItemPtr> decode(const TaskItemPtr& parentTask = TaskItemPtr()) const;
+
+    //getters
+    quint64 getBlockId() const;
+    int size() const;
+    int byteSize() const;
+    qint64 getFirstStartTime() const;
+    qint64 getLastStartTime() const;
+    qint64 getMaxEndTime() const;
+    quint64 getMinEventId() const;
+    quint64 getMaxEventId() const;
+    bool hasEventId(const quint64& eventId) const;          // Reads only the ids, and only if eventId is in the range
+    quint32 getStatusCount(const EventItem::EventStatus& status) const;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineColdCache            /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Recently decoded cold blocks shared by all tasks of a storage, least recently used ones are dropped first. Thread safe
+*/
+
+class TimeLineColdCache
+{
+private:
+    QCache<quint64, EventBlockPtr> mBlocks;                 // By cold block id
+    mutable QMutex mMutex;
+
+public:
+    TimeLineColdCache(const int& maxBlocks = 64);
+
+    //setters
+    void insert(const quint64& blockId, const EventBlockPtr& block);
+    void setMaxBlocks(const int& maxBlocks);
+    void clear();
+
+    //getters
+    EventBlockPtr find(const quint64& blockId);             // Null if the block isn't cached
+    int getMaxBlocks() const;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineStringPool           /////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Interned texts of a storage: task names and event payloads. Every distinct string is kept once
+* and referred to by a 32-bit id, so millions of items sharing a few texts cost 4 bytes each.
+* Strings are never removed, an id stays valid while the pool lives. Thread safe
+*/
+
+class TimeLineStringPool
+{
+private:
+    QHash<QString, quint32> mIds;
+    QVector<QString> mStrings;                              // By id, 0 - the empty string
+    qint64 mByteSize;                                       // Characters of all the strings
+    mutable QMutex mMutex;
+
+public:
+    TimeLineStringPool();
+
+    //setters
+    quint32 intern(const QString& string);                  // The same id for equal strings, 0 for the empty one
+
+    //getters
+    QString getString(const quint32& id) const;             // Empty for an unknown id
+    int size() const;
+    qint64 byteSize() const;
+};
+
 //////////////////////////////////////////////////////////////////////////////
 ///////////////             TaskItem                     /////////////////////
 //////////////////////////////////////////////////////////////////////////////
@@ -140,18 +378,46 @@ public:
 /**
 * A task is the concept representing some general action on the timeline.
 * It may my comprised of discrete events or represent a single continuous action
-* Every task type has it's own axis to paint on, style etc
+* Every task type has it's own axis to paint on, style etc.
+* Old events can be frozen into cold blocks, they are decoded again only to be shown or queried
 */
 
-class TaskItem : public AbstractItem
+class TaskItem : public AbstractItem, public std::enable_shared_from_this<TaskItem>
 {
 private:
     quint64 mTaskId;
     bool mIsInfinite;
-    QString mTaskName;
+    QString mTaskName;                                      // Until the task gets a string pool
+    quint32 mTaskNameId;                                    // In mStringPool
+    TimeLineStringPoolPtr mStringPool;                      // Set by the storage
     TimeLineTaskType mTaskType;
-    QMap<QDateTime, EventItemPtr> mEvent;
-    QMap<QDateTime, EventItemPtr> mEventsWithInfoSigh;      // Events with icons
+    QList<EventBlockPtr> mEventBlocks;                      // Events sorted by start time, the only index of the hot events
+    quint32 mEventCount;                                    // Items in mEventBlocks, a run counts once
+    qint64 mMaxEventDuration;                               // usec, bounds the search for events overlapping a time point
+    TimeLineSlabArenaPtr mSlabArena;                        // Event blocks are allocated here, set by the storage
+    qint64 mCoalescingGap;                                  // usec, events continuing the latest one within it are merged into it, -1 - off
+    QList<ColdEventBlockPtr> mColdBlocks;                   // Frozen events, sorted by the first start time
+    TimeLineColdCachePtr mColdCache;                        // Decoded cold blocks, set by the storage
+    quint32 mColdEventCount;                                // Items in mColdBlocks
+    qint64 mMaxColdBlockSpan;                               // usec, the longest time from a cold block's first start to it's max end
+    qint64 mExplicitEndTime;                                // usec, the end time given to the task, events removed don't move the end before it. TimeLineTime::mInvalidTime - none
+    qint64 mPurgeTime;                                      // usec, the task's key in the storage's purge index, max() - not indexed
+    int mBucketPos;                                         // In the storage's bucket of the task type, -1 - none
+
+    friend class TaskStorage;
+
+private:
+    void insertToBlocks(const EventItemPtr& event);
+    void setStringPool(const TimeLineStringPoolPtr& stringPool);   // Interns the name
+    bool appendToRun(const EventItemPtr& event);            // Merges the event into the latest one if it continues it
+    void removeFromBlocks(const int& blockNum, const int& pos, int count);    // count events from the position on
+    void lowerBound(const qint64& startTime, int& blockNum, int& pos) const;  // Position of the first event starting at or after startTime, usec
+    EventItemPtr latestEvent() const;                       // The last one by start time, null if there are no events
+    qint64 firstEventStartTime() const;                     // usec, of the earliest hot or frozen event, max() if there are no events
+    EventBlockPtr createEventBlock() const;
+    qint64 latestEventEndTime() const;                      // usec, min() if there are no events
+    qint64 latestColdEventEndTime() const;                  // usec, min() if there are no cold events
+    void restoreEndTime();                                  // Moves the end time back to the latest event or the explicit end time
 
 public:
     TaskItem(const QDateTime startTime = QDateTime(),
@@ -160,9 +426,24 @@ public:
              const bool& isInfinite = false,
              const QString taskName = QString(),
              const TimeLineTaskType& taskType = TL_TASK_TYPE_INVALID);
+    TaskItem(const qint64& startTime,
+             const qint64& endTime,
+             const quint64& taskId = -1,
+             const bool& isInfinite = false,
+             const QString taskName = QString(),
+             const TimeLineTaskType& taskType = TL_TASK_TYPE_INVALID);                   // usec since epoch
 
     //setters
-    bool addEvent(EventItemPtr event);
+    EventItemPtr addEvent(EventItemPtr event);              // The event itself or the run it was merged into. Not checked for duplicates, TaskStorage rejects a taken id
+    void setCoalescingGap(const qint64& gap);               // usec, -1 - off. Events with ids and failures are never merged
+    QVector<EventItemPtr> freezeEvents(const qint64& time, ColdEventBlockPtr& coldBlock);          // Moves up to a block of the oldest events starting before time to a new cold block, returns them
+    int removeColdEvents(const qint64& startTime, const qint64& endTime,
+                         QVector<ColdEventBlockPtr>& removedBlocks,
+                         QVector<ColdEventBlockPtr>& addedBlocks);                      // Frozen events starting in [startTime, endTime), usec. Runs are cut at the bounds, partially covered blocks are replaced. Returns the number removed, merged events included
+    QVector<EventItemPtr> removeEvents(const qint64& startTime,
+                                       const qint64& endTime,
+                                       const int& maxCount = std::numeric_limits<int>::max());   // The earliest events starting in [startTime, endTime), usec. Runs are cut at the bounds
+    void setEndTimeUs(const qint64& endTime);               // Also the explicit end time
 
     //getters
     quint64 getTaskId() const;
@@ -172,9 +453,168 @@ public:
 
     bool isInfinite() const;
 
-    quint32 eventCount() const;
-    const QMap<QDateTime, EventItemPtr>& getEvents() const;
-    const QMap<QDateTime, EventItemPtr>& getEventsWithInfoIcon() const;
+    quint32 eventCount() const;                             // Including the frozen ones
+    quint32 coldEventCount() const;
+    QVector<EventItemPtr> getEvents(const qint64& startTime, const qint64& endTime) const;       // Not frozen events starting in [startTime, endTime), usec, by start time
+    const QList<EventBlockPtr>& getEventBlocks() const;
+    qint64 getMaxEventDuration() const;
+    qint64 getCoalescingGap() const;
+    const QList<ColdEventBlockPtr>& getColdBlocks() const;
+    qint64 getMaxColdBlockSpan() const;
+    EventBlockPtr getDecodedColdBlock(const ColdEventBlockPtr& block) const;            // Taken from the cold cache if it's there
+    QVector<EventItemPtr> getColdEvents(const qint64& startTime, const qint64& endTime) const;   // Frozen events starting in [startTime, endTime), usec, by start time
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineHistogram           //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Keeps a rolling window of the last samples and answers percentile queries
+*/
+
+class TimeLineHistogram
+{
+private:
+    QVector<double> mSamples;                         // Ring buffer with the last samples
+    int mNextSample;                                  // Ring buffer write position
+    int mSampleCount;
+
+public:
+    TimeLineHistogram(const int& windowSize = 256);
+
+    //setters
+    void addSample(const double& value);
+    void clear();
+
+    //getters
+    int sampleCount() const;
+    double percentile(const double& portion) const;   // portion in [0, 1], e.g. 0.95 for p95
+    double average() const;
+    double maximum() const;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineMetrics             //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Per-frame instrumentation of the timeline. Layers write into the current frame
+* while painting, the widget closes the frame and feeds the histograms
+*/
+
+class TimeLineMetrics
+{
+public:
+    enum Metric
+    {
+        METRIC_FRAME_TIME,
+        METRIC_LAYOUT_TIME,
+        METRIC_GRID_PAINT_TIME,
+        METRIC_ITEMS_PAINT_TIME,
+        METRIC_ICONS_PAINT_TIME,
+        METRIC_LOCK_WAIT_TIME,
+        METRIC_LOCK_HOLD_TIME,
+        METRIC_VISIBLE_ITEMS,
+        METRIC_ICONS_DRAWN,
+        METRIC_QUALITY_LEVEL,
+        METRIC_INVALID
+    };
+
+    struct FrameStats
+    {
+        double frameTime;                             // Whole viewport paint, msec
+        double layoutTime;                            // Visible items calculation including the lock wait, msec
+        double gridPaintTime;                         // msec
+        double itemsPaintTime;                        // Background, axis and items, msec
+        double iconsPaintTime;                        // msec
+        double lockWaitTime;                          // Time spent waiting for the storage lock, msec
+        double lockHoldTime;                          // Time the storage lock was held, msec
+        quint32 visibleItems;
+        quint32 iconsDrawn;
+        quint32 qualityLevel;                         // TimeLineQualityGovernor::QualityLevel the frame was painted at
+        bool gridCached;                              // The grid came from its DeviceCoordinateCache, only the overlay was painted
+        bool itemsCached;                             // The items came from their DeviceCoordinateCache, nothing was laid out or painted
+
+        FrameStats() : frameTime(0), layoutTime(0), gridPaintTime(0), itemsPaintTime(0), iconsPaintTime(0),
+                       lockWaitTime(0), lockHoldTime(0), visibleItems(0), iconsDrawn(0), qualityLevel(0),
+                       gridCached(true), itemsCached(true) {}
+
+        double value(const Metric& metric) const;
+        bool isMeasured(const Metric& metric) const;  // False if the metric's layer came from its cache
+    };
+
+private:
+    FrameStats mCurrentFrame;                         // Frame being painted
+    FrameStats mLastFrame;                            // Last finished frame
+    QVector<TimeLineHistogram> mHistograms;           // One per metric
+    quint64 mFrameCount;
+
+public:
+    TimeLineMetrics(const int& windowSize = 256);
+
+    //setters
+    FrameStats& currentFrame();
+    void beginFrame();
+    void endFrame(const double& frameTime);
+    void clear();
+
+    //getters
+    FrameStats lastFrame() const;
+    const TimeLineHistogram& histogram(const Metric& metric) const;
+    quint64 frameCount() const;
+
+    static QString metricName(const Metric& metric);
+    static double elapsedMSecs(const QElapsedTimer& timer);
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////         TimeLineQualityGovernor         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Keeps frames within a paint time budget. Frames over the budget step the rendering quality
+* down one level at a time, frames with enough headroom step it back up, much slower
+*/
+
+class TimeLineQualityGovernor
+{
+public:
+    enum QualityLevel                                 // Each level keeps the degradations of the previous ones
+    {
+        QUALITY_FULL,
+        QUALITY_NO_HQ_ANTIALIASING,                   // QPainter::HighQualityAntialiasing is off
+        QUALITY_PLAIN_RECTS,                          // Items are plain rects instead of rounded ones
+        QUALITY_ICON_TICKS,                           // Info icons are replaced by tick marks
+        QUALITY_COARSE_LAYOUT,                        // Event blocks are always laid out as single bars
+        QUALITY_INVALID
+    };
+
+private:
+    QualityLevel mLevel;
+    double mFrameTimeBudget;                          // msec, 0 - the governor is off
+    double mAverageFrameTime;                         // Moving average since the last level change, msec
+    int mFramesOverBudget;                            // Consecutive frames with the average over the budget
+    int mFramesWithHeadroom;                          // Consecutive frames with the average under mHeadroomPortion of the budget
+
+    static const int mStepDownFrames = 3;
+    static const int mStepUpFrames = 30;
+    static const double mHeadroomPortion;
+    static const double mAveragingFactor;
+
+public:
+    TimeLineQualityGovernor(const double& frameTimeBudget = 0);
+
+    //setters
+    void setFrameTimeBudget(const double& frameTimeBudget);  // Resets to the full quality
+    bool addFrame(const double& frameTime);           // True if the level has changed
+    void reset();
+
+    //getters
+    QualityLevel getLevel() const;
+    double getFrameTimeBudget() const;
+
+    static QString levelName(const QualityLevel& level);
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -190,15 +630,11 @@ class TimeLineGrid : public QObject, public QGraphicsItem
     Q_OBJECT
     Q_INTERFACES(QGraphicsItem)
 
-private:
-    static const int second = 1000;
-    static const int minute = second * 60;
-    static const int hour = minute * 60;
-    static const int day = hour * 24;
-    static const int week = day * 7;
-
-    static const int mMaxNumberOfUnits = 30;
+public:
+    static const qint64 mMinTimeScale = 10 * TimeLineTime::microsecond;      // Zoom limits can be set within these
+    static const qint64 mMaxTimeScale = 5 * TimeLineTime::decade;            // The visible range stays under 2^52 usec, as TimeLineSpanKernel needs
 
+private:
     static const QString mTimeFormat;
     static const QString mDayFormat;
     static const double mOverlayOpacity;
@@ -223,13 +659,13 @@ public:
     {
         quint32 borderIndentY;                      // Item painting region's vertical indent (from the borders of the widget, px)
         quint32 borderIndentX;			            // Item painting region's horizontal indent (from the borders of the widget, px)
-        quint64 maximumScale;                       // Max zoom time interval - MINUTE
-        quint64 minimumScale;                       // Min zoom time interval - WEEK
+        qint64 maximumScale;                        // Max zoom time interval, usec from the center to a border. Default - MINUTE
+        qint64 minimumScale;                        // Min zoom time interval, usec. Default - WEEK. Both are clamped to [mMinTimeScale, mMaxTimeScale]
 
         TimeLineGridSettings(const quint32 borderIndentHorisontal = 0,
                              const quint32 borderIndentVertical = 15,
-                             const quint64 maximumTimeScale = minute,
-                             const quint64 minimumTimeScale = week) :
+                             const qint64 maximumTimeScale = TimeLineTime::minute,
+                             const qint64 minimumTimeScale = TimeLineTime::week) :
                              borderIndentX(borderIndentHorisontal),
                              borderIndentY(borderIndentVertical),
                              maximumScale(maximumTimeScale),
@@ -237,24 +673,42 @@ public:
     };
 
 private:
-    QDateTime mTimeCenterMark;
-    quint64 mTimeDelta;                               // Current scale - msec from the central mark to both borders
+    qint64 mTimeCenterMark;                           // usec since epoch, TimeLineTime::mInvalidTime - not set yet
+    qint64 mTimeDelta;                                // Current scale - usec from the central mark to both borders
     QPoint mMousePos;
     QSizeF mSize;                                     // Current grid scale
 
     TimeLineGridStyle mStyle;
     TimeLineGridSettings mSettings;
 
+    TimeLineMetricsPtr mMetrics;
+    bool mMetricsOverlayVisible;                      // Paint frame statistics on top of the grid
+    bool mMouseMarkVisible;                           // Disabled when there is no mouse, e.g. for headless rendering
+
+    TimeLineGridOverlay* mOverlay;                    // Child item with the marks that move with the mouse
+    QRect mMouseMarkRect;                             // Overlay parts as painted last time, to repaint only them
+    QRect mMetricsOverlayRect;
+
+    friend class TimeLineGridOverlay;
+
 private:
    void drawMarks(QPainter* painter);
-   void drawCurrTimeMark(const double& msecPerPixel, const quint64& currTime, const quint64& endTime,
-                         const quint64& startTime, QPair<int, int>& currTimeMarkBorders,
+   void drawOverlay(QPainter* painter);
+   void drawMetricsOverlay(QPainter* painter);
+   void drawCurrTimeMark(const double& usecPerPixel, const qint64& currTime, const qint64& startTime,
+                         const qint64& endTime, QPair<int, int>& currTimeMarkBorders,
                          const QString textFormat, const QFontMetrics& fm, QPainter* painter);
+   QPair<int, int> getCurrTimeMarkBorders(const double& usecPerPixel, const qint64& currTime, const qint64& startTime,
+                                          const qint64& endTime, const QString textFormat, const QFontMetrics& fm) const;   // (-1, -1) if the mark is out of the range
+   QRect getMouseMarkRect() const;                   // Where the mouse mark is painted at the current position
+   void updateOverlay();
 
    void drawMouseTimeMark(QPainter* painter);
-   void drawGridMarks(const QFontMetrics& fm, const double& msecPerPixel,
-                      quint64& startTime, const QString textFormat,
+   void drawGridMarks(const QFontMetrics& fm, const double& usecPerPixel,
+                      const qint64& startTime, const QString textFormat,
                       QPair<int, int> &currTimeMarkBorders, QPainter *painter);
+   QString getTextFormat() const;                    // Grid marks format for the current scale
+   static int fractionDigits(const double& resolution);   // Second fraction digits telling apart times resolution usec apart
 
 public:
     TimeLineGrid(QGraphicsItem* parent = 0);
@@ -264,57 +718,539 @@ public:
     void setSettings(const TimeLineGridSettings& settings);
 
     void setSize(const QSizeF& size, const QPointF& pos);
-    bool setTimeRange(const QDateTime& centralTime, const quint64& timeDelta);
+    bool setTimeRange(const qint64& centralTime, const qint64& timeDelta);     // usec, false if timeDelta is out of the zoom limits
     void setMousePos(const QPoint& pos, bool isDragging = false);
+    void setMetrics(TimeLineMetricsPtr metrics);
+    void setMetricsOverlayVisible(const bool& visible);
+    void setMouseMarkVisible(const bool& visible);
 
     //getters
-    QDateTime getTimeMark() const;
-    quint64 getTimeDelta() const;
+    qint64 getTimeMark() const;                       // usec since epoch
+    qint64 getTimeDelta() const;                      // usec
     QPoint getMousePos() const;
     TimeLineGridSettings getSettings() const;
     TimeLineGridStyle getStyle() const;
+    bool isMetricsOverlayVisible() const;
 
-    quint64 calculateStep(const int& maxNumberOfTextMarks);
+    qint64 calculateStep(const int& maxNumberOfTextMarks) const;     // usec between grid marks, a round number of time units
     void paintText(bool topBottom, int xPos, QString text, QPainter* painter, QColor color);
     QRectF boundingRect() const;
     QRect graphicsRect() const;                        /**< Timeline item painting region rect */
 
-protected:
+    //graphic
     void paint(QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget * widget = 0);
+    void paintOverlay(QPainter* painter);             // The overlay's marks, for painting the grid outside of a scene
 
 signals:
     void rangeChanged(QDateTime startTime, QDateTime endTime);
 };
 
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineGridOverlay         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* The cheap part of the grid: the current time and mouse marks and the metrics overlay.
+* It's a separate item, so that hovering repaints only the marks' rects while
+* the static grid and the items layer are taken from their caches
+*/
+
+class TimeLineGridOverlay : public QGraphicsItem
+{
+private:
+    TimeLineGrid* mGrid;
+
+public:
+    TimeLineGridOverlay(TimeLineGrid* grid);
+
+    void updateGeometry();                            // Before the grid changes its size
+
+    QRectF boundingRect() const;
+
+    //graphic
+    void paint(QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget * widget = 0);
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineSlabArena           //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Slab allocator for the small objects owned by the storage: items, their control blocks,
+* event blocks and index nodes. Chunks of one size class are carved from 64 KiB slabs,
+* a slab goes back to the system as soon as its last chunk is freed (one spare is kept per class).
+* Slabs are aligned to their size, so the slab of a chunk is found by masking its address.
+* Bigger requests fall through to the global operator new. Thread safe
+*/
+
+class TimeLineSlabArena
+{
+public:
+    static const int mSlabSize = 64 * 1024;
+    static const int mGranularity = 16;                     // Chunk sizes and alignment
+    static const int mMaxChunkSize = 1024;                  // Bigger requests aren't served by slabs
+
+    struct Stats
+    {
+        int slabCount;                                      // Including the spare ones
+        qint64 bytesReserved;                               // Slabs and big allocations
+        qint64 bytesInUse;                                  // Requested by the live objects
+        qint64 chunkCount;                                  // Live objects in slabs
+        qint64 largeBytes;                                  // Allocated past the slabs
+        double fragmentation;                               // 1 - bytesInUse / bytesReserved
+
+        Stats() : slabCount(0), bytesReserved(0), bytesInUse(0), chunkCount(0), largeBytes(0), fragmentation(0){}
+    };
+
+private:
+    struct Slab                                             // Header at the start of every slab
+    {
+        Slab* prev;                                         // In the partial list of the size class
+        Slab* next;
+        void* freeChunks;                                   // Intrusive list of the freed chunks
+        int sizeClass;
+        int chunkSize;
+        int capacity;
+        int usedChunks;
+        int unusedOffset;                                   // Chunks past it have never been used
+        bool isPartial;
+    };
+
+    static const int mClassCount = mMaxChunkSize / mGranularity;
+
+    QVector<Slab*> mPartialSlabs;                           // Slabs with free chunks, per size class
+    QVector<Slab*> mSpareSlabs;                             // An empty slab kept per size class
+    int mSlabCount;
+    qint64 mBytesInUse;
+    qint64 mChunkCount;
+    qint64 mLargeBytes;
+    mutable QMutex mMutex;
+
+private:
+    Slab* createSlab(const int& sizeClass);
+    void releaseSlab(Slab* slab);
+    void linkPartial(Slab* slab);
+    void unlinkPartial(Slab* slab);
+    static int firstChunkOffset();
+
+public:
+    TimeLineSlabArena();
+    ~TimeLineSlabArena();
+
+    void* allocate(std::size_t size);
+    void deallocate(void* ptr, std::size_t size);           // size must be the one passed to allocate()
+    void trim();                                            // Releases the spare slabs
+
+    //getters
+    Stats getStats() const;
+};
+
+/**
+* Standard allocator over a TimeLineSlabArena, keeps the arena alive while anything allocated by it exists
+*/
+
+template <typename T>
+class TimeLineSlabAllocator
+{
+private:
+    TimeLineSlabArenaPtr mArena;
+
+public:
+    typedef T value_type;
+
+    TimeLineSlabAllocator(const TimeLineSlabArenaPtr& arena) : mArena(arena){}
+
+    template <typename U>
+    TimeLineSlabAllocator(const TimeLineSlabAllocator<U>& other) : mArena(other.getArena()){}
+
+    T* allocate(std::size_t count)
+    {
+        static_assert(alignof(T) <= TimeLineSlabArena::mGranularity, "The type is overaligned for the slab arena");
+        return static_cast<T*>(mArena->allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t count)
+    {
+        mArena->deallocate(ptr, count * sizeof(T));
+    }
+
+    //getters
+    const TimeLineSlabArenaPtr& getArena() const
+    {
+        return mArena;
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(const TimeLineSlabAllocator<T>& first, const TimeLineSlabAllocator<U>& second)
+{
+    return first.getArena() == second.getArena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const TimeLineSlabAllocator<T>& first, const TimeLineSlabAllocator<U>& second)
+{
+    return !(first == second);
+}
 
 //////////////////////////////////////////////////////////////////////////////
 ///////////////	                 TaskStorage            //////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
 /**
-* Stores tasks and their events
+* Stores tasks and their events.
+* Changes are coalesced and reported once per event loop iteration.
+* Items made by createTask() and createEvent() and the storage indices live in the storage's slab arena
 */
 
-class TaskStorage
+class TaskStorage : public QObject
 {
+    Q_OBJECT
+
 public:
-    TaskStorage(){};
+    struct InfoMark                                           // An event with an info icon, e.g. a failure
+    {
+        qint64 time;                                          // usec since epoch, the middle of the event
+        quint64 taskId;
+        TimeLineTaskType taskType;
+        EventItemPtr event;
+
+        InfoMark(const qint64& markTime = 0,
+                 const quint64& markTaskId = 0,
+                 const TimeLineTaskType& markTaskType = TL_TASK_TYPE_INVALID,
+                 const EventItemPtr& markEvent = EventItemPtr()) :
+                 time(markTime),
+                 taskId(markTaskId),
+                 taskType(markTaskType),
+                 event(markEvent){}
+    };
 
-    bool addTask(const TaskItemPtr task);
-    void removeTask(const quint64& taskId);
+public:
+    TaskStorage();
+
+    TaskItemPtr createTask(const QDateTime startTime = QDateTime(),
+                           const QDateTime endTime = QDateTime(),
+                           const quint64& taskId = -1,
+                           const bool& isInfinite = false,
+                           const QString taskName = QString(),
+                           const TimeLineTaskType& taskType = TL_TASK_TYPE_INVALID);          // Allocated in the storage's arena, not added yet
+    EventItemPtr createEvent(QDateTime startTime = QDateTime(),
+                             QDateTime endTime = QDateTime(),
+                             EventItem::EventStatus stat = EventItem::EVENT_STATUS_INVALID,
+                             const quint64& eventId = 0,
+                             const QString& payload = QString());                              // Allocated in the storage's arena, not added yet. The payload is interned
+    TaskItemPtr createTask(const qint64& startTime,
+                           const qint64& endTime,
+                           const quint64& taskId = -1,
+                           const bool& isInfinite = false,
+                           const QString taskName = QString(),
+                           const TimeLineTaskType& taskType = TL_TASK_TYPE_INVALID);          // usec since epoch
+    EventItemPtr createEvent(const qint64& startTime,
+                             const qint64& endTime,
+                             EventItem::EventStatus stat = EventItem::EVENT_STATUS_INVALID,
+                             const quint64& eventId = 0,
+                             const QString& payload = QString());                              // usec since epoch
+
+    bool addTask(const TaskItemPtr task);                     // False if the task's events have ids used in the storage already
+    void removeTask(const quint64& taskId, const bool& force = false);                // Tasks with events are removed only if forced
+    void setCoalescingGap(const qint64& gap);                 // usec, for all tasks. Merged events aren't addressable by id, -1 - off (default)
+    void setColdHistoryAge(const qint64& age);                // usec, older events are frozen periodically, -1 - off (default). Frozen events aren't addressable by id, their ids stay taken
+    void setColdCacheSize(const int& blocks);                 // Decoded cold blocks kept, 64 by default
+    int freezeBefore(const QDateTime& time);                  // Freezes events starting before time except failures, as purgeBefore() picks them. Returns the number frozen
+    int freezeBefore(const qint64& time);                     // usec since epoch
     bool addEvent(const quint32 taskId, const EventItemPtr event);
-    void clear();
+    int addEvents(const QVector<QPair<quint64, EventItemPtr>>& events);             // Task id and event pairs added under a single lock. Returns the number added
+    int removeEvents(const quint64& taskId, const QDateTime& startTime, const QDateTime& endTime);   // Events starting in [startTime, endTime), an invalid time - unbounded. Returns the number removed
+    int removeEvents(const quint64& taskId, const qint64& startTime, const qint64& endTime);         // usec, min() and max() - unbounded
+    int purgeBefore(const QDateTime& time);                   // Events starting before time and finished tasks left empty that ended before it. Returns the number of events removed
+    int purgeBefore(const qint64& time);                      // usec since epoch
+    void clear();                                             // The string pool is kept, events outside the storage may still refer to it
+    quint32 internString(const QString& string);              // For EventItem::setPayloadId(), 0 for the empty string
 
     TaskItemPtr getTask(const quint64& taskId);
+    EventItemPtr getEvent(const quint64& eventId);            // Null for a frozen event
     EventItemPtr getEvent(const quint64& taskId, const QDateTime& startTime);
+    EventItemPtr getEvent(const quint64& taskId, const qint64& startTime);             // usec since epoch, one of them if several events start then
+    QVector<EventItemPtr> getEvents(const quint64& taskId, const QDateTime& startTime, const QDateTime& endTime);   // Events starting in [startTime, endTime), by start time
+    QVector<EventItemPtr> getEvents(const quint64& taskId, const qint64& startTime, const qint64& endTime);         // usec since epoch
     const QHash<quint64, TaskItemPtr> getTasks();
+    const QVector<TaskItemPtr> getTasks(const TimeLineTaskType& taskType) const;      // Tasks of the type in the order they were added
+
+    QVector<InfoMark> getInfoMarks(const qint64& startTime, const qint64& endTime) const;          // Marks in [startTime, endTime), usec, must be called between lock() and unlock()
+    quint64 getRevision() const;                              // Incremented on every change, doesn't lock
+    quint64 getTaskSetRevision() const;                       // Incremented when tasks are added or removed, doesn't lock
+    qint64 getColdHistoryAge() const;
+    TimeLineSlabArena::Stats getAllocatorStats() const;       // Doesn't lock the storage
+    QString getString(const quint32& id) const;               // Interned string, doesn't lock the storage
+    QString getEventPayload(const EventItemPtr& event) const; // Looked up only when needed, e.g. for a tooltip
+    const TimeLineStringPoolPtr& getStringPool() const;
+    int countInfoMarks(const QDateTime& startTime, const QDateTime& endTime,
+                       const TimeLineTaskType& taskType = TL_TASK_TYPE_INVALID);                  // Marks in [startTime, endTime), TL_TASK_TYPE_INVALID - all task types. Walks the marks in the range
+    int countInfoMarks(const qint64& startTime, const qint64& endTime,
+                       const TimeLineTaskType& taskType = TL_TASK_TYPE_INVALID);                  // usec since epoch
 
     void lock();
     void unlock();
 
 private:
+    struct TaskBucket
+    {
+        QVector<TaskItemPtr> tasks;                           // In the order they were added, erased tasks leave null holes until compacted
+        int holeCount;
+
+        TaskBucket() : holeCount(0){}
+    };
+
+    void markDirty(const TimeLineTaskType& taskType, const qint64& startTime, const qint64& endTime);   // Must be called under mMutex
+    bool indexEvent(const EventItemPtr& event);               // Assigns an id if the event has none, false if the id is taken
+    bool isEventIdTaken(const quint64& eventId) const;        // By a hot or a frozen event, must be called under mMutex
+    void registerColdBlock(const ColdEventBlockPtr& block);   // Must be called under mMutex
+    void unregisterColdBlock(const ColdEventBlockPtr& block); // Must be called under mMutex
+    bool insertEvent(const quint64& taskId, const EventItemPtr& event);   // Must be called under mMutex
+    void insertInfoMark(const InfoMark& mark);
+    void removeInfoMarks(const QVector<EventItemPtr>& events);
+    void eraseTask(const TaskItemPtr& task);                  // Must be called under mMutex
+    void indexTask(const TaskItemPtr& task);                  // Updates the task's purge time, must be called under mMutex
+    void unindexTask(const TaskItemPtr& task);                // Must be called under mMutex
+    void compactBucket(TaskBucket& bucket);                   // Drops the holes of erased tasks
+    int removeColdTaskEvents(const TaskItemPtr& task, const qint64& startTime, const qint64& endTime);   // Must be called under mMutex
+    QVector<EventItemPtr> removeTaskEvents(const TaskItemPtr& task, const qint64& startTime,
+                                           const qint64& endTime);                    // One slice, must be called under mMutex
+
+private:
+    typedef std::pair<const quint64, EventItemPtr> EventIndexNode;
+    typedef std::unordered_map<quint64, EventItemPtr, std::hash<quint64>, std::equal_to<quint64>,
+                               TimeLineSlabAllocator<EventIndexNode>> EventIndex;
+
+    TimeLineSlabArenaPtr mSlabArena;                          // Must outlive the indices below
     QHash<quint64, TaskItemPtr> mTasks;                       // All added tasks
+    QHash<TimeLineTaskType, TaskBucket> mTaskBuckets;         // The same tasks bucketed by type
+    QMultiMap<qint64, quint64> mTasksByPurgeTime;             // Task ids by the earliest event start, finished tasks without events by the end. Lets purgeBefore() visit only the tasks it changes
+    EventIndex mEventsById;                                   // Hot events by id, the nodes are in the arena
+    QMultiMap<quint64, ColdEventBlockPtr> mColdBlocksByMaxId; // Cold blocks of all tasks by their max event id, they keep the frozen ids taken
+    quint64 mNextEventId;                                     // Next id to try for events added without one
+    qint64 mCoalescingGap;                                    // usec, -1 - off
+    TimeLineColdCachePtr mColdCache;                          // Shared by all tasks
+    TimeLineStringPoolPtr mStringPool;                        // Task names and event payloads, shared by all tasks
+    qint64 mColdHistoryAge;                                   // usec, -1 - off
+    QTimer* mFreezeTimer;
+    QMultiMap<qint64, InfoMark> mInfoMarks;                   // Info marks of all tasks by time, inserted and removed in log n
     QMutex mMutex;
+
+    //change notification
+    QList<TimeLineTaskType> mDirtyTypes;                      // Types changed since the last notification
+    qint64 mDirtyStartTime;                                   // usec since epoch
+    qint64 mDirtyEndTime;
+    bool mFlushPending;
+    std::atomic<quint64> mRevision;
+    std::atomic<quint64> mTaskSetRevision;
+
+    static const int mRemovalSliceSize = 4096;               // Events removed per lock, so that painting isn't blocked by big purges
+    static const int mFreezeInterval = 60 * 1000;             // msec between freezing passes
+
+    static const qint64 mUnboundedStartTime = std::numeric_limits<qint64>::min();
+    static const qint64 mUnboundedEndTime = std::numeric_limits<qint64>::max();
+
+    private slots:
+    void flushChanges();
+    void onFreezeTimer();
+
+signals:
+    void changed(QList<TimeLineTaskType> taskTypes, qint64 startTime, qint64 endTime);  // [startTime, endTime), usec since epoch, min() and max() - unbounded
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineSharedFeed          //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Live events from a collector process through a shared memory ring of fixed size records.
+* The collector writes with TimeLineSharedFeedWriter, nothing is locked or serialized on the way:
+* records are read in place and taken into the storage in batches. Every record has a sequence
+* number, records the collector overwrote before they were read are counted as lost
+*/
+
+class TimeLineSharedFeed : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int mMaxPayloadSize = 82;                   // UTF-8 bytes, longer payloads are cut
+
+    struct Record                                             // One event as the collector wrote it
+    {
+        quint64 taskId;
+        quint64 eventId;                                      // 0 - assigned by the storage
+        qint64 startTime;                                     // usec since epoch
+        qint64 endTime;
+        quint32 status;                                       // EventItem::EventStatus
+        quint16 payloadSize;
+        char payload[mMaxPayloadSize];                        // Interned into the storage's string pool
+    };
+
+    struct Slot
+    {
+        std::atomic<quint64> sequence;                        // Sequence number of the record, mSlotWriting while it's being written
+        Record record;
+    };
+
+    struct Header                                             // At the start of the shared memory, followed by the slots
+    {
+        quint32 magic;
+        quint32 version;
+        quint32 slotSize;
+        quint32 capacity;                                     // Slots, a power of 2
+        std::atomic<quint64> writeSequence;                   // Number of records published so far
+    };
+
+    static const quint32 mMagic = 0x544c4645;                 // "TLFE"
+    static const quint32 mVersion = 1;
+    static const quint64 mSlotWriting = std::numeric_limits<quint64>::max();
+
+private:
+    TaskStoragePtr mTaskStorage;
+    QSharedMemory mSharedMemory;
+    const Header* mHeader;
+    const Slot* mSlots;
+    quint64 mNextSequence;                                    // Next record to take
+    quint64 mReceivedCount;
+    quint64 mLostCount;
+    int mBatchSize;                                           // Records taken per poll
+    int mPollInterval;                                        // msec
+    QTimer* mPollTimer;
+
+public:
+    TimeLineSharedFeed(TaskStoragePtr taskStorage, QObject* parent = 0);
+    ~TimeLineSharedFeed();
+
+    //setters
+    bool attach(const QString& key);                          // False if there is no valid feed with the key. Reading starts at the oldest record in the ring
+    void detach();
+    void setBatchSize(const int& batchSize);                  // 4096 by default
+    void start(const int& pollInterval = 10);                 // msec
+    void stop();
+    int poll();                                               // Takes a batch into the storage. Returns the number of records taken
+
+    //getters
+    bool isAttached() const;
+    quint64 getNextSequence() const;
+    quint64 getReceivedCount() const;                         // Records added to the storage
+    quint64 getLostCount() const;
+
+    static int sharedMemorySize(const quint32& capacity);
+
+    private slots:
+    void onPollTimer();
+
+signals:
+    void recordsLost(quint64 count);                          // Overwritten before they were read
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////          TimeLineSharedFeedWriter       //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* The collector's end of TimeLineSharedFeed. Creates the ring and publishes records into it.
+* A single writer per ring, it never waits for the readers
+*/
+
+class TimeLineSharedFeedWriter
+{
+private:
+    QSharedMemory mSharedMemory;
+    TimeLineSharedFeed::Header* mHeader;
+    TimeLineSharedFeed::Slot* mSlots;
+    quint64 mNextSequence;
+
+public:
+    TimeLineSharedFeedWriter();
+
+    //setters
+    bool create(const QString& key, const quint32& capacity = 65536);         // The capacity is rounded up to a power of 2
+    quint64 write(const quint64& taskId,
+                  const qint64& startTime,
+                  const qint64& endTime,
+                  const EventItem::EventStatus& status,
+                  const quint64& eventId = 0,
+                  const QByteArray& payload = QByteArray());                 // usec since epoch. Returns the sequence number of the record
+
+    //getters
+    bool isCreated() const;
+    quint64 getNextSequence() const;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineSpanKernel          //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Converts blocks of [start, end) time spans to pixel spans: clips them to the visible range,
+* subtracts its start, scales and rounds. Spans left empty after clipping are dropped.
+* The instruction set is chosen once at runtime, plain C++ is used if neither AVX2 nor SSE4.2 is there
+* or the visible range is 2^52 usec or longer
+*/
+
+class TimeLineSpanKernel
+{
+public:
+    enum InstructionSet
+    {
+        INSTRUCTION_SET_SCALAR,
+        INSTRUCTION_SET_SSE4,
+        INSTRUCTION_SET_AVX2
+    };
+
+    static InstructionSet instructionSet();
+
+    // Output arrays must have room for count values. Returns the number of visible spans,
+    // indices are the positions of the visible spans in the input arrays
+    static int transform(const qint64* startTimes, const qint64* endTimes, const int& count,
+                         const qint64& visibleStartTime, const qint64& visibleEndTime, const double& pixelsPerUSec,
+                         qint32* startPositions, qint32* widths, qint32* indices);
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineRasterizer          //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Paints the items' rounded rects straight into premultiplied ARGB32 images, the same shape
+* QPainter gives for a filled and outlined QPainterPath::addRoundedRect. Full coverage spans are
+* blended with SIMD, edges and corners take their coverage from masks calculated once per shape size
+*/
+
+class TimeLineRasterizer
+{
+private:
+    struct CoverageMask                                       // Coverage of a shape compressed to it's corners, 0-255
+    {
+        int width;
+        int height;
+        QVector<quint8> coverage;
+
+        CoverageMask(const int& maskWidth = 0, const int& maskHeight = 0) :
+                     width(maskWidth),
+                     height(maskHeight),
+                     coverage(maskWidth * maskHeight){}
+    };
+
+    QHash<quint64, CoverageMask> mCoverageMasks;              // By width, height and doubled corner radii
+
+    static const int mMaskSamples = 16;                       // Subsamples per pixel side
+    static const int mMaxCoverageMasks = 1024;
+
+private:
+    const CoverageMask& getCoverageMask(const int& width, const int& height, const int& radiusX2, const int& radiusY2);
+    static void blendSpan(quint32* pixels, const int& count, const QRgb& color, const quint8& coverage);
+
+public:
+    static bool canRasterize(const QImage& image);
+    static void fillSpan(quint32* pixels, const int& count, const QRgb& color);     // Source over, full coverage
+
+    void fillRoundedRect(QImage& image, const QRect& rect, const qreal& radius, const QRgb& color);   // color is premultiplied
+    static void fillRect(QImage& image, const QRect& rect, const QRgb& color);                        // Without the outline and antialiasing
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -342,6 +1278,60 @@ private:
                    rect(itemRect){}
     };
 
+    struct LayoutParams                                       // Everything the layout depends on, so it can run off the GUI thread
+    {
+        qint64 centralTime;                                   // usec since epoch
+        qint64 timeDelta;                                     // usec
+        QSizeF size;
+        qint64 visibleRangeStartTime;
+        qint64 visibleRangeEndTime;
+        double pixelsPerUSec;
+        qreal height;
+        quint32 distBetweenAxis;
+        quint32 taskHeight;
+        quint32 eventHeight;
+        quint32 rowHeight;                                    // Swimlane row height, 0 - one axis per task type
+        qreal lanesTop;                                       // Top of the swimlane viewport
+        qreal verticalOffset;                                 // Height of the swimlane rows scrolled out above the viewport
+        int firstRow;                                         // Swimlane rows intersecting the viewport
+        int lastRow;                                          // Exclusive
+        QVector<TaskStylePtr> itemStyles;
+        QVector<TimeLineTaskType> itemTypes;
+        QVector<int> itemTypeSlots;
+        qint64 eventsVisibleScale;
+        quint32 parallelLayoutThreshold;
+        quint64 configRevision;                               // Item types and settings version
+        bool coarse;                                          // Event blocks are laid out as single bars, frozen ones are not decoded
+        quint32 coarseLayoutBudget;                           // msec, past it a coarse layout adds no more events
+        std::shared_ptr<std::atomic<bool>> cancelled;         // Set when the layout isn't needed anymore, may be null
+    };
+
+    struct LayoutResult
+    {
+        QList<VisibleItem> visibleItems;
+        QMap<int, TaskStylePtr> infoMarks;
+        QVector<TaskItemPtr> rows;                            // Tasks of the swimlane rows from LayoutParams::firstRow
+        int rowCount;                                         // Total number of swimlane rows
+        quint64 storageRevision;                              // Storage revision the layout was made for
+
+        LayoutResult() : rowCount(0), storageRevision(0) {}
+    };
+
+    struct LayoutBuffer                                       // Filled by a single layout worker
+    {
+        QList<VisibleItem> visibleItems;
+        QVector<qint32> spanPositions;                        // TimeLineSpanKernel output for a single event block
+        QVector<qint32> spanWidths;
+        QVector<qint32> spanIndices;
+        QElapsedTimer layoutTimer;                            // For the coarse layout budget
+        int firstTask;
+        int lastTask;                                         // Exclusive
+
+        LayoutBuffer(const int& first = 0, const int& last = 0) :
+                     firstTask(first),
+                     lastTask(last){}
+    };
+
 public:
     struct TimeLineItemsStyle
     {
@@ -369,53 +1359,134 @@ public:
 
     struct TimeLineItemsSettings
     {
-        quint64 eventsVisibleScale;					          // Minimum scale at which events are still visible. Default - 20 мин
+        qint64 eventsVisibleScale;					          // Minimum scale at which events are still visible, usec. Default - 20 мин
         double infoHeightPortion;                             // Icon area height / total item painting area height. Default - 0.25
         double taskHeightPortion;                             // Task item height / Distance between axis.  Default - 0.25
         double eventsHeightPortion;                           // Event item height / Distance between axis.  Default - 0.5
-
-        TimeLineItemsSettings(const quint64& eventsShowedScale = 1000 * 60 * 10 * 2, //20 min
+        quint32 parallelLayoutThreshold;                      // Number of tasks from which the layout is split across the thread pool, 0 - never. Default - 512
+        bool fastRasterization;                               // Paint items with TimeLineRasterizer instead of QPainter paths. Default - false
+        quint32 swimlaneRowHeight;                            // A row of this height per task, scrolled vertically. 0 - one axis per task type, the height is split evenly. Default - 0
+        quint32 swimlaneHeaderWidth;                          // Width of the row headers showing task names in the swimlane mode. Default - 120
+        bool progressiveRendering;                            // While the view moves, items are laid out coarsely and refined when it stops. Default - true
+        quint32 refinementDelay;                              // View changes closer than that are a motion, msec. Default - 150
+        quint32 coarseLayoutBudget;                           // Time a coarse layout may spend on events, msec. Default - 4
+
+        TimeLineItemsSettings(const qint64& eventsShowedScale = 20 * TimeLineTime::minute,
                              const double& infoAreaHeightPortion = 0.25,
                              const double& taskHeightToAxisDeltaPortion = 0.25,
-                             const double& eventHeightToAxisDeltaPortion = 0.75) :
+                             const double& eventHeightToAxisDeltaPortion = 0.75,
+                             const quint32& parallelLayoutTaskThreshold = 512,
+                             const bool& useFastRasterization = false,
+                             const quint32& rowHeight = 0,
+                             const quint32& rowHeaderWidth = 120,
+                             const bool& useProgressiveRendering = true,
+                             const quint32& motionRefinementDelay = 150,
+                             const quint32& coarseLayoutTimeBudget = 4) :
                              eventsVisibleScale(eventsShowedScale),
                              infoHeightPortion(infoAreaHeightPortion),
                              taskHeightPortion(taskHeightToAxisDeltaPortion),
-                             eventsHeightPortion(eventHeightToAxisDeltaPortion) {}
+                             eventsHeightPortion(eventHeightToAxisDeltaPortion),
+                             parallelLayoutThreshold(parallelLayoutTaskThreshold),
+                             fastRasterization(useFastRasterization),
+                             swimlaneRowHeight(rowHeight),
+                             swimlaneHeaderWidth(rowHeaderWidth),
+                             progressiveRendering(useProgressiveRendering),
+                             refinementDelay(motionRefinementDelay),
+                             coarseLayoutBudget(coarseLayoutTimeBudget) {}
     };
 
 private:
     TaskStoragePtr mTaskStorage;
     QList<VisibleItem> mVisibleItems;                         // Currently visible objects
     QMap<int, TaskStylePtr> mInfoMarks;			              // Info icons and their styles
-    QHash<TimeLineTaskType, TaskStylePtr> mItemStyles;        // Task styles */
+    QVector<TaskStylePtr> mItemStyles;                        // Task styles indexed by type slot, the slot is also the axis number
+    QVector<TimeLineTaskType> mItemTypes;                     // Registered types indexed by type slot
+    QVector<int> mItemTypeSlots;                              // Type slots indexed by TimeLineTaskType, -1 - not registered
     TimeLineItemPtr mSelectedItem;                            // Currently selected object
-    QDateTime mCentralTime;
-    quint64 mTimeDelta;                                       // Current scale - number of msec form the center to any border*/
+    qint64 mCentralTime;                                      // usec since epoch
+    qint64 mTimeDelta;                                        // Current scale - number of usec form the center to any border*/
     QSizeF mSize;                                             // Current area size */
+    qreal mVerticalOffset;                                    // Swimlane scrolling, height of the rows above the viewport
+    int mRowCount;                                            // Swimlane rows as of the last layout
+    int mFirstVisibleRow;
+    QVector<TaskItemPtr> mVisibleRows;                        // Tasks of the swimlane rows from mFirstVisibleRow
 
     TimeLineItemsStyle mStyle;
     TimeLineItemsSettings mSettings;
 
+    TimeLineMetricsPtr mMetrics;
+    bool mLayoutDirty;                                        // Visible items are out of date, paints in between reuse them
+    quint64 mLayoutConfigRevision;                            // Incremented when item types or settings change
+
+    QFuture<LayoutResult> mPrefetchedLayout;                  // Layout of a predicted view, calculated by the thread pool
+    LayoutParams mPrefetchedParams;
+    bool mPrefetchPending;                                    // mPrefetchedLayout hasn't been taken yet
+
+    QElapsedTimer mViewChangeTimer;                           // Time since the view was last moved
+    bool mViewMoving;                                         // The last view change came soon after the previous one
+    bool mLayoutCoarse;                                       // The visible items come from a coarse layout
+    QFuture<LayoutResult> mRefinedLayout;                     // Full layout of the current view, calculated by the thread pool
+    LayoutParams mRefinedParams;
+    bool mRefinementPending;                                  // mRefinedLayout hasn't been taken yet
+
+    TimeLineRasterizer mRasterizer;
+    QImage mItemsLayer;                                       // Items are rasterized here and then drawn at once
+    TimeLineQualityGovernor::QualityLevel mQualityLevel;
+
+    static const int mMinTasksPerLayoutChunk = 64;
+
 private:
     void calculateVisibleItems();
+    LayoutParams layoutParams(const qint64& centralTime, const qint64& timeDelta) const;
+    bool takePrefetchedLayout(const LayoutParams& params, LayoutResult& result);     // False if there is no finished valid prefetched layout for the params, doesn't wait
+    void cancelPrefetch();
+    void applyLayout(const LayoutParams& params, LayoutResult& result);
+    void cancelRefinement();
+    static bool isSameView(const LayoutParams& first, const LayoutParams& second);
+    static QFuture<LayoutResult> startLayout(const TaskStoragePtr& taskStorage, const LayoutParams& params);   // On the thread pool
+    static void calculateLayout(const TaskStoragePtr& taskStorage, const LayoutParams& params,
+                                LayoutResult& result, TimeLineMetrics::FrameStats* frameStats);
+    static void layoutTasks(const QVector<TaskItemPtr>& tasks, const LayoutParams& params, LayoutBuffer& buffer);
+    static void layoutEventBlock(const EventBlock& block, const qint64& searchStartTime, const TaskStylePtr& style,
+                                 const LayoutParams& params, const qint32& axisYPos, const bool& splitRuns, LayoutBuffer& buffer);
+    static void layoutRun(const EventItemPtr& run, const TaskStylePtr& style, const LayoutParams& params,
+                          const qint32& axisYPos, LayoutBuffer& buffer);       // A run split at it's gaps
+    static void layoutBlockSummary(const TaskItemPtr& task, const qint64& startTime, const qint64& endTime, const TaskStylePtr& style,
+                                   const LayoutParams& params, const qint32& axisYPos, LayoutBuffer& buffer);   // A coarse bar over a block
     void paintVisibleItems(QPainter* painter);
+    bool rasterizeVisibleItems(QPainter* painter);            // False if the items can't be rasterized, e.g. the painter is scaled
     void drawAxis(const quint16& resultAreaHeight, QPainter* painter);
+    void drawRowHeaders(const quint16& resultAreaHeight, QPainter* painter);   // Swimlane mode
+    qreal getMaxVerticalOffset() const;
     void paintIcons(const quint16& resultAreaHeight, QPainter* painter);
+    int getItemTypeSlot(const TimeLineTaskType& type) const;
+    static int getItemTypeSlot(const QVector<int>& itemTypeSlots, const TimeLineTaskType& type);
 
 public:
     TimeLineItems(TaskStoragePtr tasks, QGraphicsItem * parent = 0);
 
     //setters
     void addItemType(const TimeLineTaskType type, const TaskStyle& style);
-    void setTime(const QDateTime& centralTime, const quint64& timeDelta);
+    void setTime(const qint64& centralTime, const qint64& timeDelta);                 // usec
     void setSize(const QSizeF& size, const QPointF& pos);
     void setSelectedItem(const TimeLineItemPtr item);
+    void setSelectedEvent(const quint64& eventId);           // Null selection if there is no such event
+    void invalidateLayout();                                  // The layout is recalculated on the next paint
+    void prefetchLayout(const qint64& centralTime, const qint64& timeDelta);          // Lays out a predicted view in the background, used if the view gets there
+    bool refineLayout();                                      // Replaces a coarse layout by the full one made in the background. False until it's done, call again
     void setSettings(const TimeLineItemsSettings& settings);
     void setStyle(const TimeLineItemsStyle& style);
+    void setMetrics(TimeLineMetricsPtr metrics);
+    void setVerticalOffset(const qreal& offset);              // Swimlane scrolling, clamped to the rows
+    void setQualityLevel(const TimeLineQualityGovernor::QualityLevel& level);
 
     //getters
     QList<TimeLineItemPtr> getItemUnderPos(QPoint& pos);     // Retrieve the list of objects under the pos
+    bool hasItemType(const TimeLineTaskType& type) const;
+    bool isSwimlaneMode() const;
+    qreal getVerticalOffset() const;
+    bool isLayoutCoarse() const;                              // A refineLayout() is due
+    TimeLineQualityGovernor::QualityLevel getQualityLevel() const;
     TimeLineItemsSettings getSettings() const;
     TimeLineItemsStyle getStyle() const;
 
@@ -436,26 +1507,35 @@ class SphereTimeLineScaler : public QObject
 {
     Q_OBJECT
 
-    QTimeLine* mZoomingTimeLine;                       // Updates the scale when zooming
+    TimeLineAnimationDriver* mAnimationDriver;         // Ticks the zooming
     int mScheduledScaling;                             // Planned elementary zooming actions
-    static const int mDefaultScale = 600000;           // Default scale - 10 MINUTES
+    static const qint64 mDefaultScale = 10 * TimeLineTime::minute;     // Default scale, usec
 
     double mZoomStepRelaxationCoeff;                   // Elementary scaling coefficient
     quint16 mZoomStepTime;                             // Scaling time
     quint16 mElementalZoomTime;                        // Elementary scaling time
 
+    bool mIsScaling;
+    qint64 mZoomStepStartTime;                         // Animation clock time the current zooming action started at
+    qint64 mLastTickTime;                              // Animation clock time the scale was last updated for
+
+private:
+    double zoomRate() const;                           // ln(scale factor) per msec
+
 public:
-    SphereTimeLineScaler(QObject* parent = 0);
+    SphereTimeLineScaler(TimeLineAnimationDriver* animationDriver, QObject* parent = 0);
 
     void setZoomStepTime(const quint64& zoomStepTime);
     void setElementalZoomTime(const quint64& elementalZoomTime);
 
-    quint64 getDefaultScale() const;
+    qint64 getDefaultScale() const;
     quint64 getZoomStepTime() const;
     quint64 getElementalZoomTime() const;
+    bool scalingIsOngoing() const;
+    qreal getRemainingScale() const;                    // Scale factor the planned zooming actions are still going to apply
 
     private slots:
-    void onUpdateScale(qreal);                          // Elementary scale update when zooming
+    void onTick(qint64 time);                           // Scale update for the animation clock time
     void scalingFinished();
 
     public slots:
@@ -478,22 +1558,26 @@ class SphereTimeLineScroller : public QObject
 {
     Q_OBJECT
 
-    QTimeLine* mScrollingTimeLine;                        // Updates the current position when scrolling
+    TimeLineAnimationDriver* mAnimationDriver;            // Ticks the scrolling
     bool mDragIsOngoing;
+    bool mIsScrolling;
 
     int mMouseDragDistance;                               // Mouse move distance with left button being pressed
     QDateTime mLastMouseTrack;                            // Moving start time
     double mInitialVelocity;                              // Scrolling start speed
     double mFrictionCoeff;
-    double mMsecPerPixel;                                 // Scale - msec/px
-    QDateTime mScrollStartTime;                           // Scrolling start pos
+    double mUsecPerPixel;                                 // Scale - usec/px
+    qint64 mScrollStartTime;                              // Scrolling start pos, usec since epoch
+    qint64 mScrollStartClockTime;                         // Animation clock time the scrolling started at
+    qint64 mScrollDuration;                               // msec until the scrolling stops
 
     static const int mFreeFallAcceleration = 10;
-    static const int mElementalScrollTime = 25;           // Elementary scrolling period - 25 msec
-    static const int mTotalElementalScrollDuration = 350; // msec
+
+private:
+    qint64 scrollPosition(const qint64& elapsedTime) const;       // Central time after elapsedTime msec of scrolling, usec
 
 public:
-    SphereTimeLineScroller(QObject* parent = 0);
+    SphereTimeLineScroller(TimeLineAnimationDriver* animationDriver, QObject* parent = 0);
 
     //setters
     void setFrictionCoefficient(const double& coeff);
@@ -505,17 +1589,18 @@ public:
     double getFrictionCoefficient() const;
     bool dragIsOngoing() const;
     bool scalingIsOngoing() const;
+    qint64 getScrollDestination() const;                  // Central time the scrolling will stop at, TimeLineTime::mInvalidTime if not scrolling
 
     private slots:
-    void onUpdateScroll(qreal);
+    void onTick(qint64 time);                             // Position update for the animation clock time
     void onScrollFinished();
 
     public slots:
-    void startScrolling(const QDateTime startTime, const double msecPerPixel);
+    void startScrolling(const qint64 startTime, const double usecPerPixel);
     void stopScrolling();
 
 signals:
-    void scroll(QDateTime newCentralTime);
+    void scroll(qint64 newCentralTime);                   // usec since epoch
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -534,6 +1619,80 @@ struct TaskStyle
              infoIconPath(iconPath){}
 };
 
+//////////////////////////////////////////////////////////////////////////////
+///////////////         TimeLineFrameScheduler          //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Collects repaint requests from all the sources and turns them into
+* at most one frame per frame interval
+*/
+
+class TimeLineFrameScheduler : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTimer* mFrameTimer;                                 // Single shot, fires when the next frame is allowed
+    QElapsedTimer mLastFrameTimer;                       // Time passed since the last frame
+    quint32 mMaxFrameRate;                               // Frames per second, 0 - no limit
+
+public:
+    TimeLineFrameScheduler(const quint32& maxFrameRate = 60, QObject* parent = 0);
+
+    //setters
+    void setMaxFrameRate(const quint32& maxFrameRate);
+
+    //getters
+    quint32 getMaxFrameRate() const;
+    bool isFramePending() const;
+
+    public slots:
+    void requestFrame();                                 // Any number of requests until the next frame results in a single frame
+
+    private slots:
+    void onFrameTimer();
+
+signals:
+    void frame();
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////         TimeLineAnimationDriver         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Ticks all the animations of a widget on the frames of it's frame scheduler.
+* The clock is sampled once per frame, an animation requests the next tick while it runs,
+* so nothing wakes up when there is nothing to animate
+*/
+
+class TimeLineAnimationDriver : public QObject
+{
+    Q_OBJECT
+
+private:
+    TimeLineFrameScheduler* mFrameScheduler;
+    QElapsedTimer mClock;                                // Monotonic animation clock
+    bool mTickRequested;
+
+public:
+    TimeLineAnimationDriver(TimeLineFrameScheduler* frameScheduler, QObject* parent = 0);
+
+    //setters
+    void requestTick();                                  // The next frame will emit tick()
+
+    //getters
+    qint64 now() const;                                  // msec since the driver was created
+    bool isTickRequested() const;
+
+    private slots:
+    void onFrame();
+
+signals:
+    void tick(qint64 time);                              // Animation clock time of the frame
+};
+
 //////////////////////////////////////////////////////////////////////////////
 ///////////////             TimeLineWidget              //////////////////////
 //////////////////////////////////////////////////////////////////////////////
@@ -557,9 +1716,19 @@ public:
     {
         TimeLineGrid::TimeLineGridSettings gridSettings;
         TimeLineItems::TimeLineItemsSettings itemsSettings;
+        quint32 maxFrameRate;                            // Repaint rate cap, 0 - no limit. Default - 60
+        double frameTimeBudget;                          // Paint time the quality is lowered to keep within, msec, 0 - always full quality. Default - 0
+
+        TimeLineSettings(const quint32& frameRateLimit = 60,
+                         const double& paintTimeBudget = 0) :
+                        maxFrameRate(frameRateLimit),
+                        frameTimeBudget(paintTimeBudget){}
     };
 
 private:
+    TaskStoragePtr mTaskStorage;
+    quint64 mTaskSetRevision;                            // Of the storage as of the last change notification
+
     //graphics
     TimeLineGrid* mGrid;
     TimeLineItems* mItems;
@@ -567,9 +1736,20 @@ private:
     QGraphicsProxyWidget* mRealTimeButtonProxy;
     SphereTimeLineScaler* mScaler;
     SphereTimeLineScroller* mScroller;
+    TimeLineFrameScheduler* mFrameScheduler;             // The only source of viewport repaints
+    TimeLineAnimationDriver* mAnimationDriver;           // Shared by the scaler and the scroller
+    qint64 mZoomTargetDelta;                             // Time delta the zooming is predicted to end at, usec, 0 - not zooming
+    QRegion mDirtyRegion;                                // Viewport parts changed since the last frame
 
     //timing
     QTimer* mUpdateTimer;                                // Updates timeline every second
+    QTimer* mRefinementTimer;                            // Single shot, refines a coarse layout once the view stays still
+    TimeLineMetricsPtr mMetrics;                         // Frame statistics shared with the grid and the items
+    TimeLineQualityGovernor mQualityGovernor;            // Fed with the frame times
+    QTimer* mQualityRestoreTimer;                        // Single shot, brings the full quality back once the view stays still
+
+    static const int mRefinementPollInterval = 16;       // msec, while the full layout is being made
+    static const int mQualityRestoreDelay = 500;         // msec without frames after which a lowered quality is restored
 
 private:
     void rearrangeWidgets(QSize size);
@@ -583,15 +1763,26 @@ public:
 
     TimeLineStyle getStyle() const;
     TimeLineSettings getSettings() const;
+    const TimeLineMetrics& metrics() const;
+    bool isMetricsOverlayVisible() const;
 
     public slots:
     void addItemType(const TimeLineTaskType type, const TaskStyle& style);
+    void setMetricsOverlayVisible(bool visible);          // Frame statistics overlay, off by default
+    void resetMetrics();
     void setScale(qreal factor);                          // Change timeline scale. Calculated as follows: current time delta / factor
     void setCentralTime(QDateTime time);                  // Central time mark change
+    void setSelectedEvent(quint64 eventId);
 
     private slots:
     void onUpdateTimeLine();                               // Called by mUpdateTimer
     void setRealTime();
+    void onScroll(qint64 centralTime);                     // usec since epoch
+    void onStorageChanged(QList<TimeLineTaskType> taskTypes, qint64 startTime, qint64 endTime);
+    void onSceneChanged(const QList<QRectF>& region);
+    void onFrame();
+    void onRefineLayout();                                 // Called by mRefinementTimer
+    void onRestoreQuality();                               // Called by mQualityRestoreTimer
 
 protected:
     void mouseMoveEvent(QMouseEvent* event);
@@ -599,10 +1790,58 @@ protected:
     void mouseReleaseEvent(QMouseEvent* event);
     void wheelEvent(QWheelEvent * event);
     void resizeEvent(QResizeEvent * event);
+    void paintEvent(QPaintEvent * event);
 
 signals:
-    void eventClicked(quint64 taskId, QDateTime startTime);  // Item selection signal
+    void eventClicked(quint64 eventId);                   // Item selection signal
     void rangeChanged(QDateTime startTime, QDateTime endTime);
 };
 
+//////////////////////////////////////////////////////////////////////////////
+///////////////             TimeLineRenderer            //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Paints the timeline into images without a view and an event loop, e.g. for reports.
+* Every call creates its own grid and items, so it's safe to render from several threads at once
+*/
+
+class TimeLineRenderer
+{
+public:
+    struct RenderStyle
+    {
+        TimeLineWidget::TimeLineStyle style;
+        TimeLineWidget::TimeLineSettings settings;
+        QList<QPair<TimeLineTaskType, TaskStyle>> itemTypes;     // Axis styles, the same as passed to TimeLineWidget::addItemType()
+        QColor backgroundColor;                                  // Image background. Default - Qt::white
+
+        RenderStyle(const QColor& imageBackgroundColor = Qt::white) :
+                    backgroundColor(imageBackgroundColor) {}
+    };
+
+    typedef std::function<void(const QImage& tile, const QRect& tileRect)> TileHandler;
+
+private:
+    static const int mTileMargin = 128;                          // Painted around every tile, so that items and texts are not cut at the seams
+
+private:
+    static void paint(TaskStoragePtr storage, const qint64& startTime, const qint64& endTime,
+                      const RenderStyle& style, const QSize& size, QPainter* painter);      // usec since epoch
+
+public:
+    static QImage render(TaskStoragePtr storage, const QPair<QDateTime, QDateTime>& range,
+                         const QSize& size, const RenderStyle& style);
+    static QImage render(TaskStoragePtr storage, const qint64& startTime, const qint64& endTime,
+                         const QSize& size, const RenderStyle& style);                          // usec since epoch
+
+    // Splits an image too wide for a single QImage into tiles, which are passed to the handler from left to right
+    static bool renderTiled(TaskStoragePtr storage, const QPair<QDateTime, QDateTime>& range,
+                            const QSize& size, const RenderStyle& style,
+                            const int& tileWidth, TileHandler handler);
+    static bool renderTiled(TaskStoragePtr storage, const qint64& startTime, const qint64& endTime,
+                            const QSize& size, const RenderStyle& style,
+                            const int& tileWidth, TileHandler handler);                        // usec since epoch
+};
+
 #endif // TIMELINE_H
@@ -0,0 +1,533 @@
+#include "timelinestream.h"
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////            TimeLineStreamServer         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+static const int streamReadBufferSize = 256 * 1024;          // Holds several messages of the maximum size
+static const int streamMaxCachedPayloads = 4096;
+
+const int TimeLineStreamServer::mLengthSize;
+const int TimeLineStreamServer::mTaskSize;
+const int TimeLineStreamServer::mEventSize;
+const int TimeLineStreamServer::mSyncSize;
+const int TimeLineStreamServer::mSyncReplySize;
+const int TimeLineStreamServer::mMaxMessageSize;
+
+TimeLineStreamServer::TimeLineStreamServer(TaskStoragePtr taskStorage, QObject* parent) :
+                                           QObject(parent),
+                                           mTaskStorage(taskStorage),
+                                           mBatchSize(8192),
+                                           mReceivedTasks(0),
+                                           mReceivedEvents(0),
+                                           mProtocolErrors(0)
+{
+    Q_ASSERT(mTaskStorage != nullptr);
+
+    mServer = new QLocalServer(this);
+    connect(mServer, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+
+    mEventBatch.reserve(mBatchSize);
+}
+
+TimeLineStreamServer::~TimeLineStreamServer()
+{
+    close();
+}
+
+bool TimeLineStreamServer::listen(const QString& name)
+{
+    close();
+
+    // A server that crashed leaves its socket file behind on Unix
+    QLocalServer::removeServer(name);
+    return mServer->listen(name);
+}
+
+void TimeLineStreamServer::close()
+{
+    mServer->close();
+
+    QList<QLocalSocket*> sockets = mConnections.keys();
+    mConnections.clear();
+
+    for (QLocalSocket* socket : sockets)
+    {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+    }
+
+    flushEvents();
+}
+
+void TimeLineStreamServer::setBatchSize(const int& batchSize)
+{
+    Q_ASSERT(batchSize > 0);
+    mBatchSize = std::max(batchSize, 1);
+    mEventBatch.reserve(mBatchSize);
+}
+
+int TimeLineStreamServer::parse(Connection& connection)
+{
+    const uchar* data = reinterpret_cast<const uchar*>(connection.buffer.constData());
+    int position = 0;
+
+    while (connection.bufferedSize - position >= mLengthSize)
+    {
+        quint32 length = qFromLittleEndian<quint32>(data + position);
+        if (length == 0 || length > (quint32)mMaxMessageSize){
+            return -1;
+        }
+
+        // The rest of the message comes with the next read
+        if (connection.bufferedSize - position - mLengthSize < (int)length){
+            break;
+        }
+
+        const uchar* message = data + position + mLengthSize;
+        bool parsed = false;
+
+        switch (message[0])
+        {
+        case MESSAGE_TASK:
+            parsed = parseTask(message, length);
+            break;
+
+        case MESSAGE_EVENT:
+            parsed = parseEvent(connection, message, length);
+            break;
+
+        case MESSAGE_SYNC:
+            parsed = parseSync(connection, length);
+            break;
+
+        default:
+            break;
+        }
+
+        if (!parsed){
+            return -1;
+        }
+
+        position += mLengthSize + length;
+    }
+
+    return position;
+}
+
+bool TimeLineStreamServer::parseTask(const uchar* data, const int& size)
+{
+    if (size < mTaskSize){
+        return false;
+    }
+
+    quint64 taskId = qFromLittleEndian<quint64>(data + 1);
+    qint64 startTime = qFromLittleEndian<qint64>(data + 9);
+    qint64 endTime = qFromLittleEndian<qint64>(data + 17);
+    quint8 flags = data[25];
+    quint32 taskType = qFromLittleEndian<quint32>(data + 26);
+    quint16 nameSize = qFromLittleEndian<quint16>(data + 30);
+
+    if (size != mTaskSize + nameSize || taskType > TL_TASK_TYPE_INVALID){
+        return false;
+    }
+
+    // Events the client sent before the task may belong to a task it replaces
+    flushEvents();
+
+    QString taskName = QString::fromUtf8(reinterpret_cast<const char*>(data + mTaskSize), nameSize);
+    mTaskStorage->addTask(mTaskStorage->createTask(startTime, endTime, taskId, flags & 1, taskName, TimeLineTaskType(taskType)));
+    ++mReceivedTasks;
+
+    return true;
+}
+
+bool TimeLineStreamServer::parseEvent(Connection& connection, const uchar* data, const int& size)
+{
+    if (size < mEventSize){
+        return false;
+    }
+
+    quint64 taskId = qFromLittleEndian<quint64>(data + 1);
+    quint64 eventId = qFromLittleEndian<quint64>(data + 9);
+    qint64 startTime = qFromLittleEndian<qint64>(data + 17);
+    qint64 endTime = qFromLittleEndian<qint64>(data + 25);
+    quint8 status = data[33];
+    quint16 payloadSize = qFromLittleEndian<quint16>(data + 34);
+
+    if (size != mEventSize + payloadSize || status > EventItem::EVENT_STATUS_INVALID){
+        return false;
+    }
+
+    EventItemPtr event = mTaskStorage->createEvent(startTime, endTime, EventItem::EventStatus(status), eventId);
+
+    if (payloadSize)
+    {
+        // Looked up without copying the bytes, only a payload seen for the first time is copied and interned.
+        // setRawData() repoints the key's header after the first call, so the lookup allocates nothing
+        const char* payload = reinterpret_cast<const char*>(data + mEventSize);
+        connection.payloadKey.setRawData(payload, payloadSize);
+        quint32 payloadId = connection.payloadIds.value(connection.payloadKey, 0);
+
+        if (payloadId == 0)
+        {
+            if (connection.payloadIds.size() >= streamMaxCachedPayloads){
+                connection.payloadIds.clear();
+            }
+
+            payloadId = mTaskStorage->internString(QString::fromUtf8(payload, payloadSize));
+            connection.payloadIds.insert(QByteArray(payload, payloadSize), payloadId);
+        }
+
+        event->setPayloadId(payloadId);
+    }
+
+    mEventBatch.append(qMakePair(taskId, event));
+    ++connection.receivedEvents;
+    ++mReceivedEvents;
+
+    if (mEventBatch.size() >= mBatchSize){
+        flushEvents();
+    }
+
+    return true;
+}
+
+bool TimeLineStreamServer::parseSync(Connection& connection, const int& size)
+{
+    if (size != mSyncSize || connection.socket == nullptr){
+        return false;
+    }
+
+    // The client is answered only when everything it sent before is in the storage
+    flushEvents();
+
+    uchar reply[mLengthSize + mSyncReplySize];
+    qToLittleEndian<quint32>(mSyncReplySize, reply);
+    reply[mLengthSize] = MESSAGE_SYNC;
+    qToLittleEndian<quint64>(connection.receivedEvents, reply + mLengthSize + 1);
+
+    return connection.socket->write(reinterpret_cast<const char*>(reply), sizeof(reply)) == sizeof(reply);
+}
+
+void TimeLineStreamServer::flushEvents()
+{
+    if (mEventBatch.isEmpty()){
+        return;
+    }
+
+    mTaskStorage->addEvents(mEventBatch);
+
+    // Keeps the capacity for the next batch
+    mEventBatch.resize(0);
+}
+
+bool TimeLineStreamServer::isListening() const
+{
+    return mServer->isListening();
+}
+
+int TimeLineStreamServer::getConnectionCount() const
+{
+    return mConnections.size();
+}
+
+quint64 TimeLineStreamServer::getReceivedTasks() const
+{
+    return mReceivedTasks;
+}
+
+quint64 TimeLineStreamServer::getReceivedEvents() const
+{
+    return mReceivedEvents;
+}
+
+quint64 TimeLineStreamServer::getProtocolErrors() const
+{
+    return mProtocolErrors;
+}
+
+QString TimeLineStreamServer::getErrorString() const
+{
+    return mServer->errorString();
+}
+
+void TimeLineStreamServer::onNewConnection()
+{
+    while (mServer->hasPendingConnections())
+    {
+        QLocalSocket* socket = mServer->nextPendingConnection();
+        if (socket == nullptr){
+            break;
+        }
+
+        Connection& connection = mConnections[socket];
+        connection.socket = socket;
+        connection.buffer.resize(streamReadBufferSize);
+
+        connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+
+        // Data may have come before the signals were connected
+        if (socket->bytesAvailable()){
+            QMetaObject::invokeMethod(this, "onReadyRead", Qt::QueuedConnection);
+        }
+    }
+}
+
+void TimeLineStreamServer::onReadyRead()
+{
+    // Queued calls from onNewConnection() have no sender, every connection is read then
+    QList<QLocalSocket*> sockets;
+    QLocalSocket* sender = qobject_cast<QLocalSocket*>(QObject::sender());
+
+    if (sender != nullptr){
+        sockets.append(sender);
+    }
+    else{
+        sockets = mConnections.keys();
+    }
+
+    for (QLocalSocket* socket : sockets)
+    {
+        auto iter = mConnections.find(socket);
+        if (iter == mConnections.end()){
+            continue;
+        }
+
+        Connection& connection = iter.value();
+        bool failed = false;
+
+        while (true)
+        {
+            qint64 readSize = socket->read(connection.buffer.data() + connection.bufferedSize,
+                                           connection.buffer.size() - connection.bufferedSize);
+            if (readSize <= 0){
+                break;
+            }
+
+            connection.bufferedSize += readSize;
+
+            int parsedSize = parse(connection);
+            if (parsedSize < 0)
+            {
+                failed = true;
+                break;
+            }
+
+            // The start of an incomplete message is moved to the front of the buffer
+            if (parsedSize)
+            {
+                char* buffer = connection.buffer.data();
+                std::copy(buffer + parsedSize, buffer + connection.bufferedSize, buffer);
+                connection.bufferedSize -= parsedSize;
+            }
+        }
+
+        if (failed)
+        {
+            ++mProtocolErrors;
+            emit protocolError(QString("Malformed message from a stream client, disconnected"));
+
+            // Removes the connection through onDisconnected()
+            socket->abort();
+        }
+    }
+
+    flushEvents();
+}
+
+void TimeLineStreamServer::onDisconnected()
+{
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>(QObject::sender());
+    if (socket == nullptr){
+        return;
+    }
+
+    // Messages that were complete are kept, a message cut off by the disconnect is dropped
+    flushEvents();
+
+    mConnections.remove(socket);
+    socket->deleteLater();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////            TimeLineStreamClient         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static void appendLittleEndian(QByteArray& data, const T& value)
+{
+    char bytes[sizeof(T)];
+    qToLittleEndian<T>(value, bytes);
+    data.append(bytes, sizeof(T));
+}
+
+TimeLineStreamClient::TimeLineStreamClient(const int& flushSize) :
+                                           mFlushSize(std::max(flushSize, 1))
+{
+    mBuffer.reserve(mFlushSize + TimeLineStreamServer::mLengthSize + TimeLineStreamServer::mMaxMessageSize);
+}
+
+void TimeLineStreamClient::beginMessage(const int& size, const TimeLineStreamServer::MessageType& type)
+{
+    appendLittleEndian<quint32>(mBuffer, size);
+    mBuffer.append(char(type));
+}
+
+bool TimeLineStreamClient::connectToServer(const QString& name, const int& timeout)
+{
+    mSocket.connectToServer(name);
+    return mSocket.waitForConnected(timeout);
+}
+
+void TimeLineStreamClient::disconnectFromServer()
+{
+    flush();
+    mSocket.disconnectFromServer();
+}
+
+bool TimeLineStreamClient::sendTask(const quint64& taskId, const qint64& startTime, const qint64& endTime,
+                                    const bool& isInfinite, const QString& taskName, const TimeLineTaskType& taskType)
+{
+    QByteArray name = taskName.toUtf8().left(TimeLineStreamServer::mMaxMessageSize - TimeLineStreamServer::mTaskSize);
+
+    beginMessage(TimeLineStreamServer::mTaskSize + name.size(), TimeLineStreamServer::MESSAGE_TASK);
+    appendLittleEndian<quint64>(mBuffer, taskId);
+    appendLittleEndian<qint64>(mBuffer, startTime);
+    appendLittleEndian<qint64>(mBuffer, endTime);
+    mBuffer.append(char(isInfinite? 1 : 0));
+    appendLittleEndian<quint32>(mBuffer, taskType);
+    appendLittleEndian<quint16>(mBuffer, name.size());
+    mBuffer.append(name);
+
+    if (mBuffer.size() >= mFlushSize)
+    {
+        mSocket.write(mBuffer);
+        mBuffer.resize(0);
+    }
+
+    return isConnected();
+}
+
+bool TimeLineStreamClient::sendEvent(const quint64& taskId, const qint64& startTime, const qint64& endTime,
+                                     const EventItem::EventStatus& status, const quint64& eventId, const QByteArray& payload)
+{
+    int payloadSize = std::min(payload.size(), TimeLineStreamServer::mMaxMessageSize - TimeLineStreamServer::mEventSize);
+
+    beginMessage(TimeLineStreamServer::mEventSize + payloadSize, TimeLineStreamServer::MESSAGE_EVENT);
+    appendLittleEndian<quint64>(mBuffer, taskId);
+    appendLittleEndian<quint64>(mBuffer, eventId);
+    appendLittleEndian<qint64>(mBuffer, startTime);
+    appendLittleEndian<qint64>(mBuffer, endTime);
+    mBuffer.append(char(status));
+    appendLittleEndian<quint16>(mBuffer, payloadSize);
+    mBuffer.append(payload.constData(), payloadSize);
+
+    if (mBuffer.size() >= mFlushSize)
+    {
+        mSocket.write(mBuffer);
+        mBuffer.resize(0);
+
+        // Bounds what the socket holds when the server reads slower than we write
+        if (mSocket.bytesToWrite() > 16 * mFlushSize){
+            mSocket.waitForBytesWritten();
+        }
+    }
+
+    return isConnected();
+}
+
+bool TimeLineStreamClient::flush(const int& timeout)
+{
+    if (!mBuffer.isEmpty())
+    {
+        mSocket.write(mBuffer);
+        mBuffer.resize(0);
+    }
+
+    while (mSocket.bytesToWrite() > 0)
+    {
+        if (!mSocket.waitForBytesWritten(timeout)){
+            return false;
+        }
+    }
+
+    return isConnected();
+}
+
+bool TimeLineStreamClient::sync(quint64& receivedEvents, const int& timeout)
+{
+    beginMessage(TimeLineStreamServer::mSyncSize, TimeLineStreamServer::MESSAGE_SYNC);
+
+    if (!flush(timeout)){
+        return false;
+    }
+
+    const int replySize = TimeLineStreamServer::mLengthSize + TimeLineStreamServer::mSyncReplySize;
+    while (mSocket.bytesAvailable() < replySize)
+    {
+        if (!mSocket.waitForReadyRead(timeout)){
+            return false;
+        }
+    }
+
+    uchar reply[replySize];
+    if (mSocket.read(reinterpret_cast<char*>(reply), replySize) != replySize){
+        return false;
+    }
+
+    if (qFromLittleEndian<quint32>(reply) != (quint32)TimeLineStreamServer::mSyncReplySize ||
+        reply[TimeLineStreamServer::mLengthSize] != TimeLineStreamServer::MESSAGE_SYNC){
+        return false;
+    }
+
+    receivedEvents = qFromLittleEndian<quint64>(reply + TimeLineStreamServer::mLengthSize + 1);
+    return true;
+}
+
+bool TimeLineStreamClient::isConnected() const
+{
+    return mSocket.state() == QLocalSocket::ConnectedState;
+}
+
+double TimeLineStreamClient::runLoad(const QString& name, const quint64& eventCount, const int& taskCount)
+{
+    Q_ASSERT(taskCount > 0);
+
+    TimeLineStreamClient client;
+    if (taskCount <= 0 || !client.connectToServer(name)){
+        return -1;
+    }
+
+    const QByteArray payloads[] = {"load step 1", "load step 2", "load step 3", "load step 4"};
+    const qint64 startTime = QDateTime::currentMSecsSinceEpoch() * 1000;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int task = 0; task < taskCount; ++task){
+        client.sendTask(task + 1, startTime, TimeLineTime::mInvalidTime, true, QString("Load task %1").arg(task + 1), TASK_TYPE_TEST_EXAMPLE);
+    }
+
+    // Every task gets an event each 10 usec
+    for (quint64 event = 0; event < eventCount; ++event)
+    {
+        qint64 eventTime = startTime + qint64(event / taskCount) * 10;
+        if (!client.sendEvent(event % taskCount + 1, eventTime, eventTime + 8, EventItem::EVENT_STATUS_SUCCEDED, 0, payloads[event % 4])){
+            return -1;
+        }
+    }
+
+    // Sending is done once the bytes are in the socket, the server may still be parsing them
+    quint64 receivedEvents = 0;
+    if (!client.sync(receivedEvents) || receivedEvents != eventCount){
+        return -1;
+    }
+
+    double seconds = std::max<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+    client.disconnectFromServer();
+
+    return eventCount / seconds;
+}
@@ -0,0 +1,142 @@
+#ifndef TIMELINESTREAM_H
+#define TIMELINESTREAM_H
+
+#include <QtEndian>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include "timeline.h"
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////            TimeLineStreamServer         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* Tasks and events streamed by collectors over local sockets. Every message is a little endian
+* u32 length of the rest, a u8 MessageType and its fields; see TimeLineStreamClient for the encoding.
+* Messages are parsed in place from a per-connection buffer, events are taken into the storage in
+* batches. A client sending a malformed or oversized message is disconnected
+*/
+
+class TimeLineStreamServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum MessageType
+    {
+        MESSAGE_TASK = 1,                                     // u64 taskId, i64 startTime, i64 endTime, u8 flags (1 - infinite), u32 taskType, u16 nameSize, name
+        MESSAGE_EVENT = 2,                                    // u64 taskId, u64 eventId, i64 startTime, i64 endTime, u8 status, u16 payloadSize, payload
+        MESSAGE_SYNC = 3                                      // No fields. Answered once the events before it are in the storage: u64 events received from the client
+    };
+
+    static const int mLengthSize = 4;
+    static const int mTaskSize = 1 + 8 + 8 + 8 + 1 + 4 + 2;   // Message length without the name
+    static const int mEventSize = 1 + 8 + 8 + 8 + 8 + 1 + 2;  // Message length without the payload
+    static const int mSyncSize = 1;
+    static const int mSyncReplySize = 1 + 8;
+    static const int mMaxMessageSize = 64 * 1024;
+
+private:
+    struct Connection
+    {
+        QLocalSocket* socket;
+        QByteArray buffer;                                    // Allocated once, unparsed bytes at the start
+        int bufferedSize;
+        quint64 receivedEvents;
+        QHash<QByteArray, quint32> payloadIds;                // Recent payloads of the client, saves interning them again
+        QByteArray payloadKey;                                // Points to the payload being looked up, its header is reused
+
+        Connection() : socket(nullptr), bufferedSize(0), receivedEvents(0){}
+    };
+
+    TaskStoragePtr mTaskStorage;
+    QLocalServer* mServer;
+    QHash<QLocalSocket*, Connection> mConnections;
+    QVector<QPair<quint64, EventItemPtr>> mEventBatch;       // Reused between batches
+    int mBatchSize;
+    quint64 mReceivedTasks;
+    quint64 mReceivedEvents;
+    quint64 mProtocolErrors;
+
+    int parse(Connection& connection);                        // Returns the bytes parsed, -1 - a protocol error
+    bool parseTask(const uchar* data, const int& size);
+    bool parseEvent(Connection& connection, const uchar* data, const int& size);
+    bool parseSync(Connection& connection, const int& size);
+    void flushEvents();
+
+public:
+    TimeLineStreamServer(TaskStoragePtr taskStorage, QObject* parent = 0);
+    ~TimeLineStreamServer();
+
+    //setters
+    bool listen(const QString& name);                         // A stale server with the name is removed first
+    void close();                                             // Disconnects the clients
+    void setBatchSize(const int& batchSize);                  // Events added to the storage at a time, 8192 by default
+
+    //getters
+    bool isListening() const;
+    int getConnectionCount() const;
+    quint64 getReceivedTasks() const;
+    quint64 getReceivedEvents() const;
+    quint64 getProtocolErrors() const;
+    QString getErrorString() const;
+
+    private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+
+signals:
+    void protocolError(QString message);                      // The client was disconnected
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///////////////            TimeLineStreamClient         //////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+* The collector's end of TimeLineStreamServer. Messages are encoded into a buffer and written
+* in large chunks. runLoad() streams synthetic events to measure the server's ingestion rate,
+* the time is taken until the server confirms with MESSAGE_SYNC that it has stored all of them
+*/
+
+class TimeLineStreamClient
+{
+private:
+    QLocalSocket mSocket;
+    QByteArray mBuffer;
+    int mFlushSize;
+
+    void beginMessage(const int& size, const TimeLineStreamServer::MessageType& type);
+
+public:
+    TimeLineStreamClient(const int& flushSize = 64 * 1024);  // Bytes buffered before they are written
+
+    //setters
+    bool connectToServer(const QString& name, const int& timeout = 3000);             // msec
+    void disconnectFromServer();                              // Flushes first
+    bool sendTask(const quint64& taskId,
+                  const qint64& startTime,
+                  const qint64& endTime,
+                  const bool& isInfinite = false,
+                  const QString& taskName = QString(),
+                  const TimeLineTaskType& taskType = TL_TASK_TYPE_INVALID);                // usec since epoch. False if the connection is lost
+    bool sendEvent(const quint64& taskId,
+                   const qint64& startTime,
+                   const qint64& endTime,
+                   const EventItem::EventStatus& status,
+                   const quint64& eventId = 0,
+                   const QByteArray& payload = QByteArray());                              // usec since epoch, UTF-8 payload. False if the connection is lost
+    bool flush(const int& timeout = 3000);                    // Waits until the buffered messages are written
+    bool sync(quint64& receivedEvents, const int& timeout = 30000);                   // msec, waits until the server has taken the events sent so far
+
+    //getters
+    bool isConnected() const;
+
+    static double runLoad(const QString& name,
+                          const quint64& eventCount,
+                          const int& taskCount = 64);                                          // Events per second taken by the server, -1 if it can't be reached or lost events
+};
+
+#endif // TIMELINESTREAM_H